@@ -0,0 +1,162 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ArenaBench.cpp
+//
+//      Runs a script of filters, dithers and layout changes over 1000
+//  images and counts the memory it takes: operator new calls, scratch
+//  arena heap allocations and high water mark, and the resident set.
+//  Before the scratch arena each of these operations allocated, and most
+//  leaked, full frame buffers, so the footprint grew with every image;
+//  now it should level off after the first.  Run by make bench.  Optional
+//  arguments set the image count, width and height.  Returns 0 if the 
+//  images after the first left no memory behind and the arena stopped 
+//  touching the heap.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "CheckImages.h"
+#include <new>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef __linux__
+    #include <unistd.h>
+#endif
+
+using namespace std;
+
+// constants
+const int       c_aiCheckpoints[]   = { 1, 10, 100, 1000, 10000 };     // image counts reported at
+
+static atomic<size_t>   s_newCalls(0);          // operator new calls so far
+static atomic<long>     s_liveBlocks(0);        // operator new blocks not yet deleted
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Counting operator new and delete.  Array forms go through these.
+//
+///////////////////////////////////////////////////////////////////////////////
+void* operator new(size_t bytes)
+{
+    void    *block = malloc(bytes ? bytes : 1);
+
+    if (!block)
+        throw bad_alloc();
+    s_newCalls++;
+    s_liveBlocks++;
+    return block;
+}// operator new
+
+void operator delete(void* block) noexcept
+{
+    if (block)
+    {
+        s_liveBlocks--;
+        free(block);
+    }
+}// operator delete
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Resident set size in MB, or -1 where it cannot be read.
+//
+///////////////////////////////////////////////////////////////////////////////
+static double Resident_MB()
+{
+#ifdef __linux__
+    FILE    *statm = fopen("/proc/self/statm", "r");
+    long    pages = 0, resident = -1;
+
+    if (statm)
+    {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+            resident = -1;
+        fclose(statm);
+    }
+    return resident < 0 ? -1 : (double)resident * sysconf(_SC_PAGESIZE) / (1 << 20);
+#else
+    return -1;
+#endif
+}// Resident_MB
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the script over one image, as a batch job would: load, filter
+//  planar, dither and filter interleaved, convert for display.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Run_Script(int width, int height, unsigned int seed, unsigned char* rgb)
+{
+    TargaImage  image(width, height);
+
+    Fill_Premultiplied(&image, seed);
+    image.Set_Planar(true);
+    image.Filter_Box();
+    image.Filter_Bartlett();
+    image.Filter_Gaussian();
+    image.Set_Planar(false);
+    image.Dither_Bright();
+    image.Filter_Edge();
+    image.To_RGB(rgb);
+}// Run_Script
+
+
+int main(int argc, char* argv[])
+{
+    int             images = argc > 1 ? atoi(argv[1]) : 1000;
+    int             width = argc > 3 ? atoi(argv[2]) : 320, height = argc > 3 ? atoi(argv[3]) : 240;
+    unsigned char   *rgb = new unsigned char[(size_t)width * height * 3];
+    long            liveBefore = s_liveBlocks, liveAfterFirst = 0;
+    size_t          newBefore = s_newCalls, lastNew = s_newCalls;
+    size_t          heapAtHalf = 0;
+    int             lastImages = 0, checkpoint = 0, failures = 0;
+
+    printf("%d images of %dx%d, %d threads\n", images, width, height, TargaImage::Get_Thread_Count());
+    printf("%7s %10s %10s %10s %11s %11s %9s\n", "images", "new/image", "live new", "arena heap", "high water", "arena cache", "resident");
+    for (int i = 1 ; i <= images ; i++)
+    {
+        Run_Script(width, height, i, rgb);
+
+        ScratchStats    stats = TargaImage::Get_Scratch_Stats();
+
+        if (stats.inUse)
+        {
+            printf("image %d left %d scratch bytes in use\n", i, (int)stats.inUse);
+            failures++;
+        }
+        if (i == 1)
+            liveAfterFirst = s_liveBlocks;
+        if (i == images / 2)
+            heapAtHalf = stats.heapAllocs;
+        if (i == images || i == c_aiCheckpoints[checkpoint])
+        {
+            printf("%7d %10.1f %10ld %10d %8.1f MB %8.1f MB %6.1f MB\n", i,
+                   (double)(s_newCalls - lastNew) / (i - lastImages), s_liveBlocks - liveBefore,
+                   (int)stats.heapAllocs, stats.highWater / 1048576.0, stats.cached / 1048576.0, Resident_MB());
+            lastNew = s_newCalls;
+            lastImages = i;
+            if (i == c_aiCheckpoints[checkpoint])
+                checkpoint++;
+        }
+    }
+
+    ScratchStats    stats = TargaImage::Get_Scratch_Stats();
+
+    if (s_liveBlocks != liveAfterFirst)
+    {
+        printf("%ld operator new blocks were not deleted\n", s_liveBlocks - liveAfterFirst);
+        failures++;
+    }
+    if (images > 1 && stats.heapAllocs != heapAtHalf)
+    {
+        printf("the arena went to the heap %d times in the second half\n", (int)(stats.heapAllocs - heapAtHalf));
+        failures++;
+    }
+    printf("%d operator new calls in all\n", (int)(s_newCalls - newBefore));
+    delete[] rgb;
+    printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}// main
@@ -0,0 +1,62 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      CheckImages.cpp
+//
+//      Test images shared by the standalone check and benchmark programs.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "CheckImages.h"
+#include <math.h>
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fill an image with repeatable premultiplied pixels.  An eighth of
+//  the pixels are fully transparent and an eighth opaque, so special cases
+//  on either alpha get exercised.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Fill_Premultiplied(TargaImage* pImage, unsigned int seed)
+{
+    for (int i = 0 ; i < pImage->width * pImage->height ; i++)
+    {
+        unsigned char   *pixel = pImage->data + (size_t)i * 4;
+
+        seed = seed * 1103515245 + 12345;
+        switch ((seed >> 16) & 7)
+        {
+            case 0:     pixel[3] = 0;                               break;
+            case 1:     pixel[3] = 255;                             break;
+            default:    pixel[3] = (unsigned char)(seed >> 24);     break;
+        }
+        for (int c = 0 ; c < 3 ; c++)
+        {
+            seed = seed * 1103515245 + 12345;
+            pixel[c] = (unsigned char)((seed >> 16) % (pixel[3] + 1));
+        }
+    }
+}// Fill_Premultiplied
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fill an image with an opaque synthetic picture: smooth red and 
+//  green waves with a little noise, and a sharp blue pattern.  It has 
+//  many more colors than a palette holds, spread unevenly.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Fill_Synthetic(TargaImage* pImage, unsigned int seed)
+{
+    for (int y = 0 ; y < pImage->height ; y++)
+        for (int x = 0 ; x < pImage->width ; x++)
+        {
+            unsigned char   *pixel = pImage->data + ((size_t)y * pImage->width + x) * 4;
+
+            seed = seed * 1103515245 + 12345;
+            pixel[0] = (unsigned char)((int)(127 + 120 * sin(x * 0.05)) ^ ((seed >> 16) & 15));
+            pixel[1] = (unsigned char)((int)(127 + 120 * cos(y * 0.03)) ^ ((seed >> 24) & 31));
+            pixel[2] = (unsigned char)((x ^ y) & 255);
+            pixel[3] = 255;
+        }
+}// Fill_Synthetic
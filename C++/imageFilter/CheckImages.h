@@ -0,0 +1,51 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      CheckImages.h
+//
+//      Test images and timing shared by the standalone check and 
+//  benchmark programs.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef _CHECK_IMAGES_H_
+#define _CHECK_IMAGES_H_
+
+#include "TargaImage.h"
+#include <chrono>
+
+// sizes every check runs at: odd widths leave SIMD tails, 1x1 is the
+// smallest image
+const int       c_aiCheckSizes[][2] = { { 33, 17 }, { 1, 1 }, { 257, 130 } };
+const int       c_nCheckSizes       = sizeof(c_aiCheckSizes) / sizeof(c_aiCheckSizes[0]);
+
+void Fill_Premultiplied(TargaImage* pImage, unsigned int seed);    // repeatable random premultiplied pixels
+void Fill_Synthetic(TargaImage* pImage, unsigned int seed);        // opaque waves, noise and a pattern, like a photo
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Best time in milliseconds of runs calls of operation, each on a 
+//  fresh copy of source.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<typename Operation> double Best_Ms(const TargaImage& source, int runs, Operation operation)
+{
+    double  best = 0;
+
+    for (int run = 0 ; run < runs ; run++)
+    {
+        TargaImage                              image(source);
+        std::chrono::steady_clock::time_point   start = std::chrono::steady_clock::now();
+
+        operation(&image);
+
+        double  ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        if (run == 0 || ms < best)
+            best = ms;
+    }
+    return best;
+}// Best_Ms
+
+#endif
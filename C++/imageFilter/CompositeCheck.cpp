@@ -0,0 +1,295 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      CompositeCheck.cpp
+//
+//      Checks the Comp_* operators on random premultiplied images against
+//  the float loops they replaced and against exactly rounded Porter-Duff
+//  sums, then times both.  Run by make check.  An optional width and 
+//  height set the size of the timed images.  Returns 0 if every check 
+//  passed.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "CheckImages.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+// constants
+const char*     c_asNames[]         = { "over", "in", "out", "atop", "xor" };
+const int       c_nOps              = 5;
+const int       c_nRuns             = 5;        // timed runs, the best is reported
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The float loops the Comp_* operators used before, one pixel of A
+//  (this image) with one of B (the given one), A updated in place.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Float_Over(unsigned char* a, const unsigned char* b)
+{
+    float   alpha = (float)a[3] / 255;
+
+    for (int c = 0 ; c < 4 ; c++)
+        a[c] = a[c] + (1 - alpha) * b[c];
+}// Float_Over
+
+static void Float_In(unsigned char* a, const unsigned char* b)
+{
+    float   alpha = (float)b[3] / 255;
+
+    if (alpha == 0)
+        memcpy(a, b, 4);
+    if (alpha != 0 && alpha != 1)
+        for (int c = 0 ; c < 4 ; c++)
+            a[c] = alpha * a[c];
+}// Float_In
+
+static void Float_Out(unsigned char* a, const unsigned char* b)
+{
+    float   alpha = (float)b[3] / 255;
+
+    if (alpha == 1)
+        memset(a, 0, 4);
+    if (alpha != 0 && alpha != 1)
+        for (int c = 0 ; c < 4 ; c++)
+            a[c] = (1 - alpha) * a[c];
+}// Float_Out
+
+static void Float_Atop(unsigned char* a, const unsigned char* b)
+{
+    float   alpha_g = (float)b[3] / 255, alpha_f = (float)a[3] / 255;
+
+    for (int c = 0 ; c < 4 ; c++)
+    {
+        if (alpha_g == 0)
+            a[c] = alpha_f != 1 ? (unsigned char)((1 - alpha_f) * b[c]) : 0;
+        else if (alpha_f == 1)
+            a[c] = alpha_g * a[c];
+        else
+            a[c] = alpha_g * a[c] + (1 - alpha_f) * b[c];
+    }
+}// Float_Atop
+
+static void Float_Xor(unsigned char* a, const unsigned char* b)
+{
+    float   alpha_g = (float)b[3] / 255, alpha_f = (float)a[3] / 255;
+
+    for (int c = 0 ; c < 4 ; c++)
+        a[c] = (1 - alpha_g) * a[c] + (1 - alpha_f) * b[c];
+}// Float_Xor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run operator op the old way over whole images.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Float_Composite(int op, TargaImage* pA, TargaImage* pB)
+{
+    static void (* const s_apOps[])(unsigned char*, const unsigned char*) =
+        { Float_Over, Float_In, Float_Out, Float_Atop, Float_Xor };
+
+    for (size_t i = 0 ; i < (size_t)pA->width * pA->height * 4 ; i += 4)
+        s_apOps[op](pA->data + i, pB->data + i);
+}// Float_Composite
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      One sample of operator op as A * Fa + B * Fb over 255, rounded to
+//  nearest and clamped.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int Exact_Sample(int op, int a, int b, int alphaA, int alphaB)
+{
+    const int   aiFa[] = { 255, alphaB, 255 - alphaB, alphaB, 255 - alphaB };
+    const int   aiFb[] = { 255 - alphaA, 0, 0, 255 - alphaA, 255 - alphaA };
+    int         sum = a * aiFa[op] + b * aiFb[op];
+
+    return sum >= 255 * 255 ? 255 : (2 * sum + 255) / 510;
+}// Exact_Sample
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run operator op through TargaImage.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Composite(int op, TargaImage* pA, TargaImage* pB)
+{
+    switch (op)
+    {
+        case 0:     return pA->Comp_Over(pB);
+        case 1:     return pA->Comp_In(pB);
+        case 2:     return pA->Comp_Out(pB);
+        case 3:     return pA->Comp_Atop(pB);
+        case 4:     return pA->Comp_Xor(pB);
+    }
+    return false;
+}// Composite
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Check operator op on one pair of images: it must round exactly, be
+//  within 1 of the float code, and give the same bytes planar.  Return
+//  the number of failed checks.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int Check_Op(int op, TargaImage* pA, TargaImage* pB, int& maxDiff, long long& differ)
+{
+    TargaImage  result(*pA), old(*pA), planar(*pA), planarB(*pB);
+    size_t      count = (size_t)pA->width * pA->height * 4;
+    int         failures = 0;
+
+    Composite(op, &result, pB);
+    Float_Composite(op, &old, pB);
+    planar.Set_Planar(true);
+    planarB.Set_Planar(true);
+    Composite(op, &planar, &planarB);
+    planar.Set_Planar(false);
+
+    for (size_t i = 0 ; i < count ; i++)
+    {
+        size_t  pixel = i & ~(size_t)3;
+        int     exact = Exact_Sample(op, pA->data[i], pB->data[i], pA->data[pixel + 3], pB->data[pixel + 3]);
+        int     diff = abs(result.data[i] - old.data[i]);
+
+        if (result.data[i] != exact)
+        {
+            if (!failures)
+                printf("%s %dx%d sample %d is %d, not %d\n", c_asNames[op], pA->width, pA->height,
+                       (int)i, result.data[i], exact);
+            failures++;
+        }
+        if (diff > maxDiff)
+            maxDiff = diff;
+        if (diff)
+            differ++;
+    }
+    if (maxDiff > 1)
+    {
+        printf("%s %dx%d is %d from the float code\n", c_asNames[op], pA->width, pA->height, maxDiff);
+        failures++;
+    }
+    if (memcmp(result.data, planar.data, count))
+    {
+        printf("%s %dx%d differs planar\n", c_asNames[op], pA->width, pA->height);
+        failures++;
+    }
+    return failures;
+}// Check_Op
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Comp_In with a fully transparent B.  Premultiplied, B is all zero
+//  and both versions give zero; with colour left in B the float code
+//  copied it, and now A is cleared.  Return the number of failed checks.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int Check_Transparent_In()
+{
+    TargaImage  a(64, 4), b(64, 4), old(64, 4);
+    size_t      count = (size_t)a.width * a.height * 4;
+    int         failures = 0;
+
+    for (int premultiplied = 1 ; premultiplied >= 0 ; premultiplied--)
+    {
+        Fill_Premultiplied(&a, 11);
+        for (size_t i = 0 ; i < count ; i++)
+            b.data[i] = (premultiplied || (i & 3) == 3) ? 0 : (unsigned char)(i * 7);
+        memcpy(old.data, a.data, count);
+        a.Comp_In(&b);
+        Float_Composite(1, &old, &b);
+
+        for (size_t i = 0 ; i < count ; i++)
+            if (a.data[i] || (premultiplied && old.data[i]))
+            {
+                printf("in with transparent %s B: sample %d is %d, float %d\n",
+                       premultiplied ? "premultiplied" : "coloured", (int)i, a.data[i], old.data[i]);
+                failures++;
+                break;
+            }
+    }
+    return failures;
+}// Check_Transparent_In
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Best time of c_nRuns runs of operator op, new or float, in ms.
+//
+///////////////////////////////////////////////////////////////////////////////
+static double Time_Op(int op, bool useFloat, TargaImage* pA, TargaImage* pB)
+{
+    double  best = 0;
+
+    for (int run = 0 ; run < c_nRuns ; run++)
+    {
+        TargaImage                          image(*pA);
+        chrono::steady_clock::time_point    start = chrono::steady_clock::now();
+
+        if (useFloat)
+            Float_Composite(op, &image, pB);
+        else
+            Composite(op, &image, pB);
+
+        double  ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        if (run == 0 || ms < best)
+            best = ms;
+    }
+    return best;
+}// Time_Op
+
+
+int main(int argc, char* argv[])
+{
+    int         width = argc > 2 ? atoi(argv[1]) : 2000, height = argc > 2 ? atoi(argv[2]) : 1500;
+    int         failures = 0;
+
+    for (int op = 0 ; op < c_nOps ; op++)
+    {
+        int         maxDiff = 0;
+        long long   differ = 0, samples = 0;
+
+        for (int s = 0 ; s < c_nCheckSizes ; s++)
+        {
+            TargaImage  a(c_aiCheckSizes[s][0], c_aiCheckSizes[s][1]), b(c_aiCheckSizes[s][0], c_aiCheckSizes[s][1]);
+
+            Fill_Premultiplied(&a, 1 + s);
+            Fill_Premultiplied(&b, 101 + s);
+            failures += Check_Op(op, &a, &b, maxDiff, differ);
+            samples += (long long)a.width * a.height * 4;
+        }
+        printf("%-5s max %d from float, %.1f%% of samples differ\n", c_asNames[op], maxDiff, 100.0 * differ / samples);
+    }
+    failures += Check_Transparent_In();
+
+    if (width > 0 && height > 0)
+    {
+        TargaImage  a(width, height), b(width, height);
+        double      megabytes = (double)width * height * 8 / (1 << 20);
+
+        Fill_Premultiplied(&a, 1);
+        Fill_Premultiplied(&b, 2);
+        TargaImage::Set_Thread_Count(1);
+        printf("%dx%d, one thread:\n", width, height);
+        for (int op = 0 ; op < c_nOps ; op++)
+        {
+            double  ms = Time_Op(op, false, &a, &b), floatMs = Time_Op(op, true, &a, &b);
+
+            printf("%-5s %7.1f ms %7.0f MB/s   float %7.1f ms %7.0f MB/s\n", c_asNames[op],
+                   ms, megabytes * 1000 / ms, floatMs, megabytes * 1000 / floatMs);
+        }
+    }
+
+    printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}// main
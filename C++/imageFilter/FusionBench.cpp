@@ -0,0 +1,101 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      FusionBench.cpp
+//
+//      Times scripts of point operations around a filter run by
+//  CScriptPlan with fusion off, one command after another as before the
+//  plans were fused, and on, as single passes.  The two outputs are
+//  checked byte for byte.  Run by make bench.  An optional width and
+//  height set the image size.  Returns 0 if fused and unfused output
+//  were the same for every script.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "CheckImages.h"
+#include "ScriptPlan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// constants
+const char*     c_aasScripts[][4]   = { { "gray", "filter-gauss-n 5", "dither-thresh", NULL },
+                                        { "quant-unif", "filter-box", "gray", NULL },
+                                        { "gray", "filter-gauss", NULL, NULL },
+                                        { "dither-thresh", "filter-gauss-n 9", "quant-unif", NULL } };
+const int       c_nScripts          = sizeof(c_aasScripts) / sizeof(c_aasScripts[0]);
+const int       c_nRuns             = 3;        // timed runs, the best is reported
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Best time in milliseconds of the plan on copies of source.  The
+//  output of the last run is left in result, which the caller deletes.
+//
+///////////////////////////////////////////////////////////////////////////////
+static double Plan_Ms(const CScriptPlan& plan, const TargaImage& source, TargaImage*& pResult)
+{
+    double  best = 0;
+
+    pResult = NULL;
+    for (int run = 0 ; run < c_nRuns ; run++)
+    {
+        TargaImage                              *pImage = new TargaImage(source);
+        std::chrono::steady_clock::time_point   start = std::chrono::steady_clock::now();
+
+        if (!plan.Run(pImage))
+            printf("the script failed\n");
+
+        double  ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        if (run == 0 || ms < best)
+            best = ms;
+        delete pResult;
+        pResult = pImage;
+    }
+    return best;
+}// Plan_Ms
+
+
+int main(int argc, char* argv[])
+{
+    int         width = argc > 2 ? atoi(argv[1]) : 4000, height = argc > 2 ? atoi(argv[2]) : 3000;
+    TargaImage  source(width, height);
+    int         failures = 0;
+
+    Fill_Synthetic(&source, 1);
+    printf("%dx%d, %d threads\n%-48s %10s %10s %7s\n", width, height, TargaImage::Get_Thread_Count(),
+           "script", "unfused ms", "fused ms", "passes");
+    for (int script = 0 ; script < c_nScripts ; script++)
+    {
+        CScriptPlan     plan;
+        std::string     sName;
+        TargaImage      *apResults[2];
+        double          ms[2];
+
+        for (int i = 0 ; i < 4 && c_aasScripts[script][i] ; i++)
+        {
+            plan.Parse_Command(c_aasScripts[script][i]);
+            sName += (i ? " -> " : "");
+            sName += c_aasScripts[script][i];
+        }
+        for (int fused = 0 ; fused < 2 ; fused++)
+        {
+            plan.Set_Fusion(fused != 0);
+            ms[fused] = Plan_Ms(plan, source, apResults[fused]);
+        }
+        printf("%-48s %10.1f %10.1f %7d\n", sName.c_str(), ms[0], ms[1], plan.Step_Count());
+        fflush(stdout);
+
+        if (apResults[0]->width != apResults[1]->width || apResults[0]->height != apResults[1]->height
+            || memcmp(apResults[0]->data, apResults[1]->data, (size_t)apResults[0]->width * apResults[0]->height * 4))
+        {
+            printf("%s differs fused\n", sName.c_str());
+            failures++;
+        }
+        delete apResults[0];
+        delete apResults[1];
+    }
+
+    printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}// main
@@ -0,0 +1,74 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      MedianBench.cpp
+//
+//      Measures the quantizers on a synthetic picture: PSNR against the
+//  original and ms per megapixel.  Before Quant_Median was implemented,
+//  palette jobs fell back to Quant_Populosity, so that and Quant_Uniform
+//  are the baselines.  Run by make bench.  An optional width and height
+//  set the size of the timed image.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "CheckImages.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// constants
+const char*     c_asNames[]         = { "uniform", "populosity", "median" };
+const int       c_nOps              = 3;
+const int       c_nRuns             = 3;        // timed runs, the best is reported
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run quantizer op on the image.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Run_Op(int op, TargaImage* pImage)
+{
+    switch (op)
+    {
+        case 0:     pImage->Quant_Uniform();        break;
+        case 1:     pImage->Quant_Populosity();     break;
+        case 2:     pImage->Quant_Median();         break;
+    }
+}// Run_Op
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      PSNR in dB of quantizer op on a copy of source.
+//
+///////////////////////////////////////////////////////////////////////////////
+static double Psnr(int op, TargaImage* pSource)
+{
+    TargaImage  quantized(*pSource);
+    DiffStats   stats;
+
+    Run_Op(op, &quantized);
+    quantized.Compare(pSource, stats);
+    return stats.psnr;
+}// Psnr
+
+
+int main(int argc, char* argv[])
+{
+    int         width = argc > 2 ? atoi(argv[1]) : 4000, height = argc > 2 ? atoi(argv[2]) : 3000;
+    TargaImage  small(400, 300), large(width, height);
+    double      megapixels = (double)width * height / 1e6;
+
+    Fill_Synthetic(&small, 1);
+    Fill_Synthetic(&large, 1);
+    printf("%-11s %13s %13s %10s %8s   %d threads\n", "", "PSNR 400x300", "PSNR large", "ms", "ms/MP",
+           TargaImage::Get_Thread_Count());
+    for (int op = 0 ; op < c_nOps ; op++)
+    {
+        double  ms = Best_Ms(large, c_nRuns, [op](TargaImage* pImage) { Run_Op(op, pImage); });
+
+        printf("%-11s %10.1f dB %10.1f dB %10.1f %8.2f\n", c_asNames[op], Psnr(op, &small), Psnr(op, &large),
+               ms, ms / megapixels);
+    }
+    printf("large is %dx%d\n", width, height);
+    return 0;
+}// main
@@ -0,0 +1,98 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      PoolCheck.cpp
+//
+//      Restarts the tile thread pool between jobs and runs jobs in a 
+//  serial scope, checking every job still gives the single threaded 
+//  result.  Meant to be run under ThreadSanitizer, as make tsan-check 
+//  does.  Returns 0 if every job matched.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "CheckImages.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// constants
+const int       c_aiThreadCounts[]  = { 8, 1, 3, 0, 2, 8 };     // pool sizes cycled through between jobs
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run operation op on a fresh image of the given size.
+//
+///////////////////////////////////////////////////////////////////////////////
+static TargaImage* Run_Op(int op, int width, int height)
+{
+    TargaImage  *pImage = new TargaImage(width, height);
+
+    Fill_Premultiplied(pImage, 7 + op);
+    switch (op)
+    {
+        case 0:     pImage->Quant_Populosity();     break;
+        case 1:     pImage->Filter_Bartlett();      break;
+        case 2:     pImage->Filter_Gaussian_N(9);   break;
+        case 3:     pImage->To_Grayscale();         break;
+        case 4:     pImage->Filter_Box(3);          break;
+        case 5:     pImage->Rotate(30);             break;
+        case 6:     pImage->Half_Size();            break;
+    }
+    return pImage;
+}// Run_Op
+
+
+int main()
+{
+    const int   ops = 7;
+    const int   counts = sizeof(c_aiThreadCounts) / sizeof(c_aiThreadCounts[0]);
+    int         failures = 0, jobs = 0;
+
+    for (int round = 0 ; round < 4 ; round++)
+        for (int s = 0 ; s < c_nCheckSizes ; s++)
+            for (int op = 0 ; op < ops ; op++)
+            {
+                int         width = c_aiCheckSizes[s][0], height = c_aiCheckSizes[s][1];
+                TargaImage  *pSerial, *pPooled;
+
+                TargaImage::Set_Thread_Count(1);
+                pSerial = Run_Op(op, width, height);
+                TargaImage::Set_Thread_Count(c_aiThreadCounts[jobs++ % counts]);
+                pPooled = Run_Op(op, width, height);
+
+                if (pSerial->width != pPooled->width || pSerial->height != pPooled->height ||
+                    memcmp(pSerial->data, pPooled->data, (size_t)pSerial->width * pSerial->height * 4))
+                {
+                    printf("op %d on %dx%d with %d threads differs\n", op, width, height, TargaImage::Get_Thread_Count());
+                    failures++;
+                }
+                delete pSerial;
+                delete pPooled;
+            }
+
+    // serial scopes run jobs on the calling thread without stopping the pool
+    for (int op = 0 ; op < ops ; op++)
+    {
+        TargaImage  *pSerial, *pScoped;
+
+        TargaImage::Set_Thread_Count(1);
+        pSerial = Run_Op(op, 257, 130);
+        TargaImage::Set_Thread_Count(4);
+        {
+            TargaImage::Serial_Scope    serial;
+
+            pScoped = Run_Op(op, 257, 130);
+        }
+        if (memcmp(pSerial->data, pScoped->data, (size_t)pSerial->width * pSerial->height * 4))
+        {
+            printf("op %d in a serial scope differs\n", op);
+            failures++;
+        }
+        delete pSerial;
+        delete pScoped;
+        jobs++;
+    }
+
+    printf("%d jobs, %d failed\n", 2 * jobs, failures);
+    return failures ? 1 : 0;
+}// main
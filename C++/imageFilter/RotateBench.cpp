@@ -0,0 +1,113 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      RotateBench.cpp
+//
+//      Times Rotate against a naive double precision inverse map, one
+//  output pixel at a time in row order, at 1K, 4K and 8K for a quarter
+//  turn and for 30 degrees.  Rotate was a stub that cleared the image,
+//  so the naive map stands in for the untiled version.  Quarter turns
+//  must match the naive map exactly and other angles within 1.  Run by
+//  make bench.  An optional argument sets the largest width.  Returns 0
+//  if every rotation matched.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "CheckImages.h"
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace std;
+
+// constants
+const int       c_aiSizes[][2]      = { { 1024, 1024 }, { 3840, 2160 }, { 7680, 4320 } };
+const int       c_nSizes            = sizeof(c_aiSizes) / sizeof(c_aiSizes[0]);
+const float     c_afAngles[]        = { 90, 30 };
+const int       c_nAngles           = 2;
+const int       c_nRuns             = 3;        // timed runs of Rotate, the best is reported
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Rotate source clockwise by angle degrees about its center into
+//  result, sampling bilinearly in double precision.  Corners rotated in
+//  are clear.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Naive_Rotate(const TargaImage& source, double angle, unsigned char* result)
+{
+    int     width = source.width, height = source.height;
+    double  radians = angle * 3.14159265358979323846 / 180;
+    double  c = cos(radians), s = sin(radians);
+    double  centerX = (width - 1) * 0.5, centerY = (height - 1) * 0.5;
+
+    for (int y = 0 ; y < height ; y++)
+        for (int x = 0 ; x < width ; x++)
+        {
+            double  dx = x - centerX, dy = y - centerY;
+            double  sourceX = centerX + dx * c + dy * s, sourceY = centerY - dx * s + dy * c;
+            int     left = (int)floor(sourceX), top = (int)floor(sourceY);
+            double  fx = sourceX - left, fy = sourceY - top;
+
+            for (int channel = 0 ; channel < 4 ; channel++)
+            {
+                double  value = 0;
+
+                for (int j = 0 ; j < 2 ; j++)
+                    for (int i = 0 ; i < 2 ; i++)
+                    {
+                        int     sx = left + i, sy = top + j;
+
+                        if (sx >= 0 && sy >= 0 && sx < width && sy < height)
+                            value += source.data[((size_t)sy * width + sx) * 4 + channel] * (i ? fx : 1 - fx) * (j ? fy : 1 - fy);
+                    }
+                result[((size_t)y * width + x) * 4 + channel] = (unsigned char)floor(value + 0.5);
+            }
+        }
+}// Naive_Rotate
+
+
+int main(int argc, char* argv[])
+{
+    int     maxWidth = argc > 1 ? atoi(argv[1]) : 7680;
+    int     failures = 0;
+
+    printf("%-10s %6s %10s %10s %8s   %d threads\n", "size", "angle", "naive ms", "Rotate ms", "max diff",
+           TargaImage::Get_Thread_Count());
+    for (int size = 0 ; size < c_nSizes && c_aiSizes[size][0] <= maxWidth ; size++)
+    {
+        int                     width = c_aiSizes[size][0], height = c_aiSizes[size][1];
+        TargaImage              source(width, height);
+        vector<unsigned char>   reference((size_t)width * height * 4);
+
+        Fill_Premultiplied(&source, width);
+        for (int angle = 0 ; angle < c_nAngles ; angle++)
+        {
+            chrono::steady_clock::time_point    start = chrono::steady_clock::now();
+
+            Naive_Rotate(source, c_afAngles[angle], reference.data());
+
+            double      naiveMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            TargaImage  rotated(source);
+            int         maxDiff = 0, allowed = fmod(c_afAngles[angle], 90) == 0 ? 0 : 1;
+
+            rotated.Rotate(c_afAngles[angle]);
+            for (size_t i = 0 ; i < reference.size() ; i++)
+                maxDiff = max(maxDiff, abs(reference[i] - rotated.data[i]));
+
+            double  ms = Best_Ms(source, c_nRuns, [angle](TargaImage* pImage) { pImage->Rotate(c_afAngles[angle]); });
+
+            printf("%4dx%-5d %6.0f %10.1f %10.1f %8d\n", width, height, c_afAngles[angle], naiveMs, ms, maxDiff);
+            fflush(stdout);
+            if (maxDiff > allowed)
+            {
+                printf("%dx%d by %g differs by %d\n", width, height, c_afAngles[angle], maxDiff);
+                failures++;
+            }
+        }
+    }
+
+    printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}// main
@@ -0,0 +1,112 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      SaveBench.cpp
+//
+//      Times Save_Image writing SAVE_RAW, the only format before, and
+//  SAVE_COMPACT on a noisy opaque picture and on the same picture run
+//  through Dither_Threshold, and reports MB/s of image and the file
+//  sizes.  The threshold is done before the timing.  Each compact file
+//  is loaded back and checked against the raw one.  Run by make bench.
+//  The first argument is the file to write, optional width and height
+//  follow.  Returns 0 if every compact file loaded back the same.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "CheckImages.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// constants
+const char*     c_asFormats[]       = { "raw", "compact" };
+const int       c_nRuns             = 5;        // timed runs, the best is reported
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Size of a file in MB, or -1 if it cannot be opened.
+//
+///////////////////////////////////////////////////////////////////////////////
+static double File_MB(const char* path)
+{
+    FILE    *file = fopen(path, "rb");
+    long    bytes = -1;
+
+    if (file)
+    {
+        if (fseek(file, 0, SEEK_END) == 0)
+            bytes = ftell(file);
+        fclose(file);
+    }
+    return bytes < 0 ? -1 : bytes / 1e6;
+}// File_MB
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time both formats on the image and print a row.  Returns the
+//  number of failures.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int Run_Image(const char* name, const TargaImage& source, char* path)
+{
+    double      megabytes = (double)source.width * source.height * 4 / 1e6;
+    TargaImage  *apLoaded[2] = { NULL, NULL };
+    int         failures = 0;
+
+    printf("%-12s", name);
+    for (int format = 0 ; format < 2 ; format++)
+    {
+        TargaImage::SaveFormat  saveFormat = format ? TargaImage::SAVE_COMPACT : TargaImage::SAVE_RAW;
+        bool                    saved = true;
+        double                  ms = Best_Ms(source, c_nRuns, [&](TargaImage* pImage) { saved = pImage->Save_Image(path, saveFormat) && saved; });
+
+        if (!saved)
+        {
+            printf("\ncould not write %s\n", path);
+            return 1;
+        }
+        printf("  %7.1f %7.1f %6.1f MB", ms, megabytes * 1000 / ms, File_MB(path));
+        apLoaded[format] = TargaImage::Load_Image(path);
+    }
+    printf("\n");
+
+    if (!apLoaded[0] || !apLoaded[1] || memcmp(apLoaded[0]->data, apLoaded[1]->data, (size_t)source.width * source.height * 4))
+    {
+        printf("%s compact file does not load back the same as raw\n", name);
+        failures++;
+    }
+    delete apLoaded[0];
+    delete apLoaded[1];
+    return failures;
+}// Run_Image
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        printf("usage: %s file.tga [width height]\n", argv[0]);
+        return 1;
+    }
+
+    int         width = argc > 3 ? atoi(argv[2]) : 4000, height = argc > 3 ? atoi(argv[3]) : 3000;
+    TargaImage  noisy(width, height);
+    int         failures = 0;
+
+    Fill_Synthetic(&noisy, 1);
+
+    TargaImage  thresholded(noisy);
+
+    thresholded.Dither_Threshold();
+    printf("%dx%d, %d threads; ms, MB/s of image and file size\n%-12s", width, height, TargaImage::Get_Thread_Count(), "");
+    for (int format = 0 ; format < 2 ; format++)
+        printf("  %25s", c_asFormats[format]);
+    printf("\n");
+    failures += Run_Image("noisy", noisy, argv[1]);
+    failures += Run_Image("thresholded", thresholded, argv[1]);
+
+    remove(argv[1]);
+    printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}// main
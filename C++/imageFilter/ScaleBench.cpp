@@ -0,0 +1,77 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ScaleBench.cpp
+//
+//      Times the filters, cluster dithering and the painterly filter on
+//  square images from 256 up to 8192 pixels a side, to show how their
+//  throughput scales with image size.  Before they were sized from the
+//  image they only worked at 400x400, so there is no earlier version to
+//  compare against.  Run by make bench.  An optional argument sets the
+//  largest side.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "CheckImages.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// constants
+const char*     c_asNames[]         = { "box", "bartlett", "gauss", "edge", "cluster", "paint" };
+const int       c_nOps              = 6;
+const int       c_nPaintMaxSide     = 1024;     // largest side the painterly filter is timed at, it grows faster than the image
+const int       c_nRunsMaxSide      = 2048;     // sides above this are timed once, not best of three
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run operation op on the image.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Run_Op(int op, TargaImage* pImage)
+{
+    switch (op)
+    {
+        case 0:     pImage->Filter_Box();           break;
+        case 1:     pImage->Filter_Bartlett();      break;
+        case 2:     pImage->Filter_Gaussian();      break;
+        case 3:     pImage->Filter_Edge();          break;
+        case 4:     pImage->Dither_Cluster();       break;
+        case 5:     pImage->NPR_Paint();            break;
+    }
+}// Run_Op
+
+
+int main(int argc, char* argv[])
+{
+    int     maxSide = argc > 1 ? atoi(argv[1]) : 8192;
+
+    printf("%-6s", "side");
+    for (int op = 0 ; op < c_nOps ; op++)
+        printf("  %15s", c_asNames[op]);
+    printf("    ms and MP/s, %d threads\n", TargaImage::Get_Thread_Count());
+
+    for (int side = 256 ; side <= maxSide ; side *= 2)
+    {
+        TargaImage  source(side, side);
+        double      megapixels = (double)side * side / 1e6;
+        int         runs = side > c_nRunsMaxSide ? 1 : 3;
+
+        Fill_Premultiplied(&source, side);
+        printf("%-6d", side);
+        for (int op = 0 ; op < c_nOps ; op++)
+        {
+            if (op == 5 && side > c_nPaintMaxSide)
+            {
+                printf("  %15s", "-");
+                continue;
+            }
+
+            double  ms = Best_Ms(source, runs, [op](TargaImage* pImage) { Run_Op(op, pImage); });
+
+            printf("  %7.1f %7.1f", ms, megapixels * 1000 / ms);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+    return 0;
+}// main
@@ -0,0 +1,1318 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ScriptPlan.cpp
+//
+//      Implementation of CScriptPlan and CScriptBatch methods.
+//
+//      A plan is compiled into steps as it is parsed.  Runs of per pixel
+//  commands (gray, quant-unif, dither-thresh, dither-rand) and at most one
+//  convolution filter among them are fused into a single pass over the
+//  image, see TargaImage::Run_Pass; every other command is a step of its
+//  own.  Runs may be profiled a step at a time, see CScriptProfile.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "ScriptPlan.h"
+#include <iostream>
+#include <fstream>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <dirent.h>
+#endif
+
+using namespace std;
+
+// constants
+const int       c_maxScriptDepth        = 16;                           // deepest nesting of run commands
+const int       c_queuedPerThread       = 2;                            // images waiting between stages, per worker
+const char      c_sWhiteSpace[]         = " \t\n\r";
+const char      c_asCommands[][32]      = { "load",                     // valid commands, as CScriptHandler
+                                            "save",
+                                            "run",
+                                            "gray",
+                                            "quant-unif",
+                                            "quant-pop",
+                                            "dither-thresh",
+                                            "dither-rand",
+                                            "dither-fs",
+                                            "dither-bright",
+                                            "dither-cluster",
+                                            "dither-pattern",
+                                            "dither-color",
+                                            "filter-box",
+                                            "filter-bartlett",
+                                            "filter-gauss",
+                                            "filter-gauss-n",
+                                            "filter-edge",
+                                            "filter-enhance",
+                                            "npr-paint",
+                                            "half",
+                                            "double",
+                                            "scale",
+                                            "comp-over",
+                                            "comp-in",
+                                            "comp-out",
+                                            "comp-atop",
+                                            "comp-xor",
+                                            "diff",
+                                            "rotate"
+                                          };
+
+enum ECommands          // command ids
+{
+    LOAD,
+    SAVE,
+    RUN,
+    GRAY,
+    QUANT_UNIF,
+    QUANT_POP,
+    DITHER_THRESH,
+    DITHER_RAND,
+    DITHER_FS,
+    DITHER_BRIGHT,
+    DITHER_CLUSTER,
+    DITHER_PATTERN,
+    DITHER_COLOR,
+    FILTER_BOX,
+    FILTER_BARTLETT,
+    FILTER_GAUSS,
+    FILTER_GAUSS_N,
+    FILTER_EDGE,
+    FILTER_ENHANCE,
+    NPR_PAINT,
+    HALF,
+    DOUBLE,
+    SCALE,
+    COMP_OVER,
+    COMP_IN,
+    COMP_OUT,
+    COMP_ATOP,
+    COMP_XOR,
+    DIFF,
+    ROTATE,
+    NUM_COMMANDS
+};// ECommands
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor and destructor.  The plan owns the operand images of its
+//  commands.
+//
+///////////////////////////////////////////////////////////////////////////////
+CScriptPlan::CScriptPlan() : m_bFuse(true)
+{}// CScriptPlan
+
+CScriptPlan::~CScriptPlan()
+{
+    Clear();
+}// ~CScriptPlan
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Remove all commands.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CScriptPlan::Clear()
+{
+    for (size_t i = 0 ; i < m_commands.size() ; i++)
+        delete m_commands[i].pOperand;
+    m_commands.clear();
+    m_steps.clear();
+}// Clear
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Parse a command string and append it to the plan.  Arguments are
+//  checked now rather than when the plan runs: the images of comp-* and
+//  diff are loaded once, and the scripts named by run are parsed in place.
+//  If the command could not be parsed an error message is displayed and
+//  false is returned.  Blank commands are skipped.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptPlan::Parse_Command(const char* sCommand)
+{
+    return Parse_Command(sCommand, 0);
+}// Parse_Command
+
+bool CScriptPlan::Parse_Command(const char* sCommand, int depth)
+{
+    if (!sCommand)
+        return true;
+
+    vector<char>    commandLine(sCommand, sCommand + strlen(sCommand) + 1);
+    char            *sToken = strtok(&commandLine[0], c_sWhiteSpace);
+
+    if (!sToken)
+        return true;
+
+    // find command that was given
+    int command;
+    for (command = 0; command < NUM_COMMANDS; ++command)
+        if (!strcmp(sToken, c_asCommands[command]))
+            break;
+
+    CScriptCommand  parsed = { command, "", 0, NULL };
+    char            *sArgument = strtok(NULL, c_sWhiteSpace);
+
+    if (sArgument)
+        parsed.sArgument = sArgument;
+
+    switch (command)
+    {
+        case LOAD:
+        case SAVE:
+        {
+            if (!sArgument)
+            {
+                cout << "No filename given." << endl;
+                return false;
+            }// if
+            break;
+        }// LOAD, SAVE
+
+        case RUN:
+        {
+            if (depth >= c_maxScriptDepth)
+            {
+                cout << "Scripts nested too deeply:  " << sCommand << endl;
+                return false;
+            }// if
+            return Parse_File(sArgument, depth + 1);
+        }// RUN
+
+        case GRAY:
+        case QUANT_UNIF:
+        case QUANT_POP:
+        case DITHER_THRESH:
+        case DITHER_RAND:
+        case DITHER_FS:
+        case DITHER_BRIGHT:
+        case DITHER_CLUSTER:
+        case DITHER_COLOR:
+        case FILTER_BARTLETT:
+        case FILTER_GAUSS:
+        case FILTER_EDGE:
+        case FILTER_ENHANCE:
+        case NPR_PAINT:
+        case HALF:
+        case DOUBLE:
+            break;
+
+        case FILTER_BOX:
+        {
+            int radius = sArgument ? atoi(sArgument) : 2;
+            if (radius < 0) {
+               cout << "Radius \"" << radius << "\" is not allowed; the radius cannot be negative." << endl;
+               return false;
+            }
+            parsed.value = (float)radius;
+            break;
+        }// FILTER_BOX
+
+        case FILTER_GAUSS_N:
+        {
+            int N = sArgument ? atoi(sArgument) : 0;
+            if (N % 2 != 1) {
+               cout << "N \"" << N << "\" is not allowed; N must be an odd number." << endl;
+               return false;
+            }
+            parsed.value = (float)N;
+            break;
+        }// FILTER_GAUSS_N
+
+        case SCALE:
+        {
+            if (!sArgument || (parsed.value = (float)atof(sArgument)) <= 0)
+            {
+                cout << "Invalid scaling factor." << endl;
+                return false;
+            }// if
+            break;
+        }// SCALE
+
+        case ROTATE:
+        {
+            if (!sArgument || !(parsed.value = (float)atof(sArgument)))
+            {
+                cout << "Invalid rotation angle." << endl;
+                return false;
+            }// if
+            break;
+        }// ROTATE
+
+        case COMP_OVER:
+        case COMP_IN:
+        case COMP_OUT:
+        case COMP_ATOP:
+        case COMP_XOR:
+        case DIFF:
+        {
+            if (!sArgument)
+            {
+                cout << "No filename given." << endl;
+                return false;
+            }// if
+            if (!(parsed.pOperand = TargaImage::Load_Image(sArgument)))
+            {
+                cout << "Unable to load image:  " << sArgument << endl;
+                return false;
+            }// if
+            break;
+        }// COMP_*, DIFF
+
+        default:
+        {
+            cout << "Unable to parse command:  " << sCommand << endl;
+            return false;
+        }// default
+    }// switch
+
+    m_commands.push_back(parsed);
+    Compile();
+
+    return true;
+}// Parse_Command
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Parse the given script file and append its commands to the plan.  If
+//  a line does not parse an error message is printed and false is
+//  returned; the commands before it stay in the plan.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptPlan::Parse_File(const char* sFilename)
+{
+    return Parse_File(sFilename, 0);
+}// Parse_File
+
+bool CScriptPlan::Parse_File(const char* sFilename, int depth)
+{
+    if (!sFilename)
+    {
+        cout << "No filename given." << endl;
+        return false;
+    }// if
+
+    ifstream inFile(sFilename);
+
+    if (!inFile.is_open())
+    {
+        cout << "Unable to open file:  " << sFilename << endl;
+        return false;
+    }// if
+
+    string  sLine;
+
+    while (getline(inFile, sLine))
+    {
+        if (!Parse_Command(sLine.c_str(), depth))
+            return false;
+    }// while
+
+    return true;
+}// Parse_File
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      True if the plan loads or saves the image itself, which a batch,
+//  where every image comes from and goes to its own file, cannot allow.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptPlan::Uses_Files() const
+{
+    for (size_t i = 0 ; i < m_commands.size() ; i++)
+    {
+        if (m_commands[i].command == LOAD || m_commands[i].command == SAVE)
+            return true;
+    }
+
+    return false;
+}// Uses_Files
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The per pixel operation a command runs, or the kernel of the filter
+//  it runs.  Return false if the command is not one of those.  The
+//  Bartlett, edge and enhance filters are left out: their own integer 
+//  engine runs faster on its own than their kernels do in a pass.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Point_Op(const CScriptCommand& command, TargaImage::PointOp& op)
+{
+    switch (command.command)
+    {
+        case GRAY:              op = TargaImage::POINT_GRAY;        return true;
+        case QUANT_UNIF:        op = TargaImage::POINT_QUANT_UNIF;  return true;
+        case DITHER_THRESH:     op = TargaImage::POINT_THRESHOLD;   return true;
+        case DITHER_RAND:       op = TargaImage::POINT_RANDOM;      return true;
+    }// switch
+
+    return false;
+}// Point_Op
+
+static bool Filter_Op(const CScriptCommand& command, vector<float>& taps, int& size)
+{
+    switch (command.command)
+    {
+        case FILTER_BOX:        return command.value == 2 && TargaImage::Filter_Taps(TargaImage::KERNEL_BOX, 0, taps, size);
+        case FILTER_GAUSS:      return TargaImage::Filter_Taps(TargaImage::KERNEL_GAUSSIAN_N, 5, taps, size);
+        case FILTER_GAUSS_N:    return !TargaImage::Gaussian_Uses_Boxes((unsigned int)command.value) &&
+                                       TargaImage::Filter_Taps(TargaImage::KERNEL_GAUSSIAN_N, (unsigned int)command.value, taps, size);
+    }// switch
+
+    return false;
+}// Filter_Op
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Turn fusion on or off.  Off, every command is a step of its own.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CScriptPlan::Set_Fusion(bool bFuse)
+{
+    m_bFuse = bFuse;
+    Compile();
+}// Set_Fusion
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Rebuild the steps from the commands.  Fusable commands join the 
+//  open pass until one cannot: a second filter, a second dither-rand, or
+//  a filter after a dither-rand, whose noise would be drawn again for the
+//  halo rows.  A pass of one command runs as that command.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CScriptPlan::Compile()
+{
+    CScriptStep     open = { 0, 0, true, FusedPass() };
+
+    open.pass.size = 0;
+    m_steps.clear();
+    for (int i = 0 ; i <= (int)m_commands.size() ; i++)
+    {
+        TargaImage::PointOp     op = TargaImage::POINT_GRAY;
+        vector<float>           taps;
+        int                     size = 0;
+        bool                    last = i == (int)m_commands.size();
+        bool                    point = !last && m_bFuse && Point_Op(m_commands[i], op);
+        bool                    filter = !last && m_bFuse && !point && Filter_Op(m_commands[i], taps, size);
+        FusedPass&              pass = open.pass;
+        bool                    random = find(pass.before.begin(), pass.before.end(), TargaImage::POINT_RANDOM) != pass.before.end() ||
+                                         find(pass.after.begin(), pass.after.end(), TargaImage::POINT_RANDOM) != pass.after.end();
+        bool                    joins = (point && !(op == TargaImage::POINT_RANDOM && random)) ||
+                                        (filter && pass.kernel.empty() && !random);
+
+        // close the open pass when this command cannot join it
+        if (open.count && !joins)
+        {
+            open.bFused = open.count > 1;
+            m_steps.push_back(open);
+            open.count = 0;
+            open.pass = FusedPass();
+            open.pass.size = 0;
+        }
+        if (last)
+            break;
+
+        if (point || filter)
+        {
+            if (!open.count)
+                open.first = i;
+            open.count++;
+            if (filter)
+            {
+                open.pass.kernel.swap(taps);
+                open.pass.size = size;
+            }
+            else if (open.pass.kernel.empty())
+                open.pass.before.push_back(op);
+            else
+                open.pass.after.push_back(op);
+            continue;
+        }
+
+        CScriptStep     step = { i, 1, false, FusedPass() };
+
+        m_steps.push_back(step);
+    }
+}// Compile
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Execute one parsed command on the given image.  Return success of
+//  the operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Run_Command(const CScriptCommand& command, TargaImage*& pImage)
+{
+    // if there's no image only load is valid
+    if (!pImage && command.command != LOAD)
+    {
+        cout << "No image to operate on.  Use \"load\" command to load image." << endl;
+        return false;
+    }// if
+
+    switch (command.command)
+    {
+        case LOAD:
+        {
+            vector<char>    sFilename(command.sArgument.begin(), command.sArgument.end());
+
+            sFilename.push_back(0);
+            delete pImage;
+            if (!(pImage = TargaImage::Load_Image(&sFilename[0])))
+            {
+                cout << "Unable to load image:  " << command.sArgument << endl;
+                return false;
+            }// if
+            return true;
+        }// LOAD
+
+        case SAVE:              return pImage->Save_Image(command.sArgument.c_str());
+        case GRAY:              return pImage->To_Grayscale();
+        case QUANT_UNIF:        return pImage->Quant_Uniform();
+        case QUANT_POP:         return pImage->Quant_Populosity();
+        case DITHER_THRESH:     return pImage->Dither_Threshold();
+        case DITHER_RAND:       return pImage->Dither_Random();
+        case DITHER_FS:         return pImage->Dither_FS();
+        case DITHER_BRIGHT:     return pImage->Dither_Bright();
+        case DITHER_CLUSTER:    return pImage->Dither_Cluster();
+        case DITHER_COLOR:      return pImage->Dither_Color();
+        case FILTER_BOX:        return pImage->Filter_Box((unsigned int)command.value);
+        case FILTER_BARTLETT:   return pImage->Filter_Bartlett();
+        case FILTER_GAUSS:      return pImage->Filter_Gaussian();
+        case FILTER_GAUSS_N:    return pImage->Filter_Gaussian_N((unsigned int)command.value);
+        case FILTER_EDGE:       return pImage->Filter_Edge();
+        case FILTER_ENHANCE:    return pImage->Filter_Enhance();
+        case NPR_PAINT:         return pImage->NPR_Paint();
+        case HALF:              return pImage->Half_Size();
+        case DOUBLE:            return pImage->Double_Size();
+        case SCALE:             return pImage->Resize(command.value);
+        case ROTATE:            return pImage->Rotate(command.value);
+        case COMP_OVER:         return pImage->Comp_Over(command.pOperand);
+        case COMP_IN:           return pImage->Comp_In(command.pOperand);
+        case COMP_OUT:          return pImage->Comp_Out(command.pOperand);
+        case COMP_ATOP:         return pImage->Comp_Atop(command.pOperand);
+        case COMP_XOR:          return pImage->Comp_Xor(command.pOperand);
+        case DIFF:              return pImage->Difference(command.pOperand);
+    }// switch
+
+    return false;
+}// Run_Command
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Times a step from construction to destruction and adds it to a
+//  profile, if there is one.  The image is followed by reference since a
+//  load replaces it.  Bytes are estimated as the image read once and
+//  written once, plus the operand read; allocations are the scratch blocks
+//  taken from the heap meanwhile by all threads.
+//
+///////////////////////////////////////////////////////////////////////////////
+class CStepTimer
+{
+    public:
+        CStepTimer(CScriptProfile* pProfile, int step, TargaImage* const& pImage, const TargaImage* pOperand)
+            : m_pProfile(pProfile), m_pImage(pImage)
+        {
+            if (!m_pProfile)
+                return;
+
+            m_event.step = step;
+            m_event.thread = 0;
+            m_event.start = m_pProfile->Seconds();
+            m_event.seconds = 0;
+            m_event.bFailed = false;
+            m_pixels = Pixels(pImage);
+            m_operandPixels = Pixels(pOperand);
+            m_allocations = TargaImage::Get_Scratch_Stats().heapAllocs;
+        }
+
+        ~CStepTimer()
+        {
+            if (!m_pProfile)
+                return;
+
+            double  after = Pixels(m_pImage);
+
+            m_event.seconds = m_pProfile->Seconds() - m_event.start;
+            m_event.megapixels = max(m_pixels, after) / 1e6;
+            m_event.megabytes = (m_pixels + after + m_operandPixels) * 4 / 1048576.0;
+            m_event.allocations = TargaImage::Get_Scratch_Stats().heapAllocs - m_allocations;
+            m_pProfile->Add(m_event);
+        }
+
+        void Fail() { m_event.bFailed = true; }
+
+    private:
+        static double Pixels(const TargaImage* pImage) { return pImage ? (double)pImage->width * pImage->height : 0; }
+
+        CScriptProfile          *m_pProfile;
+        TargaImage* const&      m_pImage;
+        CProfileEvent           m_event;
+        double                  m_pixels;           // of the image before the step
+        double                  m_operandPixels;
+        size_t                  m_allocations;      // heap blocks before the step
+};// CStepTimer
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the commands of the plan on the given image, in order.  A load
+//  command replaces the image.  Stop and return false at the first command
+//  that fails.  Plans without load or save may run on several images at
+//  once, since their operands are only read.  With a profile every step
+//  is timed and recorded in it.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptPlan::Run(TargaImage*& pImage, CScriptProfile* pProfile) const
+{
+    for (size_t i = 0 ; i < m_steps.size() ; i++)
+    {
+        const CScriptStep&  step = m_steps[i];
+        CStepTimer          timer(pProfile, (int)i, pImage, step.bFused ? NULL : m_commands[step.first].pOperand);
+        bool                bResult;
+
+        if (!step.bFused)
+            bResult = Run_Command(m_commands[step.first], pImage);
+        else if (!pImage)
+        {
+            cout << "No image to operate on.  Use \"load\" command to load image." << endl;
+            bResult = false;
+        }
+        else
+            bResult = pImage->Run_Pass(step.pass);
+
+        if (!bResult)
+        {
+            timer.Fail();
+            return false;
+        }
+    }
+
+    return true;
+}// Run
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Print the steps the plan runs in, one a line, and how many passes
+//  over the image fusion saves.  Step_Name gives the commands of a step:
+//  those of a fused pass are joined by arrows, with its filter in
+//  brackets.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CScriptPlan::Explain() const
+{
+    for (size_t i = 0 ; i < m_steps.size() ; i++)
+        cout << "step " << i + 1 << (m_steps[i].bFused ? "  fused   " : "          ") << Step_Name((int)i) << endl;
+    cout << m_commands.size() << " commands in " << m_steps.size() << " steps" << endl;
+}// Explain
+
+string CScriptPlan::Step_Name(int index) const
+{
+    if (index < 0 || index >= (int)m_steps.size())
+        return "";
+
+    const CScriptStep&  step = m_steps[index];
+    string              sName;
+
+    for (int j = step.first ; j < step.first + step.count ; j++)
+    {
+        const CScriptCommand&   command = m_commands[j];
+        bool                    filter = step.bFused && command.command >= FILTER_BOX && command.command <= FILTER_ENHANCE;
+
+        sName += (j > step.first ? " -> " : "");
+        sName += (filter ? "[" : "");
+        sName += c_asCommands[command.command];
+        if (!command.sArgument.empty())
+            sName += " " + command.sArgument;
+        sName += (filter ? "]" : "");
+    }
+
+    return sName;
+}// Step_Name
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Queue of images passed between two stages of a batch.  Push waits
+//  while the queue is full, so a fast stage cannot run far ahead of a slow
+//  one and fill memory with images.  Pop waits for an image and returns
+//  false once every producer has called Close and the queue is empty.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct CBatchItem
+{
+    size_t          index;              // position in the batch
+    TargaImage*     pImage;             // NULL if an earlier stage failed
+};
+
+class CBatchQueue
+{
+    public:
+        CBatchQueue(size_t capacity, int producers) : m_capacity(capacity), m_producers(producers) {}
+
+        void Push(const CBatchItem& item)
+        {
+            unique_lock<mutex>  lock(m_lock);
+
+            m_notFull.wait(lock, [&] { return m_items.size() < m_capacity; });
+            m_items.push_back(item);
+            m_notEmpty.notify_one();
+        }
+
+        bool Pop(CBatchItem& item)
+        {
+            unique_lock<mutex>  lock(m_lock);
+
+            m_notEmpty.wait(lock, [&] { return !m_items.empty() || m_producers == 0; });
+            if (m_items.empty())
+                return false;
+            item = m_items.front();
+            m_items.pop_front();
+            m_notFull.notify_one();
+
+            return true;
+        }
+
+        void Close()
+        {
+            lock_guard<mutex>   lock(m_lock);
+
+            if (--m_producers == 0)
+                m_notEmpty.notify_all();
+        }
+
+    private:
+        mutex                   m_lock;
+        condition_variable      m_notEmpty;
+        condition_variable      m_notFull;
+        deque<CBatchItem>       m_items;
+        size_t                  m_capacity;
+        int                     m_producers;    // stage threads still pushing
+};// CBatchQueue
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time spent by the threads of one stage, summed as they finish work.
+//
+///////////////////////////////////////////////////////////////////////////////
+class CStageClock
+{
+    public:
+        CStageClock() : m_images(0), m_nanoseconds(0), m_bytes(0) {}
+
+        void Add(chrono::steady_clock::time_point start, double bytes)
+        {
+            m_nanoseconds += (long long)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+            m_bytes += (long long)bytes;
+            m_images++;
+        }
+
+        CBatchStage Stage() const
+        {
+            CBatchStage stage = { m_images, m_nanoseconds * 1e-9, m_bytes / 1048576.0 };
+
+            return stage;
+        }
+
+    private:
+        atomic<size_t>          m_images;
+        atomic<long long>       m_nanoseconds;
+        atomic<long long>       m_bytes;
+};// CStageClock
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Size in bytes of a file, 0 if it cannot be found.
+//
+///////////////////////////////////////////////////////////////////////////////
+static double File_Size(const char* sFilename)
+{
+    struct stat info;
+
+    return stat(sFilename, &info) == 0 ? (double)info.st_size : 0;
+}// File_Size
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.
+//
+///////////////////////////////////////////////////////////////////////////////
+CScriptBatch::CScriptBatch() : m_threads(0), m_format(TargaImage::SAVE_RAW), m_pProfile(NULL)
+{}// CScriptBatch
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Queue a file for processing.  Without a destination the result goes
+//  to the output directory given to Run, under the source's file name.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CScriptBatch::Add_Image(const char* sSource, const char* sDest)
+{
+    if (!sSource)
+        return;
+
+    m_sources.push_back(sSource);
+    m_dests.push_back(sDest ? sDest : "");
+}// Add_Image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Queue every file of a directory ending in .tga, in name order.
+//  Return false if the directory cannot be read.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptBatch::Add_Directory(const char* sDirectory)
+{
+    if (!sDirectory)
+    {
+        cout << "No directory given." << endl;
+        return false;
+    }// if
+
+    string          sPath = sDirectory;
+    vector<string>  names;
+
+    if (!sPath.empty() && sPath[sPath.size() - 1] != '/' && sPath[sPath.size() - 1] != '\\')
+        sPath += '/';
+
+#ifdef _WIN32
+    WIN32_FIND_DATAA    found;
+    HANDLE              hFind = FindFirstFileA((sPath + "*.tga").c_str(), &found);
+
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        if (GetLastError() == ERROR_FILE_NOT_FOUND)
+            return true;
+        cout << "Unable to read directory:  " << sDirectory << endl;
+        return false;
+    }// if
+    do
+    {
+        if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            names.push_back(found.cFileName);
+    } while (FindNextFileA(hFind, &found));
+    FindClose(hFind);
+#else
+    DIR     *pDir = opendir(sDirectory);
+
+    if (!pDir)
+    {
+        cout << "Unable to read directory:  " << sDirectory << endl;
+        return false;
+    }// if
+    for (struct dirent* pEntry = readdir(pDir) ; pEntry ; pEntry = readdir(pDir))
+    {
+        size_t      length = strlen(pEntry->d_name);
+        struct stat info;
+
+        if (length > 4 && !strcasecmp(pEntry->d_name + length - 4, ".tga") &&
+            stat((sPath + pEntry->d_name).c_str(), &info) == 0 && S_ISREG(info.st_mode))
+            names.push_back(pEntry->d_name);
+    }
+    closedir(pDir);
+#endif
+
+    sort(names.begin(), names.end());
+    for (size_t i = 0 ; i < names.size() ; i++)
+        Add_Image((sPath + names[i]).c_str());
+
+    return true;
+}// Add_Directory
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Queue the files named in a manifest.  Each line holds a source file
+//  and optionally where its result goes.  Blank lines and lines starting
+//  with # are skipped.  Return false if the manifest cannot be read.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptBatch::Add_Manifest(const char* sFilename)
+{
+    if (!sFilename)
+    {
+        cout << "No filename given." << endl;
+        return false;
+    }// if
+
+    ifstream inFile(sFilename);
+
+    if (!inFile.is_open())
+    {
+        cout << "Unable to open file:  " << sFilename << endl;
+        return false;
+    }// if
+
+    string  sLine;
+
+    while (getline(inFile, sLine))
+    {
+        vector<char>    line(sLine.begin(), sLine.end());
+
+        line.push_back(0);
+
+        char    *sSource = strtok(&line[0], c_sWhiteSpace);
+        char    *sDest = sSource ? strtok(NULL, c_sWhiteSpace) : NULL;
+
+        if (sSource && sSource[0] != '#')
+            Add_Image(sSource, sDest);
+    }// while
+
+    return true;
+}// Add_Manifest
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run a plan over every queued image, then clear the queue.  Images
+//  flow through three stages, each on its own threads: load, process and
+//  save, so reading and writing files overlaps the work on other images.
+//  Each image is processed on a single thread and the threads work on
+//  different images, so the row parallelism of the image operations is
+//  turned off while the batch runs, by a serial scope that leaves the 
+//  pool's threads running.  A few images wait between stages per
+//  worker.  Images that fail are reported and skipped.  With a profile set
+//  the steps run on every image are recorded in it.  Return false if
+//  the plan cannot run as a batch or any image failed.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptBatch::Run(const CScriptPlan& plan, const char* sOutputDirectory, CBatchStats& stats)
+{
+    memset(&stats, 0, sizeof(stats));
+
+    if (plan.Uses_Files())
+    {
+        cout << "Batch scripts cannot load or save, the batch does that." << endl;
+        return false;
+    }// if
+
+    size_t          count = m_sources.size();
+    vector<string>  dests(count);
+
+    for (size_t i = 0 ; i < count ; i++)
+    {
+        if (!m_dests[i].empty())
+            dests[i] = m_dests[i];
+        else if (sOutputDirectory)
+        {
+            size_t  slash = m_sources[i].find_last_of("/\\");
+
+            dests[i] = string(sOutputDirectory) + "/" + m_sources[i].substr(slash == string::npos ? 0 : slash + 1);
+        }
+        else
+        {
+            cout << "No output directory given for " << m_sources[i] << endl;
+            return false;
+        }
+    }
+
+    int     workers = m_threads > 0 ? m_threads : (int)thread::hardware_concurrency();
+
+    workers = max(1, min(workers, (int)max(count, (size_t)1)));
+
+    int     loaders = max(1, workers / 4), savers = max(1, workers / 4);
+    unique_ptr<TargaImage::Serial_Scope>    pSerial(workers > 1 ? new TargaImage::Serial_Scope : NULL);
+
+    CBatchQueue         loaded(workers * c_queuedPerThread, loaders);
+    CBatchQueue         processed(workers * c_queuedPerThread, workers);
+    CStageClock         loadClock, processClock, saveClock;
+    atomic<size_t>      next(0), failed(0);
+    vector<thread>      threads;
+    chrono::steady_clock::time_point    begin = chrono::steady_clock::now();
+
+    for (int i = 0 ; i < loaders ; i++)
+        threads.push_back(thread([&] {
+            for (size_t index ; (index = next++) < count ; )
+            {
+                vector<char>    sSource(m_sources[index].begin(), m_sources[index].end());
+                chrono::steady_clock::time_point    start = chrono::steady_clock::now();
+
+                sSource.push_back(0);
+
+                CBatchItem  item = { index, TargaImage::Load_Image(&sSource[0]) };
+
+                if (item.pImage)
+                    loadClock.Add(start, File_Size(&sSource[0]));
+                else
+                {
+                    cout << "Unable to load image:  " << m_sources[index] << endl;
+                    failed++;
+                }
+                loaded.Push(item);
+            }
+            loaded.Close();
+        }));
+
+    for (int i = 0 ; i < workers ; i++)
+        threads.push_back(thread([&] {
+            CBatchItem  item;
+
+            while (loaded.Pop(item))
+            {
+                if (item.pImage)
+                {
+                    chrono::steady_clock::time_point    start = chrono::steady_clock::now();
+                    double                              bytes = (double)item.pImage->width * item.pImage->height * 4;
+
+                    if (plan.Run(item.pImage, m_pProfile))
+                        processClock.Add(start, bytes);
+                    else
+                    {
+                        cout << "Script failed on " << m_sources[item.index] << endl;
+                        delete item.pImage;
+                        item.pImage = NULL;
+                        failed++;
+                    }
+                }
+                processed.Push(item);
+            }
+            processed.Close();
+        }));
+
+    for (int i = 0 ; i < savers ; i++)
+        threads.push_back(thread([&] {
+            CBatchItem  item;
+
+            while (processed.Pop(item))
+            {
+                if (!item.pImage)
+                    continue;
+
+                chrono::steady_clock::time_point    start = chrono::steady_clock::now();
+                const char                          *sDest = dests[item.index].c_str();
+
+                if (item.pImage->Save_Image(sDest, m_format))
+                    saveClock.Add(start, File_Size(sDest));
+                else
+                {
+                    cout << "Unable to save image:  " << sDest << endl;
+                    failed++;
+                }
+                delete item.pImage;
+            }
+        }));
+
+    for (size_t i = 0 ; i < threads.size() ; i++)
+        threads[i].join();
+
+    pSerial.reset();
+
+    stats.load = loadClock.Stage();
+    stats.process = processClock.Stage();
+    stats.save = saveClock.Stage();
+    stats.failed = failed;
+    stats.wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    m_sources.clear();
+    m_dests.clear();
+
+    return stats.failed == 0;
+}// Run
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Print how much each stage of a batch did and how fast.  Rates per
+//  thread are over the time the stage's threads were busy; the batch rate
+//  is over the wall time.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CScriptBatch::Report(const CBatchStats& stats)
+{
+    const char          *asNames[] = { "load", "process", "save" };
+    const CBatchStage   *stages[] = { &stats.load, &stats.process, &stats.save };
+
+    for (int i = 0 ; i < 3 ; i++)
+    {
+        const CBatchStage&  stage = *stages[i];
+        double              busy = max(stage.busySeconds, 1e-9);
+
+        printf("%-8s %8lu images %10.2f s busy %10.1f MB %8.1f images/s %8.1f MB/s per thread\n",
+               asNames[i], (unsigned long)stage.images, stage.busySeconds, stage.megabytes,
+               stage.images / busy, stage.megabytes / busy);
+    }
+    printf("batch    %8lu images %10.2f s wall %8.1f images/s, %lu failed\n",
+           (unsigned long)stats.save.images, stats.wallSeconds,
+           stats.save.images / max(stats.wallSeconds, 1e-9), (unsigned long)stats.failed);
+}// Report
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  The profile's clock starts now.
+//
+///////////////////////////////////////////////////////////////////////////////
+CScriptProfile::CScriptProfile() : m_start(chrono::steady_clock::now())
+{}// CScriptProfile
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Drop the events recorded so far and restart the clock.  Not to be
+//  called while a plan runs with the profile.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CScriptProfile::Clear()
+{
+    lock_guard<mutex>   lock(m_lock);
+
+    m_events.clear();
+    m_threads.clear();
+    m_start = chrono::steady_clock::now();
+}// Clear
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Record a run of a step.  Threads are numbered in the order they
+//  first add an event.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CScriptProfile::Add(const CProfileEvent& event)
+{
+    lock_guard<mutex>   lock(m_lock);
+    thread::id          id = this_thread::get_id();
+    size_t              number = find(m_threads.begin(), m_threads.end(), id) - m_threads.begin();
+
+    if (number == m_threads.size())
+        m_threads.push_back(id);
+    m_events.push_back(event);
+    m_events.back().thread = (int)number;
+}// Add
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Seconds since the profile started, and a copy of its events.
+//
+///////////////////////////////////////////////////////////////////////////////
+double CScriptProfile::Seconds() const
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - m_start).count();
+}// Seconds
+
+vector<CProfileEvent> CScriptProfile::Events() const
+{
+    lock_guard<mutex>   lock(m_lock);
+
+    return m_events;
+}// Events
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The events of each step of a plan summed, in step order.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct CStepTotal
+{
+    int             runs;
+    int             failed;
+    double          seconds;
+    double          megapixels;
+    double          megabytes;
+    size_t          allocations;
+};
+
+static vector<CStepTotal> Step_Totals(const CScriptPlan& plan, const vector<CProfileEvent>& events)
+{
+    CStepTotal          zero = { 0, 0, 0, 0, 0, 0 };
+    vector<CStepTotal>  totals(plan.Step_Count(), zero);
+
+    for (size_t i = 0 ; i < events.size() ; i++)
+    {
+        const CProfileEvent&    event = events[i];
+
+        if (event.step < 0 || event.step >= (int)totals.size())
+            continue;
+
+        CStepTotal&             total = totals[event.step];
+
+        total.runs++;
+        total.failed += event.bFailed;
+        total.seconds += event.seconds;
+        total.megapixels += event.megapixels;
+        total.megabytes += event.megabytes;
+        total.allocations += event.allocations;
+    }
+
+    return totals;
+}// Step_Totals
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Print the runs, time, traffic and allocations of each step, and its
+//  share of the time.  Rates are over the time spent in the step.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CScriptProfile::Report(const CScriptPlan& plan) const
+{
+    vector<CStepTotal>      totals = Step_Totals(plan, Events());
+    double                  seconds = 0;
+
+    for (size_t i = 0 ; i < totals.size() ; i++)
+        seconds += totals[i].seconds;
+
+    printf("step    runs   total ms    mean ms   share       MB     MP/s     MB/s   allocs  commands\n");
+    for (size_t i = 0 ; i < totals.size() ; i++)
+    {
+        const CStepTotal&       total = totals[i];
+        double                  busy = max(total.seconds, 1e-9);
+
+        printf("%4d %7d %10.2f %10.3f %6.1f%% %8.1f %8.1f %8.1f %8lu  %s%s\n",
+               (int)i + 1, total.runs, total.seconds * 1e3, total.seconds * 1e3 / max(total.runs, 1),
+               100 * total.seconds / max(seconds, 1e-9), total.megabytes, total.megapixels / busy,
+               total.megabytes / busy, (unsigned long)total.allocations, plan.Step_Name((int)i).c_str(),
+               total.failed ? "  (failed)" : "");
+    }
+    printf("total        %10.2f ms\n", seconds * 1e3);
+}// Report
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write a string as a JSON string literal.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Write_Json_String(FILE* file, const string& sText)
+{
+    fputc('"', file);
+    for (size_t i = 0 ; i < sText.size() ; i++)
+    {
+        unsigned char   c = (unsigned char)sText[i];
+
+        if (c == '"' || c == '\\')
+            fprintf(file, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(file, "\\u%04x", c);
+        else
+            fputc(c, file);
+    }
+    fputc('"', file);
+}// Write_Json_String
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the totals of each step and every event to a JSON file.  Steps
+//  are numbered from 1 as Explain numbers them, times are in seconds.
+//  Return false if the file cannot be written.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptProfile::Write_Json(const CScriptPlan& plan, const char* sFilename) const
+{
+    FILE    *file = sFilename ? fopen(sFilename, "w") : NULL;
+
+    if (!file)
+    {
+        cout << "Unable to open file:  " << (sFilename ? sFilename : "") << endl;
+        return false;
+    }// if
+
+    vector<CProfileEvent>   events = Events();
+    vector<CStepTotal>      totals = Step_Totals(plan, events);
+
+    fprintf(file, "{\n  \"steps\": [");
+    for (size_t i = 0 ; i < totals.size() ; i++)
+    {
+        const CStepTotal&       total = totals[i];
+        double                  busy = max(total.seconds, 1e-9);
+
+        fprintf(file, "%s\n    { \"step\": %d, \"commands\": ", i ? "," : "", (int)i + 1);
+        Write_Json_String(file, plan.Step_Name((int)i));
+        fprintf(file, ", \"runs\": %d, \"seconds\": %.9f, \"megapixels\": %.6f, \"megabytes\": %.6f, "
+                      "\"megapixelsPerSecond\": %.3f, \"allocations\": %lu, \"failed\": %d }",
+                total.runs, total.seconds, total.megapixels, total.megabytes,
+                total.megapixels / busy, (unsigned long)total.allocations, total.failed);
+    }
+    fprintf(file, "\n  ],\n  \"events\": [");
+    for (size_t i = 0 ; i < events.size() ; i++)
+    {
+        const CProfileEvent&    event = events[i];
+
+        fprintf(file, "%s\n    { \"step\": %d, \"thread\": %d, \"start\": %.9f, \"seconds\": %.9f, "
+                      "\"megapixels\": %.6f, \"megabytes\": %.6f, \"allocations\": %lu, \"failed\": %s }",
+                i ? "," : "", event.step + 1, event.thread, event.start, event.seconds,
+                event.megapixels, event.megabytes, (unsigned long)event.allocations, event.bFailed ? "true" : "false");
+    }
+    fprintf(file, "\n  ]\n}\n");
+
+    return fclose(file) == 0;
+}// Write_Json
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the events as complete events of Chrome's trace event format,
+//  for chrome://tracing or Perfetto.  Each thread that ran steps is a row
+//  of the trace.  Return false if the file cannot be written.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptProfile::Write_Trace(const CScriptPlan& plan, const char* sFilename) const
+{
+    FILE    *file = sFilename ? fopen(sFilename, "w") : NULL;
+
+    if (!file)
+    {
+        cout << "Unable to open file:  " << (sFilename ? sFilename : "") << endl;
+        return false;
+    }// if
+
+    vector<CProfileEvent>   events = Events();
+
+    fprintf(file, "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    for (size_t i = 0 ; i < events.size() ; i++)
+    {
+        const CProfileEvent&    event = events[i];
+
+        fprintf(file, "%s\n  { \"name\": ", i ? "," : "");
+        Write_Json_String(file, plan.Step_Name(event.step));
+        fprintf(file, ", \"cat\": \"step\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, "
+                      "\"args\": { \"step\": %d, \"megapixels\": %.6f, \"megabytes\": %.6f, \"allocations\": %lu, \"failed\": %s } }",
+                event.thread, event.start * 1e6, event.seconds * 1e6, event.step + 1,
+                event.megapixels, event.megabytes, (unsigned long)event.allocations, event.bFailed ? "true" : "false");
+    }
+    fprintf(file, "\n] }\n");
+
+    return fclose(file) == 0;
+}// Write_Trace
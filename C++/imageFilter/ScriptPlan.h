@@ -0,0 +1,167 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ScriptPlan.h
+//
+//      A script parsed once into a list of commands and compiled into the
+//  steps that run them, a batch runner that applies one to many images,
+//  and a profile of where the time of the runs went.  The commands are
+//  those understood by CScriptHandler.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef _C_SCRIPT_PLAN
+#define _C_SCRIPT_PLAN
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include "TargaImage.h"
+
+class CScriptProfile;
+
+// One parsed script command
+struct CScriptCommand
+{
+    int             command;            // ECommands id
+    std::string     sArgument;          // argument as written, the file name of load and save
+    float           value;              // number argument of filter-box, filter-gauss-n, scale and rotate
+    TargaImage*     pOperand;           // image of comp-* and diff, loaded once and only read
+};
+
+// Commands run together, see CScriptPlan::Explain
+struct CScriptStep
+{
+    int             first;              // index of the first command of the step
+    int             count;              // commands in the step
+    bool            bFused;             // the commands run as pass, else the one command runs on its own
+    FusedPass       pass;
+};
+
+// One run of one step, see CScriptProfile
+struct CProfileEvent
+{
+    int             step;               // index of the step in the plan
+    int             thread;             // profile's number for the thread that ran it, from 0
+    double          start;              // seconds from the start of the profile
+    double          seconds;
+    double          megapixels;         // pixels of the larger of the image before and after
+    double          megabytes;          // image bytes read and written, operands included
+    size_t          allocations;        // scratch blocks taken from the heap, by any thread
+    bool            bFailed;
+};
+
+// Work done by one stage of a batch
+struct CBatchStage
+{
+    size_t          images;             // images that went through the stage
+    double          busySeconds;        // time spent in the stage, summed over its threads
+    double          megabytes;          // file bytes read or written, or image bytes processed
+};
+
+// Totals of a batch run, see CScriptBatch::Run
+struct CBatchStats
+{
+    CBatchStage     load;
+    CBatchStage     process;
+    CBatchStage     save;
+    size_t          failed;             // images that failed to load, process or save
+    double          wallSeconds;        // time from start to finish of the batch
+};
+
+class CScriptPlan
+{
+    // methods
+    public:
+        CScriptPlan();
+        ~CScriptPlan();
+
+        bool Parse_Command(const char* sCommand);       // append one command, false if it does not parse
+        bool Parse_File(const char* sFilename);         // append the commands of a script file
+        void Clear();
+
+        bool Run(TargaImage*& pImage, CScriptProfile* pProfile = NULL) const;  // run the commands on an image, false if one fails
+        bool Uses_Files() const;                        // true if a command loads or saves the image itself
+        int Command_Count() const { return (int)m_commands.size(); }
+
+        void Set_Fusion(bool bFuse);                    // fuse commands into passes, on by default
+        int Step_Count() const { return (int)m_steps.size(); }
+        void Explain() const;                           // print the steps the commands run in
+        std::string Step_Name(int step) const;          // the commands of a step, as Explain shows them
+
+    private:
+        CScriptPlan(const CScriptPlan&);
+        CScriptPlan& operator=(const CScriptPlan&);
+
+        bool Parse_Command(const char* sCommand, int depth);
+        bool Parse_File(const char* sFilename, int depth);
+        void Compile();
+
+    // members
+    private:
+        std::vector<CScriptCommand>     m_commands;     // in script order, run commands expanded in place
+        std::vector<CScriptStep>        m_steps;        // how the commands run, rebuilt as they change
+        bool                            m_bFuse;
+};// CScriptPlan
+
+class CScriptBatch
+{
+    // methods
+    public:
+        CScriptBatch();
+
+        void Add_Image(const char* sSource, const char* sDest = NULL);  // queue a file, dest defaults to the output directory
+        bool Add_Directory(const char* sDirectory);     // queue every .tga file of a directory
+        bool Add_Manifest(const char* sFilename);       // queue the files of a list, one "source [dest]" a line
+        int Image_Count() const { return (int)m_sources.size(); }
+
+        void Set_Threads(int count) { m_threads = count; }  // images processed at once, 0 for one per core
+        void Set_Format(TargaImage::SaveFormat format) { m_format = format; }
+        void Set_Profile(CScriptProfile* pProfile) { m_pProfile = pProfile; }  // record the steps run on every image, NULL for none
+
+        bool Run(const CScriptPlan& plan, const char* sOutputDirectory, CBatchStats& stats);  // false if any image failed
+        static void Report(const CBatchStats& stats);   // print the throughput of each stage
+
+    // members
+    private:
+        std::vector<std::string>    m_sources;          // files to process
+        std::vector<std::string>    m_dests;            // where each result goes, empty for the output directory
+        int                         m_threads;
+        TargaImage::SaveFormat      m_format;           // how results are saved
+        CScriptProfile*             m_pProfile;
+};// CScriptBatch
+
+// Time, memory traffic and allocations of every step run with the profile
+// passed to CScriptPlan::Run.  Plans may run on several threads with one
+// profile.  Step numbers refer to the plan, which must not change while
+// the profile is reported.
+class CScriptProfile
+{
+    // methods
+    public:
+        CScriptProfile();
+
+        void Clear();                                   // drop the events and restart the clock
+        void Add(const CProfileEvent& event);           // record a run of a step, its thread is filled in
+        double Seconds() const;                         // time since the profile started
+        std::vector<CProfileEvent> Events() const;
+
+        void Report(const CScriptPlan& plan) const;     // print totals for each step
+        bool Write_Json(const CScriptPlan& plan, const char* sFilename) const;     // the totals and events as JSON
+        bool Write_Trace(const CScriptPlan& plan, const char* sFilename) const;    // the events in Chrome's trace event format
+
+    private:
+        CScriptProfile(const CScriptProfile&);
+        CScriptProfile& operator=(const CScriptProfile&);
+
+    // members
+    private:
+        mutable std::mutex                      m_lock;
+        std::vector<CProfileEvent>              m_events;       // in the order the steps finished
+        std::vector<std::thread::id>            m_threads;      // threads seen, by number
+        std::chrono::steady_clock::time_point   m_start;
+};// CScriptProfile
+
+#endif // _C_SCRIPT_PLAN
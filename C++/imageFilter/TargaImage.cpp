@@ -1,1343 +1,6992 @@
-
-#include "Globals.h"
-#include "TargaImage.h"
-#include "libtarga.h"
-#include <stdlib.h>
-#include <assert.h>
-#include <memory.h>
-#include <math.h>
-#include <iostream>
-#include <sstream>
-#include <vector>
-#include <algorithm>
-#include <map>
-#include <time.h>
-using namespace std;
-using namespace stdext;
-
-// constants
-const int           RED             = 0;                // red channel
-const int           GREEN           = 1;                // green channel
-const int           BLUE            = 2;                // blue channel
-const unsigned char BACKGROUND[3]   = { 0, 0, 0 };      // background color
-
-struct RGB {
-   float r;
-   float g;
-   float b;
-   bool operator <(const RGB &A) const
-   { return this->r < A.r; }
-};
-
-// Computes n choose s, efficiently
-double Binomial(int n, int s)
-{
-    double        res;
-
-    res = 1;
-    for (int i = 1 ; i <= s ; i++)
-        res = (n - i + 1) * res / i ;
-
-    return res;
-}// Binomial
-
-void convolve(unsigned char* in, unsigned char* out, int dataSizeX, int dataSizeY,
-                    float* kernel, int kernelSizeX, int kernelSizeY)
-{
-    int i, j, m, n, mm, nn;
-    int kCenterX, kCenterY;                         // center index of kernel
-    float sum;                                      // temp accumulation buffer
-    int rowIndex, colIndex;
-
-    // find center position of kernel (half of kernel size)
-    kCenterX = kernelSizeX / 2;
-    kCenterY = kernelSizeY / 2;
-
-    for(i=0; i < dataSizeY; ++i)                // rows
-    {
-        for(j=0; j < dataSizeX; ++j)            // columns
-        {
-            sum = 0;                            // init to 0 before sum
-            for(m=0; m < kernelSizeY; ++m)      // kernel rows
-            {
-                mm = kernelSizeY - 1 - m;       // row index of flipped kernel
-
-                for(n=0; n < kernelSizeX; ++n)  // kernel columns
-                {
-                    nn = kernelSizeX - 1 - n;   // column index of flipped kernel
-
-                    // index of input signal, used for checking boundary
-                    rowIndex = i + m - kCenterY;
-                    colIndex = j + n - kCenterX;
-
-                    // ignore input samples which are out of bound
-                    if(rowIndex >= 0 && rowIndex < dataSizeY && colIndex >= 0 && colIndex < dataSizeX)
-                        sum += in[dataSizeX * rowIndex + colIndex] * kernel[kernelSizeX * mm + nn];
-                }
-            }
-            out[dataSizeX * i + j] = (unsigned char)((float)fabs(sum) + 0.5f);
-        }
-    }
-}
-
-map< int, RGB > converse_map( const map< RGB, int >& o )
-{
-  map< int, RGB > result;
-  for ( map< RGB, int >::const_iterator begin( o.begin() );begin != o.end(); ++begin )
-     result.insert( make_pair( begin->second, begin->first ) );
-  return result;
-}
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Constructor.  Initialize member variables.
-//
-///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage() : width(0), height(0), data(NULL)
-{}// TargaImage
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Constructor.  Initialize member variables.
-//
-///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage(int w, int h) : width(w), height(h)
-{
-   data = new unsigned char[width * height * 4];
-   ClearToBlack();
-}// TargaImage
-
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Constructor.  Initialize member variables to values given.
-//
-///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage(int w, int h, unsigned char *d)
-{
-    int i;
-
-    width = w;
-    height = h;
-    data = new unsigned char[width * height * 4];
-
-    for (i = 0; i < width * height * 4; i++)
-	    data[i] = d[i];
-}// TargaImage
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Copy Constructor.  Initialize member to that of input
-//
-///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage(const TargaImage& image) 
-{
-   width = image.width;
-   height = image.height;
-   data = NULL; 
-   if (image.data != NULL) {
-      data = new unsigned char[width * height * 4];
-      memcpy(data, image.data, sizeof(unsigned char) * width * height * 4);
-   }
-}
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Destructor.  Free image memory.
-//
-///////////////////////////////////////////////////////////////////////////////
-TargaImage::~TargaImage()
-{
-    if (data)
-        delete[] data;
-}// ~TargaImage
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Converts an image to RGB form, and returns the rgb pixel data - 24 
-//  bits per pixel. The returned space should be deleted when no longer 
-//  required.
-//
-///////////////////////////////////////////////////////////////////////////////
-unsigned char* TargaImage::To_RGB(void)
-{
-    unsigned char   *rgb = new unsigned char[width * height * 3];
-    int		    i, j;
-
-    if (! data)
-	    return NULL;
-
-    // Divide out the alpha
-    for (i = 0 ; i < height ; i++)
-    {
-	    int in_offset = i * width * 4;
-	    int out_offset = i * width * 3;
-
-	    for (j = 0 ; j < width ; j++)
-        {
-	        RGBA_To_RGB(data + (in_offset + j*4), rgb + (out_offset + j*3));
-	    }
-    }
-
-    return rgb;
-}// TargaImage
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Save the image to a targa file. Returns 1 on success, 0 on failure.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Save_Image(const char *filename)
-{
-    TargaImage	*out_image = Reverse_Rows();
-
-    if (! out_image)
-	    return false;
-
-    if (!tga_write_raw(filename, width, height, out_image->data, TGA_TRUECOLOR_32))
-    {
-	    cout << "TGA Save Error: %s\n", tga_error_string(tga_get_last_error());
-	    return false;
-    }
-
-    delete out_image;
-
-    return true;
-}// Save_Image
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Load a targa image from a file.  Return a new TargaImage object which 
-//  must be deleted by caller.  Return NULL on failure.
-//
-///////////////////////////////////////////////////////////////////////////////
-TargaImage* TargaImage::Load_Image(char *filename)
-{
-    unsigned char   *temp_data;
-    TargaImage	    *temp_image;
-    TargaImage	    *result;
-    int		        width, height;
-
-    if (!filename)
-    {
-        cout << "No filename given." << endl;
-        return NULL;
-    }// if
-
-    temp_data = (unsigned char*)tga_load(filename, &width, &height, TGA_TRUECOLOR_32);
-    if (!temp_data)
-    {
-        cout << "TGA Error: %s\n", tga_error_string(tga_get_last_error());
-	    width = height = 0;
-	    return NULL;
-    }
-    temp_image = new TargaImage(width, height, temp_data);
-    free(temp_data);
-
-    result = temp_image->Reverse_Rows();
-
-    delete temp_image;
-
-    return result;
-}// Load_Image
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Convert image to grayscale.  Red, green, and blue channels should all 
-//  contain grayscale value.  Alpha channel shoould be left unchanged.  Return
-//  success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::To_Grayscale()
-{
-    float grayscale;
-
-	for(int i=0; i<width * height * 4;i += 4){
-		grayscale = 0.299 * data[i] + 0.587 * data[i+1] + 0.114 * data[i+2];
-		data[i] = grayscale;
-		data[i+1] = grayscale;
-		data[i+2] = grayscale;
-	}
-
-    return true;
-}// To_Grayscale
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//  Convert the image to an 8 bit image using uniform quantization.  Return 
-//  success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Quant_Uniform()
-{
-	for(int i=0; i < width * height * 4; i += 4){
-	   float r = data[i]/32;
-	   float g = data[i+1]/32;
-	   float b = data[i+2]/64;
-	   data[i] = (int)(r * 32);
-	   data[i+1] = (int)(g * 32);
-	   data[i+2] = (int)(b * 64);
-	}
-
-    return true;
-}// Quant_Uniform
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Convert the image to an 8 bit image using populosity quantization.  
-//  Return success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Quant_Populosity()
-{
-    map<RGB,int> histo;
-	map<int,RGB> converse_histo;
-	map<RGB,int>::iterator iter;
-	map<int,RGB>::iterator iter1;
-	map<int,RGB> color_256;
-    float distance,temp = 0.0, red, green,blue;
-	RGB color, closest;
-	int sum = 0;
-	closest.r = 0;
-	closest.g = 0;
-	closest.b = 0;
-   /* Uniform quantization */
-   for(int i=0; i < width * height * 4; i += 4){
-	   float r = (float)data[i]/1024;
-	   float g = (float)data[i+1]/1024;
-	   float b = (float)data[i+2]/1024;
-	   float t = (float)r * 1024;
-	   data[i] = r * 1024;
-	   data[i+1] = g * 1024;
-	   data[i+2] = b * 1024;
-	}
-   /* histogram */
-   color.r = data[0]; 
-   color.g = data[1]; 
-   color.b = data[2];
-   histo.insert(map<RGB,int>::value_type(color,1));
-   for(int i = 4;i < width * height * 4;i += 4){
-	   color.r = data[i]; 
-	   color.g = data[i+1];
-	   color.b = data[i+2];
-	   iter = histo.find(color);
-	   if(iter != histo.end())
-		   iter->second += 1;
-	   else
-		   histo.insert(map<RGB,int>::value_type(color,1));
-   }
-  // converse_histo = converse_map(histo);
- /*  histo.clear();
-   for(iter1 = converse_histo.end(); iter1 != converse_histo.begin();iter1--){
-	   sum += 1;
-	   color_256.insert(make_pair(iter1->first,iter1->second));
-	   if(sum >= 256) break;	   
-   }
-   converse_histo.clear();*/
-   for(int i = 0;i < width * height * 4;i += 4){
-	   color.r = data[i];
-	   color.g = data[i+1];
-	   color.b = data[i+2];
-	   distance = 500;
-	   //iter1 = color_256.find(color);
-	   //if(iter1 != color_256.end()){ continue; }
-	   for(iter = histo.begin();iter != histo.end();iter++){
-		   red = pow((float)(iter->first.r - data[i]),2);
-		   green = pow(iter->first.g - data[i+1],2);
-		   blue = pow(iter->first.b - data[i+2],2);
-		   temp = sqrt(red + green + blue);
-		   if(temp == 0){
-				closest.r = iter->first.r;
-			    closest.g = iter->first.g;
-			    closest.b = iter->first.b;
-		   }
-		   else if(temp < (float)distance){
-			   distance = temp;
-			   closest.r = iter->first.r;
-			   closest.g = iter->first.g;
-			   closest.b = iter->first.b;
-		   }
-	   }	   
-	   data[i] = closest.r;
-	   data[i+1] = closest.g;
-	   data[i+2] = closest.b;
-   }
-
-    return true;
-}// Quant_Populosity
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Dither the image using a threshold of 1/2.  Return success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Dither_Threshold()
-{
-	float grayscale;
-	for(int i=0; i<width * height * 4;i += 4){
-	   grayscale = 0.299 * data[i]/255 + 0.587 * data[i+1]/255 + 0.114 * data[i+2]/255;   // [0,255] change to [0,1] scale
-		if( grayscale < 0.5){
-		  data[i] = 0;
-		  data[i+1] = 0;
-		  data[i+2] = 0;
-		}
-		else{
-		  data[i] = 255;
-		  data[i+1] = 255;
-		  data[i+2] = 255;
-		}
-	}
-
-    return true;
-}// Dither_Threshold
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Dither image using random dithering.  Return success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Dither_Random()
-{
-    float grayscale;
-	for(int i=0; i< width * height * 4;i += 4){
-	   grayscale = 0.299 * data[i]/255 + 0.587 * data[i+1]/255 + 0.114 * data[i+2]/255;
-	   grayscale += ((float)rand())/RAND_MAX * 0.4 - 0.2;
-		if( grayscale < 0.5){
-		  data[i] = 0;
-		  data[i+1] = 0;
-		  data[i+2] = 0;
-		}
-		else{
-		  data[i] = 255;
-		  data[i+1] = 255;
-		  data[i+2] = 255;
-		}
-	}
-
-    return true;
-}// Dither_Random
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Perform Floyd-Steinberg dithering on the image.  Return success of 
-//  operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Dither_FS()
-{
-    ClearToBlack();
-    return false;
-}// Dither_FS
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Dither the image while conserving the average brightness.  Return 
-//  success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Dither_Bright()
-{
-	int count = 0,i;
-        float intensity_avg = 0, threshold = 0;
-	float *grayscale = new float[width * height];
-
-	/* calculate the average intensity over image */
-	for(int i=0; i< width * height * 4;i += 4){
-	   grayscale[i/4] = 0.299 * data[i] / 255 + 0.587 * data[i+1] / 255 + 0.114 * data[i+2] / 255;
-//	   data[i] = grayscale[i/4];
-///       data[i + 1] = grayscale[i/4];
-//	   data[i + 2] = grayscale[i/4];
-           intensity_avg += grayscale[i/4];
-	}
-	intensity_avg = intensity_avg / (width * height);
-
-	sort(grayscale,grayscale + width * height);
-
-   /* find a threshold */
-    
-	for(i=0; i< width * height * 4;i += 4){
-	   int index = (1-intensity_avg) * width * height;
-	   float tmp = 0.299 * data[i] / 255 + 0.587 * data[i+1] / 255 + 0.114 * data[i+2] / 255;
-	   if( tmp < grayscale[index])
-	   {
-		   data[i] = 0;
-		   data[i + 1] = 0;
-		   data[i + 2] = 0;
-	   }
-	   else{
-		   data[i] = 255;
-		   data[i + 1] = 255;
-		   data[i + 2] = 255;
-	   }
-	}
-    return true;
-}// Dither_Bright
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Perform clustered differing of the image.  Return success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Dither_Cluster()
-{
-	float mask[4][4] = { 0.7500, 0.3750, 0.6250, 0.2500, 
-	                     0.0625, 1.0000, 0.8750, 0.4375,
-	                     0.5000, 0.8125, 0.9375, 0.1250,
-	                     0.1875, 0.5625, 0.3125, 0.6875 };
-    float matrix[400][400];
-	float grayscale;
-    int x, y;
-	/* calculate the gray value for each pixel and store it into matrix */
-	for(y = 0;y < height;y++)
-		for(x = 0;x < width;x++)
-		{
-		   matrix[x][y] = 0.299 * data[(y * width + x) * 4] / 255 + 0.587 * data[(y * width + x) * 4 + 1] / 255 + 0.114 * data[(y * width + x) * 4 + 2] / 255; 
-		}
-	/* Dither matrix */
-    for(y = 0;y < height;y++)
-		for(x = 0;x < width;x++)
-		{
-			if(matrix[x][y] >= mask[x%4][y%4])
-				matrix[x][y] = 255;
-			else matrix[x][y] = 0;
-		}
-	/* Store the new matrix into image data */
-	for(y = 0;y < height;y++)
-		for(x = 0;x < width;x++)
-		{
-			data[(y * width + x) * 4] = matrix[x][y];
-            data[(y * width + x) * 4 + 1] = matrix[x][y];
-			data[(y * width + x) * 4 + 2] = matrix[x][y];
-		}
- 
-    return true;
-}// Dither_Cluster
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//  Convert the image to an 8 bit image using Floyd-Steinberg dithering over
-//  a uniform quantization - the same quantization as in Quant_Uniform.
-//  Return success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Dither_Color()
-{
-    ClearToBlack();
-    return false;
-}// Dither_Color
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Composite the current image over the given image.  Return success of 
-//  operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Comp_Over(TargaImage* pImage)
-{
-	float alpha;
-	if (width != pImage->width || height != pImage->height)
-    {
-        cout <<  "Comp_Over: Images not the same size\n";
-        return false;
-    }
-    for(int i = 0;i < height * width * 4;i += 4)
-	{
-	    alpha = (float)data[i+3] / 255;
-
-		data[i] = data[i] + (1 - alpha) * pImage->data[i];
-		data[i+1] = data[i+1] + (1 - alpha) * pImage->data[i+1];
-		data[i+2] = data[i+2] + (1 - alpha) * pImage->data[i+2];
-		data[i+3] = data[i+3] + (1 - alpha) * pImage->data[i+3];
-	}
-    
-    return true;
-}// Comp_Over
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Composite this image "in" the given image.  See lecture notes for 
-//  details.  Return success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Comp_In(TargaImage* pImage)
-{
-    //unsigned char        rgb1[3];
-
-	if (width != pImage->width || height != pImage->height)
-    {
-        cout << "Comp_In: Images not the same size\n";
-        return false;
-    }
-	for(int i = 0;i < height * width * 4;i += 4){
-		
-		float alpha;
-		if((float)pImage->data[i+3] / 255 == 0){
-			data[i] = pImage->data[i];
-			data[i+1] = pImage->data[i+1];
-			data[i+2] = pImage->data[i+2];
-			data[i+3] = pImage->data[i+3];
-		}
-		alpha = (float)pImage->data[i+3] / 255;
-		if(alpha != 0 && alpha != 1){
-			
-			data[i] = alpha * data[i];
-			data[i+1] = alpha * data[i+1];
-			data[i+2] = alpha * data[i+2];
-			data[i+3] = alpha * data[i+3];
-		}
-     /*   RGBA_To_RGB(data + i, rgb1);
-			data[i] = rgb1[0];
-			data[i+1] = rgb1[1];
-			data[i+2] = rgb1[2];*/
-	}
-    return true;
-}// Comp_In
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Composite this image "out" the given image.  See lecture notes for 
-//  details.  Return success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Comp_Out(TargaImage* pImage)
-{
-    if (width != pImage->width || height != pImage->height)
-    {
-        cout << "Comp_Out: Images not the same size\n";
-        return false;
-    }
-    for(int i = 0;i < height * width * 4;i += 4){
-		
-		float alpha;
-		if((float)pImage->data[i+3] / 255 == 1){
-			data[i] = 0;
-			data[i+1] = 0;
-			data[i+2] = 0;
-			data[i+3] = 0;
-		}
-		alpha = (float)pImage->data[i+3] / 255;
-		if(alpha != 0 && alpha != 1){
-			
-			data[i] = (1-alpha) * data[i];
-			data[i+1] = (1-alpha) * data[i+1];
-			data[i+2] = (1-alpha) * data[i+2];
-			data[i+3] = (1-alpha) * data[i+3];
-		}
-	}
-    return true;
-}// Comp_Out
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Composite current image "atop" given image.  Return success of 
-//  operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Comp_Atop(TargaImage* pImage)
-{
-    if (width != pImage->width || height != pImage->height)
-    {
-        cout << "Comp_Atop: Images not the same size\n";
-        return false;
-    }
-     for(int i = 0;i < height * width * 4;i += 4){
-		
-		float alpha_g = 0.0,alpha_f =0.0;
-		alpha_g = (float)pImage->data[i+3] / 255;
-
-		alpha_f = (float)data[i+3] / 255;
-		if(alpha_g == 0){
-			if(alpha_f != 1){
-
-			//alpha_f = (float) data[i+3] / 255;
-			  data[i] = (1 - alpha_f) * pImage->data[i];
-			  data[i+1] = (1 - alpha_f) * pImage->data[i+1];
-			  data[i+2] = (1 - alpha_f) * pImage->data[i+2];
-			  data[i+3] = (1 - alpha_f) * pImage->data[i+3];
-			}
-			else{
-			  data[i] = 0;
-			  data[i+1] = 0;
-			  data[i+2] = 0;
-			  data[i+3] = 0;
-			}
-		}
-		else{
-			if(alpha_f == 1){
-              data[i] = alpha_g * data[i];
-			  data[i+1] = alpha_g * data[i+1];
-			  data[i+2] = alpha_g * data[i+2];
-			  data[i+3] = alpha_g * data[i+3];
-			}
-			else{
-			  data[i] = alpha_g * data[i] + (1 - alpha_f) * pImage->data[i];
-			  data[i+1] = alpha_g * data[i+1] + (1 - alpha_f) * pImage->data[i+1];
-			  data[i+2] = alpha_g * data[i+2] + (1 - alpha_f) * pImage->data[i+2];
-			  data[i+3] = alpha_g * data[i+3] + (1 - alpha_f) * pImage->data[i+3];
-			}
-		}
-		
-	}
-   
-    return true;
-}// Comp_Atop
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Composite this image with given image using exclusive or (XOR).  Return
-//  success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Comp_Xor(TargaImage* pImage)
-{
-    if (width != pImage->width || height != pImage->height)
-    {
-        cout << "Comp_Xor: Images not the same size\n";
-        return false;
-    }
-     for(int i = 0;i < height * width * 4;i += 4){
-		
-		float alpha_g = 0.0,alpha_f =0.0;
-		alpha_g = (float)pImage->data[i+3] / 255;
-
-		alpha_f = (float)data[i+3] / 255;
-		
-		data[i] = (1 - alpha_g) * data[i] + (1 - alpha_f) * pImage->data[i];
-	    data[i+1] = (1 - alpha_g) * data[i+1] + (1 - alpha_f) * pImage->data[i+1];
-        data[i+2] = (1 - alpha_g) * data[i+2] + (1 - alpha_f) * pImage->data[i+2];
-        data[i+3] = (1 - alpha_g) * data[i+3] + (1 - alpha_f) * pImage->data[i+3];
-	 }
-    return true;
-}// Comp_Xor
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Calculate the difference bewteen this imag and the given one.  Image 
-//  dimensions must be equal.  Return success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Difference(TargaImage* pImage)
-{
-    if (!pImage)
-        return false;
-
-    if (width != pImage->width || height != pImage->height)
-    {
-        cout << "Difference: Images not the same size\n";
-        return false;
-    }// if
-
-    for (int i = 0 ; i < width * height * 4 ; i += 4)
-    {
-        unsigned char        rgb1[3];
-        unsigned char        rgb2[3];
-
-        RGBA_To_RGB(data + i, rgb1);
-        RGBA_To_RGB(pImage->data + i, rgb2);
-
-        data[i] = abs(rgb1[0] - rgb2[0]);
-        data[i+1] = abs(rgb1[1] - rgb2[1]);
-        data[i+2] = abs(rgb1[2] - rgb2[2]);
-        data[i+3] = 255;
-    }
-
-    return true;
-}// Difference
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Perform 5x5 box filter on this image.  Return success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-
-bool TargaImage::Filter_Box()
-{   
-	float *filter_box;
-	unsigned char *R,*G,*B,*convolR,*convolG,*convolB;
-	filter_box = new float[25];
-    R = new unsigned char[width * height];
-    G = new unsigned char[width * height];
-	B = new unsigned char[width * height];
-	convolR = new unsigned char[width * height];
-	convolG = new unsigned char[width * height];
-	convolB = new unsigned char[width * height];
-
-	for(int i = 0;i < 25;i++)
-		filter_box[i] = (float)1/25;
-	/* store (r,g,b) to R,G,B */
-	for(int i = 0;i < width * height * 4;i += 4){
-		R[i/4] = data[i];
-		G[i/4] = data[i+1];
-		B[i/4] = data[i+2];
-	}
-    convolve(R,convolR,400,400,filter_box,5,5);
-	convolve(G,convolG,400,400,filter_box,5,5);
-	convolve(B,convolB,400,400,filter_box,5,5);
-	for(int i = 0;i < width * height * 4;i += 4)
-	{
-		data[i] = convolR[i/4];
-		data[i+1] = convolG[i/4];
-		data[i+2] = convolB[i/4];
-	}
-    return true;
-}// Filter_Box
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Perform 5x5 Bartlett filter on this image.  Return success of 
-//  operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Bartlett()
-{
-    float *filter_bart;
-	float tmp[25] = {1,2,3,2,1,2,4,6,4,2,3,6,9,6,3,2,4,6,4,2,1,2,3,2,1};
-	unsigned char *R,*G,*B,*convolR,*convolG,*convolB;
-	filter_bart = new float[25];
-    R = new unsigned char[width * height];
-    G = new unsigned char[width * height];
-	B = new unsigned char[width * height];
-	convolR = new unsigned char[width * height];
-	convolG = new unsigned char[width * height];
-	convolB = new unsigned char[width * height];
-
-	for(int i = 0;i < 25;i++)
-		printf("%f\n",tmp[i]);
-	memcpy(filter_bart,tmp,sizeof(tmp));
-	for(int i = 0;i < 25;i++)
-		printf("%f\n",filter_bart[i]);
-
-	for(int i = 0;i < 25;i++)
-		filter_bart[i] = (float)filter_bart[i]/81;
-    for(int i = 0;i < 25;i++)
-		printf("%f\n",filter_bart[i]);
-
-	/* store (r,g,b) to R,G,B */
-	for(int i = 0;i < width * height * 4;i += 4){
-		R[i/4] = data[i];
-		G[i/4] = data[i+1];
-		B[i/4] = data[i+2];
-	}
-    convolve(R,convolR,400,400,filter_bart,5,5);
-	convolve(G,convolG,400,400,filter_bart,5,5);
-	convolve(B,convolB,400,400,filter_bart,5,5);
-	
-	for(int i = 0;i < width * height * 4;i += 4)
-	{
-		data[i] = convolR[i/4];
-		data[i+1] = convolG[i/4];
-		data[i+2] = convolB[i/4];
-	}
-    return true;
-}// Filter_Bartlett
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Perform 5x5 Gaussian filter on this image.  Return success of 
-//  operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Gaussian()
-{
-    ClearToBlack();
-    return false;
-}// Filter_Gaussian
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Perform NxN Gaussian filter on this image.  Return success of 
-//  operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-
-bool TargaImage::Filter_Gaussian_N( unsigned int N )
-{
-	
-	unsigned char *R,*G,*B,*convolR,*convolG,*convolB;
-    R = new unsigned char[width * height];
-    G = new unsigned char[width * height];
-	B = new unsigned char[width * height];
-	convolR = new unsigned char[width * height];
-	convolG = new unsigned char[width * height];
-	convolB = new unsigned char[width * height];
-
-	/* construct 1d filter */
-	float *filter_1d = new float[N];
-	float *filter_2d = new float[N*N];
-	float sum = 0.0;
-	for(int i = 0;i < N;i++)
-	{ filter_1d[i] = Binomial(N - 1,i); sum += filter_1d[i]; }
-  
-	/* construct 2d filter */
-	for(int i = 0;i < N;i++)
-		for(int j = 0;j < N;j++)
-		{
-		  filter_2d[i * N + j] = filter_1d[i] * filter_1d[j] / pow(sum,2);
-		}
-	for(int i = 0;i < N;i++)
-	{
-		for(int j = 0;j < N;j++)
-		{
-			printf("%f  ",filter_2d[i * N + j]);
-		}
-		printf("\n");
-	}
-	/* store (r,g,b) to R,G,B */
-	for(int i = 0;i < width * height * 4;i += 4){
-		R[i/4] = data[i];
-		G[i/4] = data[i+1];
-		B[i/4] = data[i+2];
-	}
-    convolve(R,convolR,400,400,filter_2d,N,N);
-	convolve(G,convolG,400,400,filter_2d,N,N);
-	convolve(B,convolB,400,400,filter_2d,N,N);
-	for(int i = 0;i < width * height * 4;i += 4)
-	{
-		data[i] = convolR[i/4];
-		data[i+1] = convolG[i/4];
-		data[i+2] = convolB[i/4];
-	}
-    return true;
-	
-    
-   return true;
-}// Filter_Gaussian_N
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Perform 5x5 edge detect (high pass) filter on this image.  Return 
-//  success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Edge()
-{
-    float *filter_bart;
-	float *f = new float[25];
-	float tmp[25] = {1,2,3,2,1,2,4,6,4,2,3,6,9,6,3,2,4,6,4,2,1,2,3,2,1};
-	unsigned char *R,*G,*B,*convolR,*convolG,*convolB;
-	filter_bart = new float[25];
-    R = new unsigned char[width * height];
-    G = new unsigned char[width * height];
-	B = new unsigned char[width * height];
-	convolR = new unsigned char[width * height];
-	convolG = new unsigned char[width * height];
-	convolB = new unsigned char[width * height];
-
-	for(int i = 0;i < 25;i++){
-		f[i] = 0; 
-	}
-	f[13] = 1;
-	for(int i = 0;i < 25;i++)
-		printf("%f\n",tmp[i]);
-	memcpy(filter_bart,tmp,sizeof(tmp));
-	for(int i = 0;i < 25;i++)
-		printf("%f\n",filter_bart[i]);
-
-	for(int i = 0;i < 25;i++)
-		filter_bart[i] = (float)filter_bart[i]/81;
-    for(int i = 0;i < 25;i++)
-		printf("%f\n",filter_bart[i]);
-	for(int i = 0;i < 25;i++){
-		f[i] = f[i] - filter_bart[i];
-	}
-	/* store (r,g,b) to R,G,B */
-	for(int i = 0;i < width * height * 4;i += 4){
-		R[i/4] = data[i];
-		G[i/4] = data[i+1];
-		B[i/4] = data[i+2];
-	}
-    convolve(R,convolR,400,400,f,5,5);
-	convolve(G,convolG,400,400,f,5,5);
-	convolve(B,convolB,400,400,f,5,5);
-	for(int i = 0;i < width * height * 4;i += 4)
-	{
-		data[i] = convolR[i/4];
-		data[i+1] = convolG[i/4];
-		data[i+2] = convolB[i/4];
-	}
-    return true;
-}// Filter_Edge
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Perform a 5x5 enhancement filter to this image.  Return success of 
-//  operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Enhance()
-{
-    ClearToBlack();
-    return false;
-}// Filter_Enhance
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Run simplified version of Hertzmann's painterly image filter.
-//      You probably will want to use the Draw_Stroke funciton and the
-//      Stroke class to help.
-// Return success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-void imageDiff(unsigned char *canvas,unsigned char *refImage,unsigned char *difImage){
-
-	double diff;
-	for(int i= 0; i< 400 * 400 *4; i += 4)
-	{
- 	  diff = pow(((double)canvas[i]-(double)refImage[i]), 2)
- 			 	+ pow(((double)canvas[i+1]-(double)refImage[i+1]), 2)
- 			 	+ pow(((double)canvas[i+2]-(double)refImage[i+2]), 2);
- 	  diff = sqrt(diff);
- 	  diff = diff > 255 ? 255 : diff;
-	  difImage[i] = diff;
-	  difImage[i+1] = diff;
-	  difImage[i+2] = diff;
-	 // difImage[i] = refImage[i];
-	 // difImage[i+1] = refImage[i+1];
-	 // difImage[i+2] = refImage[i+2];
-	}
-}
-
-int region(unsigned char *difImage, int& xPos, int& yPos, int radius)
-{
-	int sum = 0, idx, maxVal = 0, maxX = 0, maxY = 0;
-
-	for(int i = -radius; i <= radius; i++)
-	{
-		for(int j = -radius; j <= radius; j++)
- 		{
- 		 	idx = (i+xPos)*3 + 400 * (400-yPos-1+j)*3;
- 			if((idx >= 0)&&((i+xPos) >= 0)&&
-				((i+xPos) < 400)&&((j+yPos) < 400))
- 			{
- 				sum += (int)difImage[idx];
-
- 		 		// Test for the max value of the region 
- 				if((int)difImage[idx] > maxVal)
-				{
-					maxVal = (int)difImage[idx];
-					maxX = i+xPos;
-					maxY = j+yPos;
-				}
-			}
-		}
-	}
-	xPos = maxX; yPos = maxY;
-	return sum;
-}
-
-void paintLayer(unsigned char *source,TargaImage *canvas,unsigned char *refImage,int radius){
-
-	unsigned char *difImage = new unsigned char[400*400 * 4];
-	imageDiff(canvas->data,refImage,difImage);
-
-	int grid = radius; /* fg * radius, fg set to 1 */
-	int error,rad,maxX,maxY,unitNum;
-
-	vector<int> strokePointsX, strokePointsY;
-	strokePointsX.begin();
-	strokePointsY.begin();
-
-	Stroke stroke;
-
-	for(int x = 0; x < 400;x += grid)
-		for(int y = 0;y < 400;y += grid)
-		{
-			// sum the error
-			rad = (grid/2 < 1) ? 1 : grid/2;
- 			maxX = x+rad; maxY = y+rad;
- 			error = region(difImage, maxX, maxY, rad)/(grid * grid);
-			if(error > 25)  // threshold set to 25
-			{
-			  strokePointsX.push_back(maxX);
-			  strokePointsY.push_back(maxY);
-			}
-		}
-	// Randomly pull a point from the container and render it
-	//srand(time(NULL));
-	while(!strokePointsX.empty() && !strokePointsY.empty())
-	{
-		unitNum = rand() % strokePointsX.size();
-		stroke.radius = radius;
-		stroke.x = strokePointsX[unitNum];
-		stroke.y = strokePointsY[unitNum];
-		stroke.r = refImage[stroke.y * 400 + stroke.x];
-		stroke.g = refImage[stroke.y * 400 + stroke.x + 1];
-		stroke.b = refImage[stroke.y * 400 + stroke.x + 2];
-		stroke.a = refImage[stroke.y * 400 + stroke.x + 3];
-		canvas->Paint_Stroke(stroke);
-		strokePointsX.erase(strokePointsX.begin()+unitNum);
-		strokePointsY.erase(strokePointsY.begin()+unitNum);
-	}
-	/* copy canvas data to current image */
-	for(int i = 0;i < 400 * 400 * 4;i += 4){
-		source[i] = canvas->data[i];
-		source[i+1] = canvas->data[i+1];
-		source[i+2] = canvas->data[i+2];
-		source[i+3] = canvas->data[i+3];
-	}
-
-	delete[] difImage;
-}
-
-void paint(TargaImage *source,int strokeSizes[],int num){
-
-	TargaImage *canvas = new TargaImage(400,400);
-	unsigned char *refImage = new unsigned char[400 * 400 * 4];
-    /* Set initial canvas to black */
-	for(int i = 0;i < 400 * 400 * 4;i += 4){
-		canvas->data[i] = 0;
-		canvas->data[i+1] = 0;
-        canvas->data[i+2] = 0;
-		//canvas->data[i+3] = 0;
-	}
-
-	for(int i = 0;i < num;i++){
-       bool blur = source->Filter_Gaussian_N(2 * strokeSizes[i] + 1);
-		/* Gaussian blurred refImage */
-	   if(blur == true){
-		for(int i = 0;i < 400 * 400 * 4;i += 4){
-			refImage[i] = (float)source->data[i];
-			refImage[i+1] = (float)source->data[i+1];
-			refImage[i+2] = (float)source->data[i+2];
-		}
-	   }
-		paintLayer(source->data,canvas,refImage,strokeSizes[i]);
-	}
-    //Redraw();
-
-
-}
-bool TargaImage::NPR_Paint()
-{   
-	/* Not Working !!!!! 
-	 The basic idea: I use Gaussian filter N to create a reference image of current image, and a canvas image
-	                 to paint, each time stroke color is initialized by the color in the corresponding point 
-					 of reference image. I think it is wrong in error computation of paintLayer. I just did not
-					 figure out how to do it, and the paper omits some details in this part.*/
-	TargaImage *source = new TargaImage(400,400);
-	memcpy(source->data,data,sizeof(data));
-	int strokeSizes[] = {7,3,1};
-	paint(source,strokeSizes,3);
-	for(int i = 0;i < width * height * 4;i += 4){
-		data[i] = source->data[i];
-		data[i+1] = source->data[i+1];
-		data[i+2] = source->data[i+2];
-		data[i+3] = source->data[i+3];
-	}
-    return true;
-}
-
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Halve the dimensions of this image.  Return success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Half_Size()
-{
-    ClearToBlack();
-    return false;
-}// Half_Size
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Double the dimensions of this image.  Return success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Double_Size()
-{
-    ClearToBlack();
-    return false;
-}// Double_Size
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Scale the image dimensions by the given factor.  The given factor is 
-//  assumed to be greater than one.  Return success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Resize(float scale)
-{
-    ClearToBlack();
-    return false;
-}// Resize
-
-
-//////////////////////////////////////////////////////////////////////////////
-//
-//      Rotate the image clockwise by the given angle.  Do not resize the 
-//  image.  Return success of operation.
-//
-///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Rotate(float angleDegrees)
-{
-    ClearToBlack();
-    return false;
-}// Rotate
-
-
-//////////////////////////////////////////////////////////////////////////////
-//
-//      Given a single RGBA pixel return, via the second argument, the RGB
-//      equivalent composited with a black background.
-//
-///////////////////////////////////////////////////////////////////////////////
-void TargaImage::RGBA_To_RGB(unsigned char *rgba, unsigned char *rgb)
-{
-    const unsigned char	BACKGROUND[3] = { 0, 0, 0 };
-
-    unsigned char  alpha = rgba[3];
-
-    if (alpha == 0)
-    {
-        rgb[0] = BACKGROUND[0];
-        rgb[1] = BACKGROUND[1];
-        rgb[2] = BACKGROUND[2];
-    }
-    else
-    {
-	    float	alpha_scale = (float)255 / (float)alpha;
-	    int	val;
-	    int	i;
-
-	    for (i = 0 ; i < 3 ; i++)
-	    {
-	        val = (int)floor(rgba[i] * alpha_scale);
-	        if (val < 0)
-		    rgb[i] = 0;
-	        else if (val > 255)
-		    rgb[i] = 255;
-	        else
-		    rgb[i] = val;
-	    }
-    }
-}// RGA_To_RGB
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Copy this into a new image, reversing the rows as it goes. A pointer
-//  to the new image is returned.
-//
-///////////////////////////////////////////////////////////////////////////////
-TargaImage* TargaImage::Reverse_Rows(void)
-{
-    unsigned char   *dest = new unsigned char[width * height * 4];
-    TargaImage	    *result;
-    int 	        i, j;
-
-    if (! data)
-    	return NULL;
-
-    for (i = 0 ; i < height ; i++)
-    {
-	    int in_offset = (height - i - 1) * width * 4;
-	    int out_offset = i * width * 4;
-
-	    for (j = 0 ; j < width ; j++)
-        {
-	        dest[out_offset + j * 4] = data[in_offset + j * 4];
-	        dest[out_offset + j * 4 + 1] = data[in_offset + j * 4 + 1];
-	        dest[out_offset + j * 4 + 2] = data[in_offset + j * 4 + 2];
-	        dest[out_offset + j * 4 + 3] = data[in_offset + j * 4 + 3];
-        }
-    }
-
-    result = new TargaImage(width, height, dest);
-    delete[] dest;
-    return result;
-}// Reverse_Rows
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Clear the image to all black.
-//
-///////////////////////////////////////////////////////////////////////////////
-void TargaImage::ClearToBlack()
-{
-    memset(data, 0, width * height * 4);
-}// ClearToBlack
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Helper function for the painterly filter; paint a stroke at
-// the given location
-//
-///////////////////////////////////////////////////////////////////////////////
-void TargaImage::Paint_Stroke(const Stroke& s) {
-   int radius_squared = (int)s.radius * (int)s.radius;
-   for (int x_off = -((int)s.radius); x_off <= (int)s.radius; x_off++) {
-      for (int y_off = -((int)s.radius); y_off <= (int)s.radius; y_off++) {
-         int x_loc = (int)s.x + x_off;
-         int y_loc = (int)s.y + y_off;
-         // are we inside the circle, and inside the image?
-         if ((x_loc >= 0 && x_loc < width && y_loc >= 0 && y_loc < height)) {
-            int dist_squared = x_off * x_off + y_off * y_off;
-            if (dist_squared <= radius_squared) {
-               data[(y_loc * width + x_loc) * 4 + 0] = s.r;
-               data[(y_loc * width + x_loc) * 4 + 1] = s.g;
-               data[(y_loc * width + x_loc) * 4 + 2] = s.b;
-               data[(y_loc * width + x_loc) * 4 + 3] = s.a;
-            } else if (dist_squared == radius_squared + 1) {
-               data[(y_loc * width + x_loc) * 4 + 0] = 
-                  (data[(y_loc * width + x_loc) * 4 + 0] + s.r) / 2;
-               data[(y_loc * width + x_loc) * 4 + 1] = 
-                  (data[(y_loc * width + x_loc) * 4 + 1] + s.g) / 2;
-               data[(y_loc * width + x_loc) * 4 + 2] = 
-                  (data[(y_loc * width + x_loc) * 4 + 2] + s.b) / 2;
-               data[(y_loc * width + x_loc) * 4 + 3] = 
-                  (data[(y_loc * width + x_loc) * 4 + 3] + s.a) / 2;
-            }
-         }
-      }
-   }
-}
-
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Build a Stroke
-//
-///////////////////////////////////////////////////////////////////////////////
-Stroke::Stroke() {}
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Build a Stroke
-//
-///////////////////////////////////////////////////////////////////////////////
-Stroke::Stroke(unsigned int iradius, unsigned int ix, unsigned int iy,
-               unsigned char ir, unsigned char ig, unsigned char ib, unsigned char ia) :
-   radius(iradius),x(ix),y(iy),r(ir),g(ig),b(ib),a(ia)
-{
-}
-
+
+#include "Globals.h"
+#include "TargaImage.h"
+#include "libtarga.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <memory.h>
+#include <math.h>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <time.h>
+#include <limits.h>
+#include <atomic>
+#include <new>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+    #include <malloc.h>
+    #include <intrin.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+// SIMD kernels are compiled in when the target instruction set is enabled
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define TARGA_AVX2
+#endif
+#if defined(__SSE4_1__) || defined(__AVX2__)
+    #include <smmintrin.h>
+    #define TARGA_SSE41
+#endif
+
+// Debug output compiled in, 0 for none, 1 to print the kernels the filters
+// build
+#ifndef TARGA_TRACE
+    #define TARGA_TRACE 0
+#endif
+
+using namespace std;
+#ifdef _WIN32
+using namespace stdext;
+#endif
+
+// constants
+const int           RED             = 0;                // red channel
+const int           GREEN           = 1;                // green channel
+const int           BLUE            = 2;                // blue channel
+const unsigned char BACKGROUND[3]   = { 0, 0, 0 };      // background color
+const int           CONV_TAP_BITS   = 11;               // fixed point bits per axis of quantized kernels
+const int           CONV_MAX_DIVISOR = 4096;            // largest non power of two divisor normalized exactly
+const float         CONV_ROUND_EPS  = 1.0f / 16384;     // bias that makes the float divide truncate exactly
+const int           PLANE_ALIGN     = 64;               // alignment and row padding of planar channels
+const int           ARENA_MIN_SHIFT = 12;               // log2 of the smallest scratch block
+const int           ARENA_CLASSES   = 4 * (8 * sizeof(size_t) - ARENA_MIN_SHIFT) + 1; // scratch size classes
+const size_t        ARENA_MAX_CACHED = 5;               // free scratch blocks kept per class and thread: the four
+                                                        //   planes of an image and the one a filter replaces
+const size_t        TILE_BYTES      = 256 * 1024;       // working set of one tile, about the size of L2
+const int           QUANT_BINS      = 1 << 15;          // 5-5-5 bins of the quantizer color histogram
+const int           QUANT_COLORS    = 256;              // palette size of the palette quantizers
+const int           HIST_CHUNK_PIXELS = 1 << 20;        // pixels per partial histogram
+const int           LUMA_KEY_BITS   = 15;               // bits of the gray key Dither_Bright resolves per pass
+const int           LUMA_MAX_CHUNKS = 32;               // most partial histograms Dither_Bright keeps
+const int           STACK_TILE_X    = 256;              // tile size of a composite stack, wide so rows
+const int           STACK_TILE_Y    = 16;               //   stream through the prefetcher
+const int           DIFF_CELL       = 64;               // side of the cells changed pixels are gathered in
+const int           DITHER_FRAC_BITS = 8;               // fractional bits of diffused error
+const int           DITHER_IN_FLIGHT = 64;              // most rows error diffusion runs at once
+const int           DITHER_CHUNK    = 64;               // pixels between progress updates of a diffused row
+const int           TGA_HEADER_BYTES = 18;              // size of a targa file header
+const int           TGA_ORIGIN_RIGHT = 0x10;            // descriptor bit, pixels run right to left
+const int           TGA_ORIGIN_TOP  = 0x20;             // descriptor bit, the first row is the top one
+const size_t        TGA_STRIP_BYTES = 4 << 20;          // pixel bytes converted between writes of a saved targa
+const int           RESAMPLE_BITS   = 14;               // fixed point bits of resampling weights
+const int           RESAMPLE_MID_BITS = 6;              // fractional bits kept between the two resampling passes
+const int           ROTATE_TILE     = 64;               // side of the square tiles a rotation writes
+const int           ROTATE_FRAC_BITS = 16;              // fixed point bits of rotated source coordinates
+const int           BOX_MAX_RADIUS  = 127;              // largest radius a running sum box filter divides exactly
+const int           BOX_RECIP_BITS  = 40;               // fixed point bits of the box filter's reciprocal divisor
+const unsigned int  GAUSS_BOX_SIZE  = 41;               // smallest odd Gaussian approximated by three box passes
+const int           BARTLETT_RECIP  = 51782;            // 2^22 / 81 rounded up, divides Bartlett sums by 81
+const int           BARTLETT_RECIP_SHIFT = 6;           //   as a 16 bit high multiply and this shift
+
+// Computes n choose s, efficiently
+double Binomial(int n, int s)
+{
+    double        res;
+
+    res = 1;
+    for (int i = 1 ; i <= s ; i++)
+        res = (n - i + 1) * res / i ;
+
+    return res;
+}// Binomial
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Allocate and free PLANE_ALIGN aligned memory from the heap.
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned char* Aligned_Alloc(size_t bytes)
+{
+#ifdef _WIN32
+    return (unsigned char*)_aligned_malloc(bytes ? bytes : 1, PLANE_ALIGN);
+#else
+    void    *block = NULL;
+    if (posix_memalign(&block, PLANE_ALIGN, bytes ? bytes : 1))
+        return NULL;
+    return (unsigned char*)block;
+#endif
+}// Aligned_Alloc
+
+static void Aligned_Free(unsigned char* block)
+{
+#ifdef _WIN32
+    _aligned_free(block);
+#else
+    free(block);
+#endif
+}// Aligned_Free
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Per thread cache of PLANE_ALIGN aligned scratch blocks.  Requests are
+//  rounded up to a size class (four per power of two, at least 4K) and 
+//  freed blocks are kept on a free list per class, so an operation run 
+//  over and over on same sized images stops touching the heap after the 
+//  first call.  Each block carries a small header with its class, so a 
+//  block can be released on any thread; it goes back to the releasing 
+//  thread's cache.  The counters behind TargaImage::Get_Scratch_Stats are
+//  shared by all threads.
+//
+///////////////////////////////////////////////////////////////////////////////
+class FrameArena
+{
+    public:
+        static unsigned char*   Acquire(size_t bytes);
+        static void             Release(unsigned char* block);
+        static void             Trim();
+
+        ~FrameArena();
+
+        static atomic<size_t>   s_inUse;            // bytes handed out and not released
+        static atomic<size_t>   s_highWater;        // largest s_inUse seen
+        static atomic<size_t>   s_cached;           // bytes sitting on free lists
+        static atomic<size_t>   s_heapAllocs;       // blocks allocated from the heap
+        static atomic<size_t>   s_requests;         // calls to Acquire
+
+    private:
+        static FrameArena*      Local();
+        static int              Size_Class(size_t bytes, size_t& classBytes);
+        void                    Free_Cached();
+
+        vector<unsigned char*>  m_free[ARENA_CLASSES]; // cached blocks of each class
+};// FrameArena
+
+atomic<size_t>  FrameArena::s_inUse(0);
+atomic<size_t>  FrameArena::s_highWater(0);
+atomic<size_t>  FrameArena::s_cached(0);
+atomic<size_t>  FrameArena::s_heapAllocs(0);
+atomic<size_t>  FrameArena::s_requests(0);
+
+// Set once the calling thread's arena has been destroyed at thread exit, 
+// after which blocks go straight back to the heap.
+static thread_local bool    t_arenaGone = false;
+
+// Block header, stored in the PLANE_ALIGN bytes in front of each block
+struct ArenaHeader
+{
+    size_t          sizeClass;      // index of the free list the block belongs on
+    size_t          bytes;          // usable size of the block
+};
+
+
+FrameArena* FrameArena::Local()
+{
+    static thread_local FrameArena  arena;
+
+    return t_arenaGone ? NULL : &arena;
+}// Local
+
+
+FrameArena::~FrameArena()
+{
+    Free_Cached();
+    t_arenaGone = true;
+}// ~FrameArena
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Round a request up to its size class.  Above the smallest class each 
+//  power of two is split in quarters, so at most a quarter of a block is 
+//  wasted.
+//
+///////////////////////////////////////////////////////////////////////////////
+int FrameArena::Size_Class(size_t bytes, size_t& classBytes)
+{
+    int     top = ARENA_MIN_SHIFT;
+
+    if (bytes <= ((size_t)1 << ARENA_MIN_SHIFT))
+    {
+        classBytes = (size_t)1 << ARENA_MIN_SHIFT;
+        return 0;
+    }
+
+    // 2^top < bytes <= 2^(top + 1)
+    while (((size_t)1 << (top + 1)) < bytes)
+        top++;
+
+    size_t  quarter = (size_t)1 << (top - 2);
+    size_t  steps = (bytes - ((size_t)1 << top) + quarter - 1) / quarter;
+
+    classBytes = ((size_t)1 << top) + steps * quarter;
+    return (top - ARENA_MIN_SHIFT) * 4 + (int)steps;
+}// Size_Class
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Hand out a block of at least the given size, reusing a cached block 
+//  when there is one.  Throws bad_alloc like new when the heap is out.
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned char* FrameArena::Acquire(size_t bytes)
+{
+    size_t          classBytes;
+    int             sizeClass = Size_Class(bytes, classBytes);
+    FrameArena*     arena = Local();
+    unsigned char*  block;
+
+    if (arena && !arena->m_free[sizeClass].empty())
+    {
+        block = arena->m_free[sizeClass].back();
+        arena->m_free[sizeClass].pop_back();
+        s_cached -= classBytes;
+    }
+    else
+    {
+        unsigned char*  raw = Aligned_Alloc(classBytes + PLANE_ALIGN);
+
+        if (!raw)
+            throw bad_alloc();
+        ((ArenaHeader*)raw)->sizeClass = sizeClass;
+        ((ArenaHeader*)raw)->bytes = classBytes;
+        block = raw + PLANE_ALIGN;
+        s_heapAllocs++;
+    }
+
+    s_requests++;
+    size_t  inUse = s_inUse += classBytes;
+    size_t  high = s_highWater;
+    while (inUse > high && !s_highWater.compare_exchange_weak(high, inUse))
+        ;
+
+    return block;
+}// Acquire
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Give a block back.  It is cached unless the calling thread already 
+//  holds ARENA_MAX_CACHED blocks of its class.
+//
+///////////////////////////////////////////////////////////////////////////////
+void FrameArena::Release(unsigned char* block)
+{
+    if (!block)
+        return;
+
+    ArenaHeader*    header = (ArenaHeader*)(block - PLANE_ALIGN);
+    FrameArena*     arena = Local();
+
+    s_inUse -= header->bytes;
+    if (arena && arena->m_free[header->sizeClass].size() < ARENA_MAX_CACHED)
+    {
+        arena->m_free[header->sizeClass].push_back(block);
+        s_cached += header->bytes;
+    }
+    else
+        Aligned_Free((unsigned char*)header);
+}// Release
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return every block cached by the calling thread to the heap.
+//
+///////////////////////////////////////////////////////////////////////////////
+void FrameArena::Free_Cached()
+{
+    for (int i = 0 ; i < ARENA_CLASSES ; i++)
+    {
+        for (size_t j = 0 ; j < m_free[i].size() ; j++)
+        {
+            s_cached -= ((ArenaHeader*)(m_free[i][j] - PLANE_ALIGN))->bytes;
+            Aligned_Free(m_free[i][j] - PLANE_ALIGN);
+        }
+        m_free[i].clear();
+    }
+}// Free_Cached
+
+void FrameArena::Trim()
+{
+    FrameArena*     arena = Local();
+
+    if (arena)
+        arena->Free_Cached();
+}// Trim
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Scoped scratch array of plain data drawn from the frame arena.  The 
+//  contents start out uninitialized.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class T> class Scratch
+{
+    public:
+        explicit Scratch(size_t count) 
+            : m_pData((T*)FrameArena::Acquire(count * sizeof(T))) {}
+        ~Scratch() { FrameArena::Release((unsigned char*)m_pData); }
+
+        T*  Get() const { return m_pData; }
+        T&  operator[](size_t i) const { return m_pData[i]; }
+
+    private:
+        Scratch(const Scratch&);
+        Scratch& operator=(const Scratch&);
+
+        T*  m_pData;
+};// Scratch
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Pool of worker threads that run the tiles of an operation.  A job is
+//  a number of independent tiles; each participating thread starts with an
+//  even share of the tile indices and, once its share is used up, steals 
+//  the remaining tiles of the others one at a time.  Tiles write disjoint 
+//  output, so the result does not depend on which thread ran which tile.
+//  The calling thread takes part in the job.  Jobs started from inside a 
+//  tile, while another thread's job is running, or while a serial scope is
+//  open, run serially on the calling thread.
+//
+///////////////////////////////////////////////////////////////////////////////
+class TileScheduler
+{
+    public:
+        static void     Run(int tiles, const function<void(int)>& task);
+        static void     Set_Threads(int count);
+        static int      Threads();
+        static void     Serial(bool serial);
+
+        ~TileScheduler();
+
+    private:
+        // share of the tile indices of one thread, padded to its own cache line
+        struct Queue
+        {
+            atomic<int>     next;           // next unclaimed tile
+            int             end;            // one past the last tile of the share
+            char            pad[PLANE_ALIGN - sizeof(atomic<int>) - sizeof(int)];
+        };
+
+        TileScheduler() : m_pQueues(NULL), m_pTask(NULL), m_threadCount(0), 
+                          m_participants(0), m_pending(0), m_generation(0), m_bQuit(false), m_serial(0) {}
+
+        static TileScheduler&   Instance();
+        void                    Start(int count);
+        void                    Stop();
+        void                    Worker(int index, int seen);   // seen is the last job started before it
+        void                    Participate(int index);
+        bool                    Next(int index, int& tile);
+
+        mutex                   m_jobLock;      // held for the duration of a job
+        mutex                   m_lock;         // guards the fields below
+        condition_variable      m_wake;         // signals workers that a job is ready
+        condition_variable      m_done;         // signals the caller that workers are done
+        vector<thread>          m_threads;      // workers, index 1 and up
+        Queue*                  m_pQueues;      // one share per thread, including the caller
+        const function<void(int)>* m_pTask;     // tile function of the current job
+        exception_ptr           m_error;        // first exception thrown by a tile
+        int                     m_threadCount;  // workers plus the calling thread, 0 until started
+        int                     m_participants; // threads taking part in the current job
+        int                     m_pending;      // workers still running the current job
+        int                     m_generation;   // incremented for each job
+        bool                    m_bQuit;        // tells the workers to exit
+        atomic<int>             m_serial;       // open serial scopes, jobs run on the calling thread while any are
+};// TileScheduler
+
+// Set while the calling thread is running a tile
+static thread_local bool    t_inTile = false;
+
+
+TileScheduler& TileScheduler::Instance()
+{
+    static TileScheduler    scheduler;
+
+    return scheduler;
+}// Instance
+
+
+TileScheduler::~TileScheduler()
+{
+    Stop();
+}// ~TileScheduler
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Start count - 1 workers, or one per hardware thread if count is 0.
+//  The pool may have run jobs before, so the shares start out empty and 
+//  the workers are handed the generation of the last job, only waking for
+//  jobs started after it.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TileScheduler::Start(int count)
+{
+    if (count <= 0)
+        count = (int)thread::hardware_concurrency();
+    if (count <= 0)
+        count = 1;
+
+    m_bQuit = false;
+    m_threadCount = count;
+    m_pQueues = new Queue[count];
+    for (int i = 0 ; i < count ; i++)
+    {
+        m_pQueues[i].next = 0;
+        m_pQueues[i].end = 0;
+    }
+
+    int     generation;
+
+    {
+        lock_guard<mutex>   lock(m_lock);
+        generation = m_generation;
+    }
+    for (int i = 1 ; i < count ; i++)
+        m_threads.push_back(thread(&TileScheduler::Worker, this, i, generation));
+}// Start
+
+
+void TileScheduler::Stop()
+{
+    {
+        lock_guard<mutex>   lock(m_lock);
+        m_bQuit = true;
+    }
+    m_wake.notify_all();
+    for (size_t i = 0 ; i < m_threads.size() ; i++)
+        m_threads[i].join();
+    m_threads.clear();
+    delete[] m_pQueues;
+    m_pQueues = NULL;
+    m_threadCount = 0;
+    m_participants = 0;
+    m_pending = 0;
+}// Stop
+
+
+void TileScheduler::Worker(int index, int seen)
+{
+    unique_lock<mutex>  lock(m_lock);
+
+    for (;;)
+    {
+        m_wake.wait(lock, [&] { return m_bQuit || m_generation != seen; });
+        if (m_bQuit)
+            return;
+        seen = m_generation;
+        if (index >= m_participants)
+            continue;
+
+        lock.unlock();
+        Participate(index);
+        lock.lock();
+        if (--m_pending == 0)
+            m_done.notify_one();
+    }
+}// Worker
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run tiles until there are none left.  An exception thrown by a tile 
+//  is kept for the caller and ends this thread's part in the job.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TileScheduler::Participate(int index)
+{
+    int     tile;
+
+    t_inTile = true;
+    try
+    {
+        while (Next(index, tile))
+            (*m_pTask)(tile);
+    }
+    catch (...)
+    {
+        lock_guard<mutex>   lock(m_lock);
+        if (!m_error)
+            m_error = current_exception();
+    }
+    t_inTile = false;
+}// Participate
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Claim the next tile from this thread's share, or steal one from the 
+//  other participants.  Shares only shrink, so once every share is empty 
+//  the job is out of tiles.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TileScheduler::Next(int index, int& tile)
+{
+    for (int i = 0 ; i < m_participants ; i++)
+    {
+        Queue&  queue = m_pQueues[(index + i) % m_participants];
+
+        if (queue.next.load(memory_order_relaxed) >= queue.end)
+            continue;
+        tile = queue.next.fetch_add(1, memory_order_relaxed);
+        if (tile < queue.end)
+            return true;
+    }
+
+    return false;
+}// Next
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Call task once for each tile in [0, tiles) and wait for all of them.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TileScheduler::Run(int tiles, const function<void(int)>& task)
+{
+    TileScheduler&  pool = Instance();
+
+    if (tiles <= 1 || t_inTile || pool.m_serial.load(memory_order_relaxed) || !pool.m_jobLock.try_lock())
+    {
+        for (int i = 0 ; i < tiles ; i++)
+            task(i);
+        return;
+    }
+
+    lock_guard<mutex>   job(pool.m_jobLock, adopt_lock);
+
+    if (!pool.m_threadCount)
+        pool.Start(0);
+    if (pool.m_threadCount == 1)
+    {
+        for (int i = 0 ; i < tiles ; i++)
+            task(i);
+        return;
+    }
+
+    int     participants = min(pool.m_threadCount, tiles);
+
+    {
+        lock_guard<mutex>   lock(pool.m_lock);
+
+        for (int i = 0 ; i < participants ; i++)
+        {
+            pool.m_pQueues[i].next = (int)((long long)tiles * i / participants);
+            pool.m_pQueues[i].end = (int)((long long)tiles * (i + 1) / participants);
+        }
+        pool.m_pTask = &task;
+        pool.m_error = exception_ptr();
+        pool.m_participants = participants;
+        pool.m_pending = participants - 1;
+        pool.m_generation++;
+    }
+    pool.m_wake.notify_all();
+
+    pool.Participate(0);
+
+    unique_lock<mutex>  lock(pool.m_lock);
+    pool.m_done.wait(lock, [&] { return pool.m_pending == 0; });
+    pool.m_pTask = NULL;
+    if (pool.m_error)
+        rethrow_exception(pool.m_error);
+}// Run
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Change the number of threads used by later jobs, 0 meaning one per 
+//  hardware thread.  Waits for a running job to finish.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TileScheduler::Set_Threads(int count)
+{
+    TileScheduler&      pool = Instance();
+    lock_guard<mutex>   job(pool.m_jobLock);
+
+    pool.Stop();
+    pool.Start(count);
+}// Set_Threads
+
+
+int TileScheduler::Threads()
+{
+    TileScheduler&      pool = Instance();
+    lock_guard<mutex>   job(pool.m_jobLock);
+
+    if (!pool.m_threadCount)
+        pool.Start(0);
+    return pool.m_threadCount;
+}// Threads
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Open or close a serial scope.  Scopes may overlap, from any threads.
+//  A job already running when one opens finishes on the pool.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TileScheduler::Serial(bool serial)
+{
+    Instance().m_serial.fetch_add(serial ? 1 : -1);
+}// Serial
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Number of rows per tile for rows of the given size, so that a tile 
+//  and its halo rows fit in TILE_BYTES.  A tile is never shorter than its 
+//  halo, which bounds the work spent recomputing halos.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int Tile_Rows(size_t rowBytes, int halo)
+{
+    int     rows = (int)(TILE_BYTES / max(rowBytes, (size_t)1)) - halo;
+
+    return max(rows, max(halo, 1));
+}// Tile_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Split rows [0, height) into tiles and run body(y0, y1) on each, in 
+//  parallel.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Parallel_Rows(int height, size_t rowBytes, const function<void(int, int)>& body)
+{
+    int     tileRows = Tile_Rows(rowBytes, 0);
+    int     tiles = (height + tileRows - 1) / tileRows;
+
+    TileScheduler::Run(tiles, [&](int tile) {
+        body(tile * tileRows, min(height, (tile + 1) * tileRows));
+    });
+}// Parallel_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Bit counting and scanning on masks.  Low_Bit and High_Bit want a 
+//  mask that is not zero.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline int Bit_Count(unsigned long long mask)
+{
+#ifdef _WIN32
+    return (int)__popcnt64(mask);
+#else
+    return __builtin_popcountll(mask);
+#endif
+}// Bit_Count
+
+static inline int Low_Bit(unsigned long long mask)
+{
+#ifdef _WIN32
+    unsigned long   index;
+
+    _BitScanForward64(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctzll(mask);
+#endif
+}// Low_Bit
+
+static inline int High_Bit(unsigned long long mask)
+{
+#ifdef _WIN32
+    unsigned long   index;
+
+    _BitScanReverse64(&index, mask);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(mask);
+#endif
+}// High_Bit
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Integer separable kernel.  The 2d kernel is the outer product of col
+//  and row, divided by divisor.  Taps are stored in the order they are 
+//  applied to the input (already flipped for convolution); rowCenter and 
+//  colCenter are the taps that line up with the output pixel.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct SepKernel
+{
+    vector<int>     row;            // horizontal taps
+    vector<int>     col;            // vertical taps
+    int             rowCenter;      // index of the center horizontal tap
+    int             colCenter;      // index of the center vertical tap
+    int             divisor;        // normalization applied after both passes
+};
+
+// Rounding division by the kernel divisor.  Power of two divisors are a 
+// shift, anything else goes through a float reciprocal which is exact for
+// divisors up to CONV_MAX_DIVISOR (see Conv_Normalize).
+struct ConvNormalizer
+{
+    int             half;           // divisor / 2, rounds to nearest
+    int             shift;          // log2(divisor), or -1 if not a power of two
+    float           scale;          // 1 / divisor
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build the normalizer for the given divisor.
+//
+///////////////////////////////////////////////////////////////////////////////
+static ConvNormalizer Make_Normalizer(int divisor)
+{
+    ConvNormalizer  norm;
+
+    norm.half = divisor / 2;
+    norm.scale = 1.0f / divisor;
+    norm.shift = -1;
+    if ((divisor & (divisor - 1)) == 0)
+        for (norm.shift = 0; (1 << norm.shift) < divisor; norm.shift++)
+            ;
+
+    return norm;
+}// Make_Normalizer
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Divide a convolution sum by the kernel divisor, rounding half up, and
+//  clamp it to a byte.  Like the float path the magnitude of the sum is 
+//  used.  For non power of two divisors the float product is within 2^-15 
+//  of the true quotient, so adding CONV_ROUND_EPS before truncating gives 
+//  the exact integer quotient as long as 1/divisor > 3 * 2^-15.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline unsigned char Conv_Normalize(int sum, const ConvNormalizer& norm)
+{
+    int     val = (sum < 0 ? -sum : sum) + norm.half;
+
+    if (norm.shift >= 0)
+        val >>= norm.shift;
+    else
+        val = (int)((float)val * norm.scale + CONV_ROUND_EPS);
+
+    return (unsigned char)(val > 255 ? 255 : val);
+}// Conv_Normalize
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Horizontal pass.  src is a zero padded row holding width + numTaps - 1
+//  pixels, dst receives the unnormalized 32 bit sums.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Convolve_Row(const unsigned char* src, int* dst, int width, const int* taps, int numTaps)
+{
+    int     x = 0;
+
+#if defined(TARGA_AVX2)
+    for ( ; x + 8 <= width ; x += 8)
+    {
+        __m256i acc = _mm256_setzero_si256();
+        for (int n = 0 ; n < numTaps ; n++)
+        {
+            __m256i pix = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + x + n)));
+            acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(pix, _mm256_set1_epi32(taps[n])));
+        }
+        _mm256_storeu_si256((__m256i*)(dst + x), acc);
+    }
+#elif defined(TARGA_SSE41)
+    for ( ; x + 4 <= width ; x += 4)
+    {
+        __m128i acc = _mm_setzero_si128();
+        for (int n = 0 ; n < numTaps ; n++)
+        {
+            int     quad;
+            memcpy(&quad, src + x + n, 4);
+            __m128i pix = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(quad));
+            acc = _mm_add_epi32(acc, _mm_mullo_epi32(pix, _mm_set1_epi32(taps[n])));
+        }
+        _mm_storeu_si128((__m128i*)(dst + x), acc);
+    }
+#endif
+
+    for ( ; x < width ; x++)
+    {
+        int sum = 0;
+        for (int n = 0 ; n < numTaps ; n++)
+            sum += src[x + n] * taps[n];
+        dst[x] = sum;
+    }
+}// Convolve_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Vertical pass.  rows[m] is the horizontal pass output lined up with 
+//  tap m.  The sums are normalized and written out as bytes.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Convolve_Column(const int* const* rows, unsigned char* dst, int width, 
+                            const int* taps, int numTaps, const ConvNormalizer& norm)
+{
+    int     x = 0;
+
+#if defined(TARGA_AVX2)
+    const __m256i   half = _mm256_set1_epi32(norm.half);
+    const __m128i   shift = _mm_cvtsi32_si128(norm.shift);
+    const __m256    scale = _mm256_set1_ps(norm.scale);
+    const __m256    eps = _mm256_set1_ps(CONV_ROUND_EPS);
+    const __m256i   maxVal = _mm256_set1_epi32(255);
+
+    for ( ; x + 8 <= width ; x += 8)
+    {
+        __m256i acc = _mm256_setzero_si256();
+        for (int m = 0 ; m < numTaps ; m++)
+        {
+            __m256i sum = _mm256_loadu_si256((const __m256i*)(rows[m] + x));
+            acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(sum, _mm256_set1_epi32(taps[m])));
+        }
+        acc = _mm256_add_epi32(_mm256_abs_epi32(acc), half);
+        if (norm.shift >= 0)
+            acc = _mm256_srl_epi32(acc, shift);
+        else
+            acc = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(acc), scale), eps));
+        acc = _mm256_min_epi32(acc, maxVal);
+
+        __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        _mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(words, words));
+    }
+#elif defined(TARGA_SSE41)
+    const __m128i   half = _mm_set1_epi32(norm.half);
+    const __m128i   shift = _mm_cvtsi32_si128(norm.shift);
+    const __m128    scale = _mm_set1_ps(norm.scale);
+    const __m128    eps = _mm_set1_ps(CONV_ROUND_EPS);
+    const __m128i   maxVal = _mm_set1_epi32(255);
+
+    for ( ; x + 4 <= width ; x += 4)
+    {
+        __m128i acc = _mm_setzero_si128();
+        for (int m = 0 ; m < numTaps ; m++)
+        {
+            __m128i sum = _mm_loadu_si128((const __m128i*)(rows[m] + x));
+            acc = _mm_add_epi32(acc, _mm_mullo_epi32(sum, _mm_set1_epi32(taps[m])));
+        }
+        acc = _mm_add_epi32(_mm_abs_epi32(acc), half);
+        if (norm.shift >= 0)
+            acc = _mm_srl_epi32(acc, shift);
+        else
+            acc = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(acc), scale), eps));
+        acc = _mm_min_epi32(acc, maxVal);
+
+        __m128i words = _mm_packus_epi32(acc, acc);
+        int     quad = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+        memcpy(dst + x, &quad, 4);
+    }
+#endif
+
+    for ( ; x < width ; x++)
+    {
+        int sum = 0;
+        for (int m = 0 ; m < numTaps ; m++)
+            sum += rows[m][x] * taps[m];
+        dst[x] = Conv_Normalize(sum, norm);
+    }
+}// Convolve_Column
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve output rows [y0, y1) of a single channel with a separable
+//  integer kernel.  Samples outside the image are treated as zero, as in
+//  the original 2d loop.  The border is handled by padding the rows with
+//  zeros up front, so the inner loops never test bounds.  Channels are
+//  addressed with a step between samples and a stride between rows, so
+//  planar and interleaved channels are read and written in place.  The
+//  horizontal pass runs over the band's rows plus the halo rows the
+//  vertical pass needs above and below.  in points at image row inRow0
+//  and holds at least those rows that lie inside the image; out must not
+//  overlap them.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Separable_Band(const unsigned char* in, int inStep, int inStride, int inRow0,
+                           unsigned char* out, int outStep, int outStride, int width, int height,
+                           const SepKernel& kernel, const ConvNormalizer& norm, int y0, int y1)
+{
+    int                     rowTaps = (int)kernel.row.size();
+    int                     colTaps = (int)kernel.col.size();
+    int                     paddedWidth = width + rowTaps - 1;
+    int                     sumRows = y1 - y0 + colTaps - 1;
+    Scratch<unsigned char>  padded(paddedWidth);
+    Scratch<unsigned char>  result(width);
+    Scratch<int>            sums((size_t)sumRows * width);
+    Scratch<const int*>     rows(colTaps);
+
+    // horizontal pass, row r of sums is image row y0 - colCenter + r and
+    // rows outside the image are zero
+    memset(padded.Get(), 0, paddedWidth);
+    for (int r = 0 ; r < sumRows ; r++)
+    {
+        int     y = y0 - kernel.colCenter + r;
+        int*    dst = &sums[(size_t)r * width];
+
+        if (y < 0 || y >= height)
+        {
+            memset(dst, 0, width * sizeof(int));
+            continue;
+        }
+
+        const unsigned char*    src = in + (size_t)(y - inRow0) * inStride;
+
+        if (inStep == 1)
+            memcpy(&padded[kernel.rowCenter], src, width);
+        else
+            for (int x = 0 ; x < width ; x++)
+                padded[kernel.rowCenter + x] = src[x * inStep];
+        Convolve_Row(padded.Get(), dst, width, &kernel.row[0], rowTaps);
+    }
+
+    // vertical pass
+    for (int y = y0 ; y < y1 ; y++)
+    {
+        unsigned char*  dst = out + (size_t)y * outStride;
+
+        for (int m = 0 ; m < colTaps ; m++)
+            rows[m] = &sums[(size_t)(y - y0 + m) * width];
+        if (outStep == 1)
+            Convolve_Column(rows.Get(), dst, width, &kernel.col[0], colTaps, norm);
+        else
+        {
+            Convolve_Column(rows.Get(), result.Get(), width, &kernel.col[0], colTaps, norm);
+            for (int x = 0 ; x < width ; x++)
+                dst[x * outStep] = result[x];
+        }
+    }
+}// Separable_Band
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Express the given factor as small integers times a common scale.  
+//  Returns false if some tap is not (close to) an integer multiple of the 
+//  smallest one.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Integer_Taps(const vector<double>& factor, vector<int>& taps)
+{
+    double  unit = 0;
+
+    for (size_t i = 0 ; i < factor.size() ; i++)
+        if (factor[i] != 0 && (unit == 0 || fabs(factor[i]) < unit))
+            unit = fabs(factor[i]);
+    if (unit == 0)
+        return false;
+
+    taps.resize(factor.size());
+    for (size_t i = 0 ; i < factor.size() ; i++)
+    {
+        double  tap = factor[i] / unit;
+        double  rounded = floor(tap + 0.5);
+
+        if (fabs(tap - rounded) > 1e-3 || fabs(rounded) > (1 << CONV_TAP_BITS))
+            return false;
+        taps[i] = (int)rounded;
+    }
+    return true;
+}// Integer_Taps
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Quantize the given factor to fixed point.  The taps are scaled by 
+//  2^shift so their magnitudes sum to at most 2^CONV_TAP_BITS, and the 
+//  rounding drift is folded into the largest tap so the sum stays exact.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Quantize_Taps(const vector<double>& factor, vector<int>& taps, int& shift)
+{
+    double  sumAbs = 0, sum = 0;
+    int     largest = 0, total = 0;
+
+    for (size_t i = 0 ; i < factor.size() ; i++)
+    {
+        sumAbs += fabs(factor[i]);
+        sum += factor[i];
+        if (fabs(factor[i]) > fabs(factor[largest]))
+            largest = (int)i;
+    }
+    if (sumAbs == 0)
+        return false;
+
+    shift = (int)floor(log((1 << CONV_TAP_BITS) / sumAbs) / log(2.0));
+    taps.resize(factor.size());
+    for (size_t i = 0 ; i < factor.size() ; i++)
+    {
+        taps[i] = (int)floor(ldexp(factor[i], shift) + 0.5);
+        total += taps[i];
+    }
+    taps[largest] += (int)floor(ldexp(sum, shift) + 0.5) - total;
+    return true;
+}// Quantize_Taps
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Check whether a 2d float kernel is the outer product of two 1d 
+//  kernels, and if so build the equivalent integer separable kernel.  
+//  Kernels made of small integer weights over an integer divisor (box, 
+//  Bartlett, binomial) are recovered exactly; anything else is quantized 
+//  to CONV_TAP_BITS of fixed point per axis.  Returns false for kernels 
+//  that are not separable.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool Separate_Kernel(const float* kernel, int kernelSizeX, int kernelSizeY, SepKernel& sep)
+{
+    int             pivotRow = 0, pivotCol = 0;
+    vector<double>  rowFactor(kernelSizeX), colFactor(kernelSizeY);
+    vector<int>     rowTaps, colTaps;
+    double          pivot;
+    int             divisor;
+
+    for (int i = 0 ; i < kernelSizeY ; i++)
+        for (int j = 0 ; j < kernelSizeX ; j++)
+            if (fabs(kernel[i * kernelSizeX + j]) > fabs(kernel[pivotRow * kernelSizeX + pivotCol]))
+            {
+                pivotRow = i;
+                pivotCol = j;
+            }
+    pivot = kernel[pivotRow * kernelSizeX + pivotCol];
+    if (pivot == 0)
+        return false;
+
+    // rank one test, k[i][j] * pivot == k[i][pivotCol] * k[pivotRow][j]
+    for (int i = 0 ; i < kernelSizeY ; i++)
+        for (int j = 0 ; j < kernelSizeX ; j++)
+        {
+            double  lhs = (double)kernel[i * kernelSizeX + j] * pivot;
+            double  rhs = (double)kernel[i * kernelSizeX + pivotCol] * kernel[pivotRow * kernelSizeX + j];
+            if (fabs(lhs - rhs) > 1e-5 * pivot * pivot)
+                return false;
+        }
+
+    for (int j = 0 ; j < kernelSizeX ; j++)
+        rowFactor[j] = kernel[pivotRow * kernelSizeX + j];
+    for (int i = 0 ; i < kernelSizeY ; i++)
+        colFactor[i] = kernel[i * kernelSizeX + pivotCol] / pivot;
+
+    bool    exact = false;
+    if (Integer_Taps(rowFactor, rowTaps) && Integer_Taps(colFactor, colTaps))
+    {
+        double  recip = (double)rowTaps[pivotCol] * colTaps[pivotRow] / pivot;
+        double  sumAbs = 0;
+
+        if (recip < 0)
+        {
+            recip = -recip;
+            for (int j = 0 ; j < kernelSizeX ; j++)
+                rowTaps[j] = -rowTaps[j];
+        }
+        divisor = (int)floor(recip + 0.5);
+        for (int j = 0 ; j < kernelSizeX ; j++)
+            for (int i = 0 ; i < kernelSizeY ; i++)
+                sumAbs += abs(rowTaps[j] * colTaps[i]);
+
+        // power of two divisors are a plain shift and only need the sums to 
+        // fit in 32 bits, the float divide needs them to fit in 24 bits
+        exact = divisor > 0 && fabs(recip - divisor) <= 1e-4 * recip;
+        if ((divisor & (divisor - 1)) == 0)
+            exact = exact && sumAbs * 255 < 2147483647.0 - divisor;
+        else
+            exact = exact && sumAbs * 255 < (1 << 23) && divisor <= CONV_MAX_DIVISOR;
+    }
+    if (!exact)
+    {
+        int     rowShift, colShift;
+
+        if (!Quantize_Taps(rowFactor, rowTaps, rowShift) || !Quantize_Taps(colFactor, colTaps, colShift)
+            || rowShift + colShift < 0 || rowShift + colShift > 30)
+            return false;
+        divisor = 1 << (rowShift + colShift);
+    }
+
+    // flip the taps, convolve() applies the kernel mirrored
+    sep.row.assign(rowTaps.rbegin(), rowTaps.rend());
+    sep.col.assign(colTaps.rbegin(), colTaps.rend());
+    sep.rowCenter = kernelSizeX / 2;
+    sep.colCenter = kernelSizeY / 2;
+    sep.divisor = divisor;
+    return true;
+}// Separate_Kernel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      A 2d float kernel made ready to convolve with: its integer separable
+//  form if it has one, otherwise its taps flipped into a correlation.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct ConvKernel
+{
+    bool            separable;      // sep holds the kernel, else flipped does
+    SepKernel       sep;
+    ConvNormalizer  norm;           // rounding division by sep.divisor
+    vector<float>   flipped;        // float taps, row by row
+    int             sizeX;          // taps across
+    int             sizeY;          // taps down
+};
+
+static void Make_Conv_Kernel(const float* kernel, int sizeX, int sizeY, ConvKernel& conv)
+{
+    conv.sizeX = sizeX;
+    conv.sizeY = sizeY;
+    conv.separable = Separate_Kernel(kernel, sizeX, sizeY, conv.sep);
+    if (conv.separable)
+    {
+        conv.norm = Make_Normalizer(conv.sep.divisor);
+        return;
+    }
+
+    // flip the kernel once, then apply it as a correlation
+    conv.flipped.resize((size_t)sizeX * sizeY);
+    for (int m = 0 ; m < sizeY ; m++)
+        for (int n = 0 ; n < sizeX ; n++)
+            conv.flipped[m * sizeX + n] = kernel[(sizeY - 1 - m) * sizeX + sizeX - 1 - n];
+}// Make_Conv_Kernel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Rows per band when convolving a channel width pixels wide, with 
+//  extraBytes more per row held alongside, see Tile_Rows.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int Conv_Tile_Rows(const ConvKernel& conv, int width, size_t extraBytes)
+{
+    size_t  rowBytes = conv.separable ? (size_t)width * sizeof(int) : (size_t)(width + conv.sizeX - 1) * sizeof(float);
+
+    return Tile_Rows(rowBytes + extraBytes, conv.sizeY - 1);
+}// Conv_Tile_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve output rows [i0, i1) of a single strided channel with the
+//  float taps of a kernel that does not separate.  The band and its halo
+//  are zero padded so the inner loop has no bounds checks.  in is 
+//  addressed as in Separable_Band.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Float_Band(const ConvKernel& conv, const unsigned char* in, int inStep, int inStride, int inRow0,
+                       unsigned char* out, int outStep, int outStride, int dataSizeX, int dataSizeY, int i0, int i1)
+{
+    int             kernelSizeX = conv.sizeX, kernelSizeY = conv.sizeY;
+    int             kCenterX = kernelSizeX / 2;         // center index of kernel
+    int             kCenterY = kernelSizeY / 2;
+    int             paddedX = dataSizeX + kernelSizeX - 1;
+    int             paddedY = i1 - i0 + kernelSizeY - 1;
+    const float     *flipped = &conv.flipped[0];
+    Scratch<float>  padded((size_t)paddedX * paddedY);
+
+    memset(padded.Get(), 0, (size_t)paddedX * paddedY * sizeof(float));
+    for (int r = 0 ; r < paddedY ; r++)
+    {
+        int     i = i0 - kCenterY + r;
+
+        if (i >= 0 && i < dataSizeY)
+            for (int j = 0 ; j < dataSizeX ; j++)
+                padded[(size_t)r * paddedX + j + kCenterX] = in[(size_t)(i - inRow0) * inStride + j * inStep];
+    }
+
+    for (int i = i0 ; i < i1 ; i++)
+    {
+        for (int j = 0 ; j < dataSizeX ; j++)
+        {
+            float   sum = 0;
+            for (int m = 0 ; m < kernelSizeY ; m++)
+            {
+                const float*    src = &padded[(size_t)(i - i0 + m) * paddedX + j];
+                const float*    tap = &flipped[m * kernelSizeX];
+                for (int n = 0 ; n < kernelSizeX ; n++)
+                    sum += src[n] * tap[n];
+            }
+            sum = (float)fabs(sum) + 0.5f;
+            out[(size_t)i * outStride + j * outStep] = (unsigned char)(sum > 255 ? 255 : sum);
+        }
+    }
+}// Float_Band
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve output rows [y0, y1) of a single channel with whichever 
+//  form of the kernel it has.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Convolve_Band(const ConvKernel& conv, const unsigned char* in, int inStep, int inStride, int inRow0,
+                          unsigned char* out, int outStep, int outStride, int width, int height, int y0, int y1)
+{
+    if (conv.separable)
+        Separable_Band(in, inStep, inStride, inRow0, out, outStep, outStride, width, height, 
+                       conv.sep, conv.norm, y0, y1);
+    else
+        Float_Band(conv, in, inStep, inStride, inRow0, out, outStep, outStride, width, height, y0, y1);
+}// Convolve_Band
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve a single strided channel with a 2d float kernel.  Samples 
+//  outside the image count as zero.  Separable kernels are routed to the 
+//  integer two pass engine, which rounds half up on the exact sum; the 
+//  float path can land either side of a tie, and quantized (non integer) 
+//  kernels round to within one level.  Results are clamped to [0, 255].
+//  Both paths run in parallel bands of rows; out must not overlap in.
+//
+///////////////////////////////////////////////////////////////////////////////
+void convolve_channel(const unsigned char* in, int inStep, int inStride,
+                      unsigned char* out, int outStep, int outStride, int dataSizeX, int dataSizeY,
+                      const float* kernel, int kernelSizeX, int kernelSizeY)
+{
+    ConvKernel      conv;
+
+    Make_Conv_Kernel(kernel, kernelSizeX, kernelSizeY, conv);
+
+    int             tileRows = Conv_Tile_Rows(conv, dataSizeX, 0);
+    int             tiles = (dataSizeY + tileRows - 1) / tileRows;
+
+    TileScheduler::Run(tiles, [&](int tile) {
+        Convolve_Band(conv, in, inStep, inStride, 0, out, outStep, outStride, dataSizeX, dataSizeY,
+                      tile * tileRows, min(dataSizeY, (tile + 1) * tileRows));
+    });
+}// convolve_channel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve a single contiguous channel with a 2d float kernel.  in and
+//  out must not overlap.
+//
+///////////////////////////////////////////////////////////////////////////////
+void convolve(unsigned char* in, unsigned char* out, int dataSizeX, int dataSizeY,
+                    float* kernel, int kernelSizeX, int kernelSizeY)
+{
+    convolve_channel(in, 1, dataSizeX, out, 1, dataSizeX, dataSizeX, dataSizeY, 
+                     kernel, kernelSizeX, kernelSizeY);
+}// convolve
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Addressing for the pixels of an image in either storage layout.  
+//  Interleaved images have step 4 and stride width * 4, planar images step 
+//  1 and the padded plane stride.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct PixelView
+{
+    unsigned char*  channel[4];     // first sample of red, green, blue and alpha
+    int             step;           // distance between neighbouring pixels
+    int             stride;         // distance between rows
+};
+
+static PixelView View(TargaImage* image)
+{
+    PixelView   view;
+
+    for (int c = 0 ; c < 4 ; c++)
+        view.channel[c] = image->Is_Planar() ? image->planes[c] : image->data + c;
+    view.step = image->Is_Planar() ? 1 : 4;
+    view.stride = image->Is_Planar() ? image->stride : image->width * 4;
+    return view;
+}// View
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy between the interleaved data and the planes of an image.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Planes_To_Data(TargaImage* image)
+{
+    Parallel_Rows(image->height, (size_t)image->width * 8, [&](int y0, int y1) {
+        for (int y = y0 ; y < y1 ; y++)
+        {
+            unsigned char*  dst = image->data + (size_t)y * image->width * 4;
+            for (int c = 0 ; c < 4 ; c++)
+            {
+                const unsigned char*    src = image->planes[c] + (size_t)y * image->stride;
+                for (int x = 0 ; x < image->width ; x++)
+                    dst[x * 4 + c] = src[x];
+            }
+        }
+    });
+}// Planes_To_Data
+
+static void Data_To_Planes(TargaImage* image)
+{
+    Parallel_Rows(image->height, (size_t)image->width * 8, [&](int y0, int y1) {
+        for (int y = y0 ; y < y1 ; y++)
+        {
+            const unsigned char*    src = image->data + (size_t)y * image->width * 4;
+            for (int c = 0 ; c < 4 ; c++)
+            {
+                unsigned char*  dst = image->planes[c] + (size_t)y * image->stride;
+                for (int x = 0 ; x < image->width ; x++)
+                    dst[x] = src[x * 4 + c];
+            }
+        }
+    });
+}// Data_To_Planes
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Keeps data valid for an operation that only understands interleaved
+//  pixels.  For a planar image the planes are interleaved into data on 
+//  entry and, unless the image is only read, split back out on exit.
+//
+///////////////////////////////////////////////////////////////////////////////
+class InterleavedScope
+{
+    public:
+        InterleavedScope(TargaImage* image, bool readOnly = false)
+            : m_pImage(image && image->Is_Planar() ? image : NULL), m_bWriteBack(!readOnly)
+        {
+            if (m_pImage)
+                Planes_To_Data(m_pImage);
+        }
+
+        ~InterleavedScope()
+        {
+            if (m_pImage && m_bWriteBack)
+                Data_To_Planes(m_pImage);
+        }
+
+    private:
+        TargaImage* m_pImage;       // planar image being synced, NULL if nothing to do
+        bool        m_bWriteBack;   // copy data back to the planes on exit
+};// InterleavedScope
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve the red, green and blue channels of an image with the given
+//  kernel, leaving alpha alone.  The channels are read in place in either 
+//  layout.  Planar channels are convolved into a fresh plane that replaces
+//  the old one; interleaved images are copied to scratch and convolved back
+//  into data.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void convolve_rgb(TargaImage* image, float* kernel, int kernelSizeX, int kernelSizeY)
+{
+    int             width = image->width, height = image->height;
+
+    if (!width || !height)
+        return;
+
+    if (image->Is_Planar())
+    {
+        for (int c = RED ; c <= BLUE ; c++)
+        {
+            unsigned char*  plane = FrameArena::Acquire((size_t)image->stride * height);
+            convolve_channel(image->planes[c], 1, image->stride, plane, 1, image->stride, 
+                             width, height, kernel, kernelSizeX, kernelSizeY);
+            FrameArena::Release(image->planes[c]);
+            image->planes[c] = plane;
+        }
+        return;
+    }
+
+    size_t                  bytes = (size_t)width * height * 4;
+    Scratch<unsigned char>  source(bytes);
+
+    memcpy(source.Get(), image->data, bytes);
+    for (int c = RED ; c <= BLUE ; c++)
+        convolve_channel(source.Get() + c, 4, width * 4, image->data + c, 4, width * 4, 
+                         width, height, kernel, kernelSizeX, kernelSizeY);
+}// convolve_rgb
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Box filter output rows [y0, y1) of a single channel with a window 
+//  2 * radius + 1 pixels square, using running sums so the cost per pixel
+//  does not depend on the radius.  A sum for every column of the window is
+//  kept, updated by the row entering and the row leaving it, and each 
+//  output row slides a window across those sums.  The output may grow or
+//  shrink by grow pixels on every side: output pixel (x, y) is centered on
+//  input pixel (x - grow, y - grow).  Samples outside the input count as 
+//  zero and every sum is divided by the full window, as the box 
+//  convolution does, rounding half up.  The division is a multiply by a 
+//  2^BOX_RECIP_BITS reciprocal, exact while the sums times the divisor 
+//  stay below that, which holds up to BOX_MAX_RADIUS.  in is contiguous 
+//  rows inStride apart and must not overlap out.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Box_Band(const unsigned char* in, int inStride, int inWidth, int inHeight, 
+                     unsigned char* out, int outStep, int outStride, int outWidth, 
+                     int grow, int radius, int y0, int y1)
+{
+    int                 window = 2 * radius + 1;
+    int                 pad = radius + max(grow, 0);
+    unsigned int        divisor = (unsigned int)(window * window);
+    unsigned long long  recip = ((1ULL << BOX_RECIP_BITS) + divisor - 1) / divisor;
+    Scratch<int>        padded(inWidth + 2 * pad + 1);
+    int                 *columns = padded.Get() + pad;
+
+    // column sums of the window above the first row, indexed by input
+    // column, zero padded so the slide never tests bounds
+    memset(padded.Get(), 0, (inWidth + 2 * pad + 1) * sizeof(int));
+    for (int y = max(0, y0 - grow - radius) ; y < min(inHeight, y0 - grow + radius) ; y++)
+    {
+        const unsigned char*    src = in + (size_t)y * inStride;
+
+        for (int x = 0 ; x < inWidth ; x++)
+            columns[x] += src[x];
+    }
+
+    for (int y = y0 ; y < y1 ; y++)
+    {
+        unsigned char*  dst = out + (size_t)y * outStride;
+        int             enter = y - grow + radius, leave = y - grow - radius;
+        const int       *slide = columns - grow;
+        unsigned int    sum = 0;
+
+        if (enter >= 0 && enter < inHeight)
+        {
+            const unsigned char*    src = in + (size_t)enter * inStride;
+
+            for (int x = 0 ; x < inWidth ; x++)
+                columns[x] += src[x];
+        }
+
+        for (int x = -radius ; x < radius ; x++)
+            sum += slide[x];
+        for (int x = 0 ; x < outWidth ; x++)
+        {
+            sum += slide[x + radius];
+            dst[x * outStep] = (unsigned char)(((sum + divisor / 2) * recip) >> BOX_RECIP_BITS);
+            sum -= slide[x - radius];
+        }
+
+        if (leave >= 0 && leave < inHeight)
+        {
+            const unsigned char*    src = in + (size_t)leave * inStride;
+
+            for (int x = 0 ; x < inWidth ; x++)
+                columns[x] -= src[x];
+        }
+    }
+}// Box_Band
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Box filter a single channel, in parallel bands of rows, see 
+//  Box_Band.  A band sums the window above its first row before starting,
+//  so bands are kept several windows tall.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Box_Channel(const unsigned char* in, int inStride, int inWidth, int inHeight,
+                        unsigned char* out, int outStep, int outStride, int grow, int radius)
+{
+    int     outWidth = inWidth + 2 * grow, outHeight = inHeight + 2 * grow;
+    int     tileRows = max(Tile_Rows((size_t)inWidth * sizeof(int), 0), 8 * radius);
+    int     tiles = (outHeight + tileRows - 1) / tileRows;
+
+    TileScheduler::Run(tiles, [&](int tile) {
+        Box_Band(in, inStride, inWidth, inHeight, out, outStep, outStride, outWidth, grow, radius,
+                 tile * tileRows, min(outHeight, (tile + 1) * tileRows));
+    });
+}// Box_Channel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Box filter the red, green and blue channels of an image several 
+//  times over, with the given radius each pass, leaving alpha alone.  The
+//  passes between go through two scratch channels with a margin wide 
+//  enough for the passes still to come, so the result is the boxes 
+//  applied one after another to the zero padded image, not to each pass
+//  cut back to the image.  Planar channels are filtered into a fresh plane,
+//  as in convolve_rgb; interleaved ones are gathered into scratch first, 
+//  since the last pass writes back over them.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Box_RGB(TargaImage* image, const int* radii, int passes)
+{
+    int             width = image->width, height = image->height;
+
+    if (!width || !height)
+        return;
+
+    int                     margin = 0;
+
+    for (int p = 1 ; p < passes ; p++)
+        margin += radii[p];
+
+    PixelView               view = View(image);
+    size_t                  size = (size_t)(width + 2 * margin) * (height + 2 * margin);
+    Scratch<unsigned char>  first(size);
+    Scratch<unsigned char>  second(passes > 1 ? size : 1);
+
+    for (int c = RED ; c <= BLUE ; c++)
+    {
+        const unsigned char *in = view.channel[c];
+        int                 inStride = view.stride, inWidth = width, inHeight = height;
+        unsigned char       *out = view.channel[c], *plane = NULL;
+        int                 extent = margin;
+
+        if (image->Is_Planar())
+            out = plane = FrameArena::Acquire((size_t)image->stride * height);
+        else
+        {
+            Parallel_Rows(height, (size_t)width * 5, [&](int y0, int y1) {
+                for (size_t i = (size_t)y0 * width ; i < (size_t)y1 * width ; i++)
+                    first[i] = view.channel[c][i * 4];
+            });
+            in = first.Get();
+            inStride = width;
+        }
+
+        // extent is the margin the output of the pass keeps
+        for (int p = 0 ; p < passes ; p++)
+        {
+            bool            last = p == passes - 1;
+            int             grow = extent - (inWidth - width) / 2;
+            unsigned char   *dst = last ? out : (in == first.Get() ? second.Get() : first.Get());
+
+            Box_Channel(in, inStride, inWidth, inHeight, dst, last ? view.step : 1, 
+                        last ? view.stride : inWidth + 2 * grow, grow, radii[p]);
+            in = dst;
+            inWidth += 2 * grow;
+            inHeight += 2 * grow;
+            inStride = inWidth;
+            if (!last)
+                extent -= radii[p + 1];
+        }
+
+        if (plane)
+        {
+            FrameArena::Release(image->planes[c]);
+            image->planes[c] = plane;
+        }
+    }
+}// Box_RGB
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Radii of three box passes that together approximate the N tap 
+//  binomial Gaussian, whose variance is (N - 1) / 4.  A box 2r + 1 wide 
+//  adds r(r + 1) / 3 to the variance; the passes use the odd widths either
+//  side of the ideal, as many of the narrower as brings the sum closest.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Gaussian_Boxes(unsigned int N, int radii[3])
+{
+    double  variance = (N - 1) / 4.0;
+    int     lower = (int)floor(sqrt(4 * variance + 1));
+
+    if (lower % 2 == 0)
+        lower--;
+
+    int     narrow = (int)floor((12 * variance - 3.0 * lower * lower - 12.0 * lower - 9) / (-4.0 * lower - 4) + 0.5);
+
+    for (int i = 0 ; i < 3 ; i++)
+        radii[i] = ((i < narrow ? lower : lower + 2) - 1) / 2;
+}// Gaussian_Boxes
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      What the integer Bartlett engine writes.  All three come from the 
+//  same [1 2 3 2 1] x [1 2 3 2 1] sum B of a pixel p's neighbourhood, and 
+//  are rounded half up from an exact quotient by 81, magnitudes taken as 
+//  the float convolution does:
+//      blur        B / 81
+//      edge        |81p - B| / 81, the pixel less the blur
+//      enhance     |162p - B| / 81, the pixel plus its edge, clamped
+//
+///////////////////////////////////////////////////////////////////////////////
+enum BartlettOutput
+{
+    BARTLETT_BLUR,
+    BARTLETT_EDGE,
+    BARTLETT_ENHANCE
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Horizontal Bartlett pass.  padded is a zero padded row holding 
+//  width + 4 pixels, sums receives [1 2 3 2 1] over each five, at most 
+//  9 * 255, so the pass runs in 16 bit lanes.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Bartlett_Row(const unsigned char* padded, unsigned short* sums, int width)
+{
+    int     x = 0;
+
+#if defined(TARGA_AVX2)
+    const __m256i   three = _mm256_set1_epi16(3);
+
+    for ( ; x + 16 <= width ; x += 16)
+    {
+        __m256i p0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(padded + x)));
+        __m256i p1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(padded + x + 1)));
+        __m256i p2 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(padded + x + 2)));
+        __m256i p3 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(padded + x + 3)));
+        __m256i p4 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(padded + x + 4)));
+        __m256i sum = _mm256_add_epi16(_mm256_add_epi16(p0, p4), _mm256_slli_epi16(_mm256_add_epi16(p1, p3), 1));
+
+        sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(p2, three));
+        _mm256_storeu_si256((__m256i*)(sums + x), sum);
+    }
+#elif defined(TARGA_SSE41)
+    const __m128i   three = _mm_set1_epi16(3);
+
+    for ( ; x + 8 <= width ; x += 8)
+    {
+        __m128i p0 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(padded + x)));
+        __m128i p1 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(padded + x + 1)));
+        __m128i p2 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(padded + x + 2)));
+        __m128i p3 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(padded + x + 3)));
+        __m128i p4 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(padded + x + 4)));
+        __m128i sum = _mm_add_epi16(_mm_add_epi16(p0, p4), _mm_slli_epi16(_mm_add_epi16(p1, p3), 1));
+
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(p2, three));
+        _mm_storeu_si128((__m128i*)(sums + x), sum);
+    }
+#endif
+
+    for ( ; x < width ; x++)
+        sums[x] = (unsigned short)(padded[x] + 2 * padded[x + 1] + 3 * padded[x + 2] + 2 * padded[x + 3] + padded[x + 4]);
+}// Bartlett_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Vertical Bartlett pass and output.  rows[m] holds the horizontal 
+//  sums of the row m - 2 from the output row and center its pixels.  B is
+//  at most 81 * 255 and the enhance difference 162 * 255, so the whole 
+//  pass stays in unsigned 16 bit lanes: magnitudes are the two saturated
+//  differences or'ed, and the division by 81 is a high multiply by 
+//  BARTLETT_RECIP, exact for every numerator below 2^22 / (BARTLETT_RECIP 
+//  * 81 - 2^22), which covers them.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Bartlett_Column(const unsigned short* const* rows, const unsigned char* center, unsigned char* dst, 
+                            int width, BartlettOutput output)
+{
+    int     factor = output == BARTLETT_EDGE ? 81 : 162;
+    int     x = 0;
+
+#if defined(TARGA_AVX2)
+    const __m256i   three = _mm256_set1_epi16(3);
+    const __m256i   half = _mm256_set1_epi16(40);
+    const __m256i   recip = _mm256_set1_epi16((short)BARTLETT_RECIP);
+    const __m256i   scale = _mm256_set1_epi16((short)factor);
+
+    for ( ; x + 16 <= width ; x += 16)
+    {
+        __m256i s0 = _mm256_loadu_si256((const __m256i*)(rows[0] + x));
+        __m256i s1 = _mm256_loadu_si256((const __m256i*)(rows[1] + x));
+        __m256i s2 = _mm256_loadu_si256((const __m256i*)(rows[2] + x));
+        __m256i s3 = _mm256_loadu_si256((const __m256i*)(rows[3] + x));
+        __m256i s4 = _mm256_loadu_si256((const __m256i*)(rows[4] + x));
+        __m256i sum = _mm256_add_epi16(_mm256_add_epi16(s0, s4), _mm256_slli_epi16(_mm256_add_epi16(s1, s3), 1));
+
+        sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(s2, three));
+        if (output != BARTLETT_BLUR)
+        {
+            __m256i pixel = _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(center + x))), scale);
+
+            sum = _mm256_or_si256(_mm256_subs_epu16(pixel, sum), _mm256_subs_epu16(sum, pixel));
+        }
+        sum = _mm256_srli_epi16(_mm256_mulhi_epu16(_mm256_add_epi16(sum, half), recip), BARTLETT_RECIP_SHIFT);
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1)));
+    }
+#elif defined(TARGA_SSE41)
+    const __m128i   three = _mm_set1_epi16(3);
+    const __m128i   half = _mm_set1_epi16(40);
+    const __m128i   recip = _mm_set1_epi16((short)BARTLETT_RECIP);
+    const __m128i   scale = _mm_set1_epi16((short)factor);
+
+    for ( ; x + 8 <= width ; x += 8)
+    {
+        __m128i s0 = _mm_loadu_si128((const __m128i*)(rows[0] + x));
+        __m128i s1 = _mm_loadu_si128((const __m128i*)(rows[1] + x));
+        __m128i s2 = _mm_loadu_si128((const __m128i*)(rows[2] + x));
+        __m128i s3 = _mm_loadu_si128((const __m128i*)(rows[3] + x));
+        __m128i s4 = _mm_loadu_si128((const __m128i*)(rows[4] + x));
+        __m128i sum = _mm_add_epi16(_mm_add_epi16(s0, s4), _mm_slli_epi16(_mm_add_epi16(s1, s3), 1));
+
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(s2, three));
+        if (output != BARTLETT_BLUR)
+        {
+            __m128i pixel = _mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(center + x))), scale);
+
+            sum = _mm_or_si128(_mm_subs_epu16(pixel, sum), _mm_subs_epu16(sum, pixel));
+        }
+        sum = _mm_srli_epi16(_mm_mulhi_epu16(_mm_add_epi16(sum, half), recip), BARTLETT_RECIP_SHIFT);
+        _mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(sum, sum));
+    }
+#endif
+
+    for ( ; x < width ; x++)
+    {
+        int     sum = rows[0][x] + 2 * rows[1][x] + 3 * rows[2][x] + 2 * rows[3][x] + rows[4][x];
+
+        if (output != BARTLETT_BLUR)
+            sum = abs(center[x] * factor - sum);
+        sum = (sum + 40) / 81;
+        dst[x] = (unsigned char)(sum > 255 ? 255 : sum);
+    }
+}// Bartlett_Column
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the Bartlett engine over output rows [y0, y1) of a single 
+//  strided channel.  The source rows and their horizontal sums are kept in
+//  rings of five, each row read and summed once; rows outside the image 
+//  are zero.  out must not overlap in.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Bartlett_Band(const unsigned char* in, int inStep, int inStride, unsigned char* out, int outStep, int outStride,
+                          int width, int height, BartlettOutput output, int y0, int y1)
+{
+    int                     paddedWidth = width + 4;
+    Scratch<unsigned char>  padded((size_t)5 * paddedWidth);
+    Scratch<unsigned short> sums((size_t)5 * width);
+    Scratch<unsigned char>  result(width);
+    const unsigned short    *rows[5];
+
+    memset(padded.Get(), 0, (size_t)5 * paddedWidth);
+    for (int y = y0 - 2 ; y < y1 + 2 ; y++)
+    {
+        int             slot = (y - y0 + 2) % 5;
+        unsigned char   *row = &padded[(size_t)slot * paddedWidth];
+
+        if (y < 0 || y >= height)
+            memset(&sums[(size_t)slot * width], 0, width * sizeof(unsigned short));
+        else
+        {
+            const unsigned char*    src = in + (size_t)y * inStride;
+
+            if (inStep == 1)
+                memcpy(row + 2, src, width);
+            else
+                for (int x = 0 ; x < width ; x++)
+                    row[2 + x] = src[x * inStep];
+            Bartlett_Row(row, &sums[(size_t)slot * width], width);
+        }
+
+        if (y < y0 + 2)
+            continue;
+
+        // all five rows around y - 2 are in
+        unsigned char*  dst = out + (size_t)(y - 2) * outStride;
+
+        for (int m = 0 ; m < 5 ; m++)
+            rows[m] = &sums[(size_t)((y - 4 + m - y0 + 2) % 5) * width];
+        row = &padded[(size_t)((y - y0) % 5) * paddedWidth] + 2;
+        if (outStep == 1)
+            Bartlett_Column(rows, row, dst, width, output);
+        else
+        {
+            Bartlett_Column(rows, row, result.Get(), width, output);
+            for (int x = 0 ; x < width ; x++)
+                dst[x * outStep] = result[x];
+        }
+    }
+}// Bartlett_Band
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the Bartlett engine over the red, green and blue channels of an
+//  image, leaving alpha alone, in parallel bands of rows.  Only five rows
+//  are held per band, so bands are sized by the rows read and written.  
+//  The channels are read in place in either layout, as in convolve_rgb.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Bartlett_RGB(TargaImage* image, BartlettOutput output)
+{
+    int             width = image->width, height = image->height;
+
+    if (!width || !height)
+        return;
+
+    int                     tileRows = Tile_Rows((size_t)width * 2, 4);
+    int                     tiles = (height + tileRows - 1) / tileRows;
+    PixelView               view = View(image);
+    Scratch<unsigned char>  source(image->Is_Planar() ? 1 : (size_t)width * height * 4);
+
+    if (!image->Is_Planar())
+        memcpy(source.Get(), image->data, (size_t)width * height * 4);
+
+    for (int c = RED ; c <= BLUE ; c++)
+    {
+        const unsigned char *in = image->Is_Planar() ? view.channel[c] : source.Get() + c;
+        unsigned char       *out = view.channel[c], *plane = NULL;
+
+        if (image->Is_Planar())
+            out = plane = FrameArena::Acquire((size_t)image->stride * height);
+        TileScheduler::Run(tiles, [&](int tile) {
+            Bartlett_Band(in, view.step, view.stride, out, view.step, view.stride, width, height, output,
+                          tile * tileRows, min(height, (tile + 1) * tileRows));
+        });
+        if (plane)
+        {
+            FrameArena::Release(image->planes[c]);
+            image->planes[c] = plane;
+        }
+    }
+}// Bartlett_RGB
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Initialize member variables.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage::TargaImage() : width(0), height(0), data(NULL), planes(), stride(0)
+{}// TargaImage
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Initialize member variables.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage::TargaImage(int w, int h) : width(w), height(h), planes(), stride(0)
+{
+   data = new unsigned char[(size_t)width * height * 4];
+   ClearToBlack();
+}// TargaImage
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Initialize member variables to values given.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage::TargaImage(int w, int h, unsigned char *d) : planes(), stride(0)
+{
+    width = w;
+    height = h;
+    data = new unsigned char[(size_t)width * height * 4];
+    memcpy(data, d, (size_t)width * height * 4);
+}// TargaImage
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy Constructor.  Initialize member to that of input
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage::TargaImage(const TargaImage& image) : planes(), stride(image.stride)
+{
+   width = image.width;
+   height = image.height;
+   data = NULL; 
+   if (image.data != NULL) {
+      data = new unsigned char[(size_t)width * height * 4];
+      memcpy(data, image.data, (size_t)width * height * 4);
+   }
+   if (image.Is_Planar()) {
+      for (int c = 0 ; c < 4 ; c++) {
+         planes[c] = FrameArena::Acquire((size_t)stride * height);
+         memcpy(planes[c], image.planes[c], (size_t)stride * height);
+      }
+   }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Free image memory.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage::~TargaImage()
+{
+    if (data)
+        delete[] data;
+    for (int c = 0 ; c < 4 ; c++)
+        FrameArena::Release(planes[c]);
+}// ~TargaImage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Switch the image between interleaved RGBA storage in data and planar
+//  storage, one PLANE_ALIGN aligned plane per channel with rows padded to
+//  stride.  Operations that understand planes (the filters, To_Grayscale,
+//  Quant_Uniform, Dither_Threshold, Dither_Random) work on them directly, 
+//  so chained operations avoid splitting and merging the channels on every
+//  call.  Everything else interleaves for the duration of the call.  
+//  Save_Image and To_RGB read the planes directly.  Return success of 
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Set_Planar(bool planar)
+{
+    if (planar == Is_Planar())
+        return true;
+
+    if (planar)
+    {
+        stride = (width + PLANE_ALIGN - 1) / PLANE_ALIGN * PLANE_ALIGN;
+        try
+        {
+            for (int c = 0 ; c < 4 ; c++)
+                planes[c] = FrameArena::Acquire((size_t)stride * height);
+        }
+        catch (bad_alloc&)
+        {
+            for (int c = 0 ; c < 4 ; c++)
+            {
+                FrameArena::Release(planes[c]);
+                planes[c] = NULL;
+            }
+            return false;
+        }
+        Data_To_Planes(this);
+    }
+    else
+    {
+        Planes_To_Data(this);
+        for (int c = 0 ; c < 4 ; c++)
+        {
+            FrameArena::Release(planes[c]);
+            planes[c] = NULL;
+        }
+    }
+
+    return true;
+}// Set_Planar
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Report the scratch memory statistics.  Plane memory comes from the 
+//  same arena, so it is counted too.  Steady state batch runs should show 
+//  heapAllocs stop growing after the first image.
+//
+///////////////////////////////////////////////////////////////////////////////
+ScratchStats TargaImage::Get_Scratch_Stats()
+{
+    ScratchStats    stats;
+
+    stats.inUse = FrameArena::s_inUse;
+    stats.highWater = FrameArena::s_highWater;
+    stats.cached = FrameArena::s_cached;
+    stats.heapAllocs = FrameArena::s_heapAllocs;
+    stats.requests = FrameArena::s_requests;
+    return stats;
+}// Get_Scratch_Stats
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Free the scratch blocks cached by the calling thread, for instance 
+//  after a run on unusually large images.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Trim_Scratch()
+{
+    FrameArena::Trim();
+}// Trim_Scratch
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set the number of threads the image operations split their work 
+//  over, including the calling thread.  0 uses one per hardware thread, 
+//  which is also the default.  Results do not depend on the count.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Set_Thread_Count(int count)
+{
+    TileScheduler::Set_Threads(count);
+}// Set_Thread_Count
+
+
+int TargaImage::Get_Thread_Count()
+{
+    return TileScheduler::Threads();
+}// Get_Thread_Count
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the image operations on the calling thread only, for as long as
+//  the scope exists, without stopping the threads.  For callers that run
+//  several images at once on threads of their own.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage::Serial_Scope::Serial_Scope()
+{
+    TileScheduler::Serial(true);
+}// Serial_Scope
+
+TargaImage::Serial_Scope::~Serial_Scope()
+{
+    TileScheduler::Serial(false);
+}// ~Serial_Scope
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Composite a premultiplied sample with black: floor(value * (255 / 
+//  alpha)) in float, clamped, 0 where alpha is 0.  Alpha_Table holds the 
+//  result of a function like this one for every alpha and value, 
+//  [alpha * 256 + value], built on first use.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline unsigned char Unpremultiply(int value, int alpha)
+{
+    if (!alpha)
+        return BACKGROUND[0];
+
+    int     val = (int)floor(value * ((float)255 / (float)alpha));
+
+    return (unsigned char)min(max(val, 0), 255);
+}// Unpremultiply
+
+template<unsigned char (*FUNCTION)(int, int)> 
+static const unsigned char* Alpha_Table()
+{
+    static struct Table
+    {
+        unsigned char   entry[256 * 256];
+
+        Table()
+        {
+            for (int alpha = 0 ; alpha < 256 ; alpha++)
+                for (int value = 0 ; value < 256 ; value++)
+                    entry[alpha * 256 + value] = FUNCTION(value, alpha);
+        }
+    } table;
+
+    return table.entry;
+}// Alpha_Table
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Un-premultiply RGBA pixels held one to a 32 bit lane, with the same 
+//  float divide and multiply as Unpremultiply.  Where alpha is 0 the 
+//  product is not a number or infinite and converts to INT_MIN, which the
+//  clamp takes to 0.  Alpha comes back cleared.
+//
+///////////////////////////////////////////////////////////////////////////////
+#if defined(TARGA_AVX2)
+static inline __m256i Unpremultiply_Pixels(__m256i px)
+{
+    const __m256i   low = _mm256_set1_epi32(0xFF);
+    const __m256i   zero = _mm256_setzero_si256();
+    __m256          scale = _mm256_div_ps(_mm256_set1_ps(255.0f), _mm256_cvtepi32_ps(_mm256_srli_epi32(px, 24)));
+    __m256i         out = zero;
+
+    for (int c = 0 ; c < 3 ; c++)
+    {
+        __m256  value = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 8 * c), low));
+        __m256i val = _mm256_cvttps_epi32(_mm256_mul_ps(value, scale));
+
+        val = _mm256_min_epi32(_mm256_max_epi32(val, zero), low);
+        out = _mm256_or_si256(out, _mm256_slli_epi32(val, 8 * c));
+    }
+    return out;
+}// Unpremultiply_Pixels
+#elif defined(TARGA_SSE41)
+static inline __m128i Unpremultiply_Pixels(__m128i px)
+{
+    const __m128i   low = _mm_set1_epi32(0xFF);
+    const __m128i   zero = _mm_setzero_si128();
+    __m128          scale = _mm_div_ps(_mm_set1_ps(255.0f), _mm_cvtepi32_ps(_mm_srli_epi32(px, 24)));
+    __m128i         out = zero;
+
+    for (int c = 0 ; c < 3 ; c++)
+    {
+        __m128  value = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8 * c), low));
+        __m128i val = _mm_cvttps_epi32(_mm_mul_ps(value, scale));
+
+        val = _mm_min_epi32(_mm_max_epi32(val, zero), low);
+        out = _mm_or_si128(out, _mm_slli_epi32(val, 8 * c));
+    }
+    return out;
+}// Unpremultiply_Pixels
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert rows [y0, y1) to packed RGB.  Pixels are gathered into RGBA 
+//  lanes, un-premultiplied unless all of them are opaque, and packed to 
+//  24 bits with a byte shuffle.  The tail goes through the table.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<int STEP> 
+static void RGB_Rows(const PixelView& view, int width, int y0, int y1, unsigned char* rgb, const unsigned char* table)
+{
+    for (int y = y0 ; y < y1 ; y++)
+    {
+        size_t              row = (size_t)y * view.stride;
+        const unsigned char *r = view.channel[RED] + row, *g = view.channel[GREEN] + row;
+        const unsigned char *b = view.channel[BLUE] + row, *a = view.channel[3] + row;
+        unsigned char       *out = rgb + (size_t)y * width * 3;
+        int                 x = 0;
+
+#if defined(TARGA_AVX2)
+        const __m256i   opaque = _mm256_set1_epi32((int)0xFF000000);
+        const __m256i   pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                                0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+        for ( ; x + 8 <= width ; x += 8)
+        {
+            __m256i px;
+
+            if (STEP == 4)
+                px = _mm256_loadu_si256((const __m256i*)(r + x * 4));
+            else
+            {
+                px = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(r + x)));
+                px = _mm256_or_si256(px, _mm256_slli_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(g + x))), 8));
+                px = _mm256_or_si256(px, _mm256_slli_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(b + x))), 16));
+                px = _mm256_or_si256(px, _mm256_slli_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(a + x))), 24));
+            }
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(px, opaque), opaque)) != -1)
+                px = Unpremultiply_Pixels(px);
+
+            __m256i packed = _mm256_shuffle_epi8(px, pack);
+            __m128i half = _mm256_castsi256_si128(packed);
+            int     last = _mm_cvtsi128_si32(_mm_srli_si128(half, 8));
+
+            _mm_storel_epi64((__m128i*)(out + x * 3), half);
+            memcpy(out + x * 3 + 8, &last, 4);
+            half = _mm256_extracti128_si256(packed, 1);
+            last = _mm_cvtsi128_si32(_mm_srli_si128(half, 8));
+            _mm_storel_epi64((__m128i*)(out + x * 3 + 12), half);
+            memcpy(out + x * 3 + 20, &last, 4);
+        }
+#elif defined(TARGA_SSE41)
+        const __m128i   opaque = _mm_set1_epi32((int)0xFF000000);
+        const __m128i   pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+        for ( ; x + 4 <= width ; x += 4)
+        {
+            __m128i px;
+
+            if (STEP == 4)
+                px = _mm_loadu_si128((const __m128i*)(r + x * 4));
+            else
+            {
+                int     quad[4];
+
+                memcpy(&quad[0], r + x, 4);
+                memcpy(&quad[1], g + x, 4);
+                memcpy(&quad[2], b + x, 4);
+                memcpy(&quad[3], a + x, 4);
+                px = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(quad[0]));
+                for (int c = 1 ; c < 4 ; c++)
+                    px = _mm_or_si128(px, _mm_slli_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(quad[c])), 8 * c));
+            }
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(px, opaque), opaque)) != 0xFFFF)
+                px = Unpremultiply_Pixels(px);
+
+            __m128i packed = _mm_shuffle_epi8(px, pack);
+            int     last = _mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+
+            _mm_storel_epi64((__m128i*)(out + x * 3), packed);
+            memcpy(out + x * 3 + 8, &last, 4);
+        }
+#endif
+
+        for ( ; x < width ; x++)
+        {
+            const unsigned char *entry = table + a[x * STEP] * 256;
+
+            out[x * 3] = entry[r[x * STEP]];
+            out[x * 3 + 1] = entry[g[x * STEP]];
+            out[x * 3 + 2] = entry[b[x * STEP]];
+        }
+    }
+}// RGB_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Converts an image to RGB form, and returns the rgb pixel data - 24 
+//  bits per pixel. The returned space should be deleted when no longer 
+//  required.
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned char* TargaImage::To_RGB(void)
+{
+    unsigned char   *rgb;
+
+    if (! data)
+	    return NULL;
+
+    rgb = new unsigned char[(size_t)width * height * 3];
+    To_RGB(rgb);
+
+    return rgb;
+}// TargaImage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Converts an image to RGB form into the given buffer, which must hold
+//  width * height * 3 bytes.  Rows are converted in parallel.  Return 
+//  success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::To_RGB(unsigned char* rgb)
+{
+    if (! data || ! rgb)
+	    return false;
+
+    PixelView               view = View(this);
+    const unsigned char     *table = Alpha_Table<Unpremultiply>();
+
+    // Divide out the alpha
+    Parallel_Rows(height, (size_t)width * 7, [&](int y0, int y1) {
+        if (view.step == 1)
+            RGB_Rows<1>(view, width, y0, y1, rgb, table);
+        else
+            RGB_Rows<4>(view, width, y0, y1, rgb, table);
+    });
+
+    return true;
+}// To_RGB
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Alpha as libtarga applies it.  Premultiply is the float product its
+//  loader takes, Straighten the divide its writer did, which leaves values
+//  alone where alpha is 0 and clamps at 255.  Both are kept bit for bit so
+//  files load and save exactly as they did through libtarga.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline unsigned char Premultiply(int value, int alpha)
+{
+    return (unsigned char)(((float)value / 255.0f) * ((float)alpha / 255.0f) * 255.0f);
+}// Premultiply
+
+static inline unsigned char Straighten(int value, int alpha)
+{
+    float   val = value / 255.0f;
+    float   a = alpha / 255.0f;
+
+    if (a > 0.0001)
+        val /= a;
+
+    return (unsigned char)(val > 1.0f ? 255.0f : val * 255.0f);
+}// Straighten
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      A file mapped read only into memory.  Data is NULL if the file could
+//  not be opened or is empty.
+//
+///////////////////////////////////////////////////////////////////////////////
+class MappedFile
+{
+    public:
+        explicit MappedFile(const char* filename);
+        ~MappedFile();
+
+        const unsigned char* Data() const { return m_pData; }
+        size_t Size() const { return m_size; }
+
+        void Prefetch(size_t offset, size_t bytes) const;   // start reading a range of the file in
+        void Discard(size_t offset, size_t bytes) const;    // let go of the pages of a range already read
+
+    private:
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+
+        const unsigned char     *m_pData;
+        size_t                  m_size;
+};// MappedFile
+
+MappedFile::MappedFile(const char* filename) : m_pData(NULL), m_size(0)
+{
+#ifdef _WIN32
+    HANDLE          file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                       FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER   size;
+
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && (unsigned long long)size.QuadPart <= (size_t)-1)
+    {
+        HANDLE  mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+        // the view keeps the mapping alive
+        if (mapping)
+        {
+            m_pData = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            m_size = m_pData ? (size_t)size.QuadPart : 0;
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    int             file = open(filename, O_RDONLY);
+    struct stat     info;
+
+    if (file < 0)
+        return;
+    if (fstat(file, &info) == 0 && info.st_size > 0)
+    {
+        void    *view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+        if (view != MAP_FAILED)
+        {
+            m_pData = (const unsigned char*)view;
+            m_size = (size_t)info.st_size;
+        }
+    }
+    close(file);
+#endif
+}// MappedFile
+
+MappedFile::~MappedFile()
+{
+    if (!m_pData)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(m_pData);
+#else
+    munmap((void*)m_pData, m_size);
+#endif
+}// ~MappedFile
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Hint which parts of the file are wanted next and which are done
+//  with.  Discard keeps pages only partly in the range, and dropped pages
+//  are read back in if touched again.  Windows is left to trim the view on
+//  its own.
+//
+///////////////////////////////////////////////////////////////////////////////
+void MappedFile::Prefetch(size_t offset, size_t bytes) const
+{
+#ifndef _WIN32
+    size_t  page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t  begin = offset / page * page;
+    size_t  end = min(offset + bytes, m_size);
+
+    if (m_pData && begin < end)
+        madvise((void*)(m_pData + begin), end - begin, MADV_WILLNEED);
+#endif
+}// Prefetch
+
+void MappedFile::Discard(size_t offset, size_t bytes) const
+{
+#ifndef _WIN32
+    size_t  page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t  begin = (offset + page - 1) / page * page;
+    size_t  end = min(offset + bytes, m_size) / page * page;
+
+    if (m_pData && begin < end)
+        madvise((void*)(m_pData + begin), end - begin, MADV_DONTNEED);
+#endif
+}// Discard
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The fields of a targa header the decoder uses.  Read_Targa_Header
+//  returns false unless the file holds the whole header, image id and
+//  color map.  Targa_Direct is true of the files decoded here rather than
+//  by libtarga: true color, 24 or 32 bits, raw or run length encoded.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct TargaHeader
+{
+    int         colorMapType;
+    int         imageType;      // 2 raw, 10 run length encoded true color
+    int         width;
+    int         height;
+    int         depth;          // bits per pixel
+    int         descriptor;     // alpha bits and origin
+    size_t      offset;         // first byte of the pixels
+};
+
+static bool Read_Targa_Header(const unsigned char* file, size_t size, TargaHeader& header)
+{
+    if (size < (size_t)TGA_HEADER_BYTES)
+        return false;
+
+    header.colorMapType = file[1];
+    header.imageType = file[2];
+    header.width = file[12] | file[13] << 8;
+    header.height = file[14] | file[15] << 8;
+    header.depth = file[16];
+    header.descriptor = file[17];
+    header.offset = TGA_HEADER_BYTES + file[0];
+    if (header.colorMapType)
+        header.offset += (size_t)(file[5] | file[6] << 8) * ((file[7] + 7) / 8);
+
+    return header.offset <= size;
+}// Read_Targa_Header
+
+static bool Targa_Direct(const TargaHeader& header)
+{
+    return !header.colorMapType && (header.imageType == 2 || header.imageType == 10) &&
+           (header.depth == 24 || header.depth == 32) && header.width > 0 && header.height > 0;
+}// Targa_Direct
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Position in the packets of a run length encoded targa.  Expand_Rle
+//  copies the next count pixels of bytes each to dst, or skips them if dst
+//  is NULL, and returns false if the packets run out first.  Packets may
+//  run across rows.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct RleCursor
+{
+    const unsigned char     *next;      // next packet, or the pixel of a run in progress
+    const unsigned char     *end;       // end of the file
+    int                     left;       // pixels left in the current packet
+    bool                    run;        // the packet repeats one pixel
+};
+
+static bool Expand_Rle(RleCursor& cursor, unsigned char* dst, int count, int bytes)
+{
+    while (count > 0)
+    {
+        if (!cursor.left)
+        {
+            if (cursor.next >= cursor.end)
+                return false;
+            cursor.run = (*cursor.next & 0x80) != 0;
+            cursor.left = (*cursor.next++ & 0x7F) + 1;
+        }
+
+        int     n = min(count, cursor.left);
+
+        if (cursor.run)
+        {
+            if (cursor.end - cursor.next < bytes)
+                return false;
+            for (int i = 0 ; dst && i < n ; i++)
+                memcpy(dst + i * bytes, cursor.next, bytes);
+            if (n == cursor.left)
+                cursor.next += bytes;
+        }
+        else
+        {
+            if ((size_t)(cursor.end - cursor.next) < (size_t)n * bytes)
+                return false;
+            if (dst)
+                memcpy(dst, cursor.next, (size_t)n * bytes);
+            cursor.next += (size_t)n * bytes;
+        }
+        cursor.left -= n;
+        count -= n;
+        if (dst)
+            dst += (size_t)n * bytes;
+    }
+
+    return true;
+}// Expand_Rle
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert a row of BGR or BGRA targa pixels, bytes each, to
+//  premultiplied RGBA.  Without alpha the pixels are opaque.  Groups of
+//  opaque pixels only have their bytes reordered, premultiplying by 255
+//  changes nothing.  reversed rows run right to left in the file.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline void Targa_Pixel(const unsigned char* src, unsigned char* dst, bool alpha, const unsigned char* table)
+{
+    int                     a = alpha ? src[3] : 255;
+    const unsigned char     *entry = table + a * 256;
+
+    dst[0] = entry[src[2]];
+    dst[1] = entry[src[1]];
+    dst[2] = entry[src[0]];
+    dst[3] = (unsigned char)a;
+}// Targa_Pixel
+
+static void Targa_To_RGBA(const unsigned char* src, unsigned char* dst, int width, int bytes, bool alpha,
+                          bool reversed, const unsigned char* table)
+{
+    int     x = 0;
+
+    if (reversed)
+    {
+        for ( ; x < width ; x++)
+            Targa_Pixel(src + (size_t)(width - 1 - x) * bytes, dst + x * 4, alpha, table);
+        return;
+    }
+
+#if defined(TARGA_SSE41)
+    const __m128i   opaque = _mm_set1_epi32((int)0xFF000000);
+
+    if (bytes == 4)
+    {
+        const __m128i   swap = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+        for ( ; x + 4 <= width ; x += 4)
+        {
+            __m128i px = _mm_loadu_si128((const __m128i*)(src + x * 4));
+
+            if (!alpha)
+                px = _mm_or_si128(px, opaque);
+            else if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(px, opaque), opaque)) != 0xFFFF)
+            {
+                for (int i = x ; i < x + 4 ; i++)
+                    Targa_Pixel(src + i * 4, dst + i * 4, true, table);
+                continue;
+            }
+            _mm_storeu_si128((__m128i*)(dst + x * 4), _mm_shuffle_epi8(px, swap));
+        }
+    }
+    else
+    {
+        const __m128i   expand = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+
+        // each load reads 16 bytes for 12
+        for ( ; x + 6 <= width ; x += 4)
+        {
+            __m128i px = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + x * 3)), expand);
+
+            _mm_storeu_si128((__m128i*)(dst + x * 4), _mm_or_si128(px, opaque));
+        }
+    }
+#endif
+
+    for ( ; x < width ; x++)
+        Targa_Pixel(src + (size_t)x * bytes, dst + x * 4, alpha, table);
+}// Targa_To_RGBA
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      File row of image row y, or image row of file row y: targas store
+//  the bottom row first unless the origin is at the top.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline int Targa_Row(const TargaHeader& header, int y)
+{
+    return (header.descriptor & TGA_ORIGIN_TOP) ? y : header.height - 1 - y;
+}// Targa_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Step cursor over file rows [row0, row1) of a run length encoded
+//  targa, noting where each starts in index[image row - first].  Return
+//  false if the packets run out.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Index_Rle(const TargaHeader& header, RleCursor& cursor, int row0, int row1, RleCursor* index, int first)
+{
+    for (int row = row0 ; row < row1 ; row++)
+    {
+        index[Targa_Row(header, row) - first] = cursor;
+        if (!Expand_Rle(cursor, NULL, header.width, header.depth / 8))
+            return false;
+    }
+
+    return true;
+}// Index_Rle
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Decode image rows [y0, y1) of a true color targa held in memory into
+//  dst as premultiplied RGBA, rows in parallel.  The origin bits decide
+//  which file row and which end of it each image row comes from.  For run
+//  length encoded files cursors[y - y0] is where image row y starts, and
+//  rows are expanded one at a time.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Decode_Targa_Rows(const TargaHeader& header, const unsigned char* file, const RleCursor* cursors,
+                              int y0, int y1, unsigned char* dst)
+{
+    int                     width = header.width;
+    int                     bytes = header.depth / 8;
+    bool                    alpha = bytes == 4 && (header.descriptor & 0x0F) != 0;
+    bool                    reversed = (header.descriptor & TGA_ORIGIN_RIGHT) != 0;
+    size_t                  rowBytes = (size_t)width * bytes;
+    const unsigned char     *table = Alpha_Table<Premultiply>();
+
+    Parallel_Rows(y1 - y0, (size_t)width * (4 + bytes), [&](int first, int last) {
+        Scratch<unsigned char>  expanded(cursors ? rowBytes : 0);
+
+        for (int i = first ; i < last ; i++)
+        {
+            const unsigned char     *src = file + header.offset + Targa_Row(header, y0 + i) * rowBytes;
+
+            if (cursors)
+            {
+                RleCursor   cursor = cursors[i];
+
+                Expand_Rle(cursor, expanded.Get(), width, bytes);
+                src = expanded.Get();
+            }
+            Targa_To_RGBA(src, dst + (size_t)i * width * 4, width, bytes, alpha, reversed, table);
+        }
+    });
+}// Decode_Targa_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Decode a true color targa held in memory straight into a new image.
+//  Run length encoded files are scanned once for where each row starts.
+//  Return NULL if the file is not one Targa_Direct accepts or is cut
+//  short.
+//
+///////////////////////////////////////////////////////////////////////////////
+static TargaImage* Decode_Targa(const unsigned char* file, size_t size)
+{
+    TargaHeader     header;
+
+    if (!Read_Targa_Header(file, size, header) || !Targa_Direct(header))
+        return NULL;
+
+    bool                encoded = header.imageType == 10;
+    Scratch<RleCursor>  cursors(encoded ? header.height : 0);
+
+    if (encoded)
+    {
+        RleCursor   cursor = { file + header.offset, file + size, 0, false };
+
+        if (!Index_Rle(header, cursor, 0, header.height, cursors.Get(), 0))
+            return NULL;
+    }
+    else if (size - header.offset < (size_t)header.width * (header.depth / 8) * header.height)
+        return NULL;
+
+    TargaImage  *result = new TargaImage;
+
+    result->width = header.width;
+    result->height = header.height;
+    result->data = new unsigned char[(size_t)header.width * header.height * 4];
+    Decode_Targa_Rows(header, file, encoded ? cursors.Get() : NULL, 0, header.height, result->data);
+
+    return result;
+}// Decode_Targa
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert image row y to a row of a 32 bit targa, BGRA with the alpha
+//  divided back out.  Groups of opaque pixels only have their bytes
+//  reordered.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<int STEP>
+static void RGBA_To_Targa(const PixelView& view, int width, int y, unsigned char* dst, const unsigned char* table)
+{
+    size_t              row = (size_t)y * view.stride;
+    const unsigned char *r = view.channel[RED] + row, *g = view.channel[GREEN] + row;
+    const unsigned char *b = view.channel[BLUE] + row, *a = view.channel[3] + row;
+    int                 x = 0;
+
+#if defined(TARGA_SSE41)
+    if (STEP == 4)
+    {
+        const __m128i   opaque = _mm_set1_epi32((int)0xFF000000);
+        const __m128i   swap = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+        for ( ; x + 4 <= width ; x += 4)
+        {
+            __m128i px = _mm_loadu_si128((const __m128i*)(r + x * 4));
+
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(px, opaque), opaque)) == 0xFFFF)
+            {
+                _mm_storeu_si128((__m128i*)(dst + x * 4), _mm_shuffle_epi8(px, swap));
+                continue;
+            }
+            for (int i = x ; i < x + 4 ; i++)
+            {
+                const unsigned char *entry = table + a[i * 4] * 256;
+
+                dst[i * 4] = entry[b[i * 4]];
+                dst[i * 4 + 1] = entry[g[i * 4]];
+                dst[i * 4 + 2] = entry[r[i * 4]];
+                dst[i * 4 + 3] = a[i * 4];
+            }
+        }
+    }
+#endif
+
+    for ( ; x < width ; x++)
+    {
+        const unsigned char *entry = table + a[x * STEP] * 256;
+
+        dst[x * 4] = entry[b[x * STEP]];
+        dst[x * 4 + 1] = entry[g[x * STEP]];
+        dst[x * 4 + 2] = entry[r[x * STEP]];
+        dst[x * 4 + 3] = a[x * STEP];
+    }
+}// RGBA_To_Targa
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Targa_Fits reports whether an image of the given size can be saved
+//  as a targa, whose sizes are 16 bits.  Write_Targa_Header writes the 
+//  header of a targa with bytes per pixel, raw or run length encoded, and
+//  returns false if the write fails.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Targa_Fits(int width, int height)
+{
+    if (width <= 0xFFFF && height <= 0xFFFF)
+        return true;
+
+    cout << "TGA Save Error: " << width << " x " << height << " is too large for a targa" << endl;
+    return false;
+}// Targa_Fits
+
+static bool Write_Targa_Header(FILE* file, int width, int height, int bytes, bool encoded, bool topFirst)
+{
+    unsigned char   header[TGA_HEADER_BYTES] = { 0 };
+
+    header[2] = encoded ? 10 : 2;
+    header[12] = (unsigned char)width;
+    header[13] = (unsigned char)(width >> 8);
+    header[14] = (unsigned char)height;
+    header[15] = (unsigned char)(height >> 8);
+    header[16] = (unsigned char)(bytes * 8);
+    header[17] = (unsigned char)((bytes == 4 ? 8 : 0) | (topFirst ? TGA_ORIGIN_TOP : 0));
+
+    return fwrite(header, TGA_HEADER_BYTES, 1, file) == 1;
+}// Write_Targa_Header
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run length encode a row of BGRA pixels into targa packets of bytes
+//  per pixel, 3 dropping the alpha.  Runs of two or more equal pixels
+//  become run packets and the pixels between them raw packets, neither
+//  crossing the end of the row.  out must hold width * (bytes + 1) bytes.
+//  Return the number of bytes written.  Run_Length counts the pixels from
+//  x up to limit equal to word; Literal_Length those from x up to limit
+//  that differ from the pixel after them.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline unsigned int Pixel_Word(const unsigned char* row, int x)
+{
+    unsigned int    word;
+
+    memcpy(&word, row + x * 4, 4);
+    return word;
+}// Pixel_Word
+
+static int Run_Length(const unsigned char* row, int x, int limit, unsigned int word)
+{
+    int     n = x;
+
+#if defined(TARGA_SSE41)
+    const __m128i   key = _mm_set1_epi32((int)word);
+
+    for ( ; n + 4 <= limit ; n += 4)
+    {
+        __m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(row + n * 4)), key);
+        int     same = _mm_movemask_ps(_mm_castsi128_ps(equal));
+
+        if (same != 0xF)
+            return n + Low_Bit(~same & 0xF) - x;
+    }
+#endif
+
+    while (n < limit && Pixel_Word(row, n) == word)
+        n++;
+
+    return n - x;
+}// Run_Length
+
+static int Literal_Length(const unsigned char* row, int x, int limit, int width)
+{
+    int     n = x;
+
+#if defined(TARGA_SSE41)
+    for ( ; n + 4 <= limit && n + 5 <= width ; n += 4)
+    {
+        __m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(row + n * 4)),
+                                        _mm_loadu_si128((const __m128i*)(row + n * 4 + 4)));
+        int     same = _mm_movemask_ps(_mm_castsi128_ps(equal));
+
+        if (same)
+            return n + Low_Bit(same) - x;
+    }
+#endif
+
+    while (n < limit && !(n + 1 < width && Pixel_Word(row, n) == Pixel_Word(row, n + 1)))
+        n++;
+
+    return n - x;
+}// Literal_Length
+
+static size_t Encode_Rle(const unsigned char* row, int width, int bytes, unsigned char* out)
+{
+    unsigned char   *start = out;
+
+    for (int x = 0 ; x < width ; )
+    {
+        int     limit = min(width, x + 128);
+        int     run = Run_Length(row, x, limit, Pixel_Word(row, x));
+
+        if (run >= 2)
+        {
+            *out++ = (unsigned char)(0x80 | (run - 1));
+            memcpy(out, row + x * 4, bytes);
+            out += bytes;
+            x += run;
+            continue;
+        }
+
+        int     count = Literal_Length(row, x, limit, width);
+
+        *out++ = (unsigned char)(count - 1);
+        if (bytes == 4)
+        {
+            memcpy(out, row + x * 4, (size_t)count * 4);
+            out += count * 4;
+        }
+        else
+        {
+            for (int i = x ; i < x + count ; i++, out += 3)
+                memcpy(out, row + i * 4, 3);
+        }
+        x += count;
+    }
+
+    return out - start;
+}// Encode_Rle
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the rows of an image to a targa, top or bottom row first.
+//  Rows are converted in parallel a strip at a time and each strip written
+//  as it completes.  Encoded rows are packed by each tile into its own
+//  part of the strip buffer, and the parts written in order.  Raw rows
+//  must be 4 bytes.  Return false if a write fails.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Write_Targa_Rows(FILE* file, TargaImage* image, bool bottomFirst, int bytes, bool encoded)
+{
+    PixelView               view = View(image);
+    int                     width = image->width, height = image->height;
+    const unsigned char     *table = Alpha_Table<Straighten>();
+    size_t                  rowBytes = max((size_t)width * 4, (size_t)1);
+    size_t                  packedBytes = encoded ? (size_t)width * (bytes + 1) : rowBytes;
+    int                     stripRows = (int)min((size_t)max(height, 1), max(TGA_STRIP_BYTES / rowBytes, (size_t)1));
+    Scratch<unsigned char>  strip(stripRows * packedBytes);
+    Scratch<size_t>         used(stripRows);
+
+    for (int first = 0 ; first < height ; first += stripRows)
+    {
+        int     rows = min(stripRows, height - first);
+
+        memset(used.Get(), 0, rows * sizeof(size_t));
+        Parallel_Rows(rows, rowBytes * 2, [&](int y0, int y1) {
+            Scratch<unsigned char>  pixels(encoded ? rowBytes : 0);
+            unsigned char           *out = strip.Get() + y0 * packedBytes;
+
+            for (int i = y0 ; i < y1 ; i++)
+            {
+                int             y = bottomFirst ? height - 1 - first - i : first + i;
+                unsigned char   *dst = encoded ? pixels.Get() : out;
+
+                if (view.step == 1)
+                    RGBA_To_Targa<1>(view, width, y, dst, table);
+                else
+                    RGBA_To_Targa<4>(view, width, y, dst, table);
+                out += encoded ? Encode_Rle(dst, width, bytes, out) : (size_t)width * 4;
+            }
+            used[y0] = out - (strip.Get() + y0 * packedBytes);
+        });
+
+        for (int i = 0 ; i < rows ; i++)
+        {
+            if (used[i] && fwrite(strip.Get() + i * packedBytes, 1, used[i], file) != used[i])
+                return false;
+        }
+    }
+
+    return true;
+}// Write_Targa_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      True if any pixel of the image is not opaque.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Uses_Alpha(const PixelView& view, int width, int height)
+{
+    atomic<bool>    found(false);
+
+    Parallel_Rows(height, (size_t)width * view.step, [&](int y0, int y1) {
+        for (int y = y0 ; y < y1 && !found.load(memory_order_relaxed) ; y++)
+        {
+            const unsigned char     *alpha = view.channel[3] + (size_t)y * view.stride;
+            unsigned char           all = 0xFF;
+
+            if (view.step == 1)
+            {
+                for (int x = 0 ; x < width ; x++)
+                    all &= alpha[x];
+            }
+            else
+            {
+                for (int x = 0 ; x < width ; x++)
+                    all &= alpha[x * 4];
+            }
+            if (all != 0xFF)
+                found = true;
+        }
+    });
+
+    return found;
+}// Uses_Alpha
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Save the image to a targa file, bottom row first.  SAVE_RAW writes
+//  32 bit pixels uncompressed.  SAVE_COMPACT run length encodes them, and
+//  drops the alpha if every pixel is opaque.  Returns 1 on success, 0 on
+//  failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Save_Image(const char *filename, SaveFormat format)
+{
+    if (! data || !Targa_Fits(width, height))
+	    return false;
+
+    bool    encoded = format == SAVE_COMPACT;
+    int     bytes = (encoded && !Uses_Alpha(View(this), width, height)) ? 3 : 4;
+    FILE    *file = fopen(filename, "wb");
+
+    if (!file)
+    {
+        cout << "TGA Save Error: cannot open " << filename << endl;
+        return false;
+    }
+
+    bool    ok = Write_Targa_Header(file, width, height, bytes, encoded, false) &&
+                 Write_Targa_Rows(file, this, true, bytes, encoded);
+
+    if (fclose(file) != 0 || !ok)
+    {
+        cout << "TGA Save Error: writing " << filename << " failed" << endl;
+        return false;
+    }
+
+    return true;
+}// Save_Image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Load a targa image from a file.  Return a new TargaImage object which
+//  must be deleted by caller.  Return NULL on failure.  True color files
+//  are mapped and decoded straight into the image.  Color mapped, gray and
+//  15 or 16 bit files, and damaged ones, go through libtarga.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* TargaImage::Load_Image(char *filename)
+{
+    unsigned char   *temp_data;
+    TargaImage	    *result;
+    int		        width, height;
+
+    if (!filename)
+    {
+        cout << "No filename given." << endl;
+        return NULL;
+    }// if
+
+    {
+        MappedFile  file(filename);
+
+        file.Prefetch(0, file.Size());
+        if (file.Data() && (result = Decode_Targa(file.Data(), file.Size())) != NULL)
+            return result;
+    }
+
+    temp_data = (unsigned char*)tga_load(filename, &width, &height, TGA_TRUECOLOR_32);
+    if (!temp_data)
+    {
+        cout << "TGA Error: " << tga_error_string(tga_get_last_error()) << endl;
+	    width = height = 0;
+	    return NULL;
+    }
+
+    // libtarga leaves the rows bottom to top, flip while copying out of the buffer
+    result = new TargaImage;
+    result->width = width;
+    result->height = height;
+    result->data = new unsigned char[(size_t)width * height * 4];
+    for (int i = 0 ; i < height ; i++)
+        memcpy(result->data + (size_t)i * width * 4,
+               temp_data + (size_t)(height - i - 1) * width * 4, (size_t)width * 4);
+    free(temp_data);
+
+    return result;
+}// Load_Image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The open file of a TargaReader.  For bottom first run length encoded
+//  files index holds where every image row starts, found when the file is
+//  opened; top first ones are read in file order from cursor.  strip holds
+//  the row starts of the strip being read.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct TargaReader::Source
+{
+    explicit Source(const char* filename) : file(filename) {}
+
+    MappedFile          file;
+    TargaHeader         header;
+    vector<RleCursor>   index;
+    vector<RleCursor>   strip;
+    RleCursor           cursor;
+};// Source
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor and destructor.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaReader::TargaReader() : m_pSource(NULL), m_width(0), m_height(0), m_row(0)
+{}// TargaReader
+
+TargaReader::~TargaReader()
+{
+    Close();
+}// ~TargaReader
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Map a targa for reading.  Only true color files, 24 or 32 bits, raw
+//  or run length encoded, can be streamed.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaReader::Open(const char* filename)
+{
+    Close();
+    if (!filename)
+        return false;
+
+    Source          *source = new Source(filename);
+    TargaHeader     &header = source->header;
+    const char      *error = NULL;
+
+    if (!source->file.Data())
+        error = "cannot open the file";
+    else if (!Read_Targa_Header(source->file.Data(), source->file.Size(), header))
+        error = "bad header";
+    else if (!Targa_Direct(header))
+        error = "only true color 24 and 32 bit files can be streamed";
+    else if (header.imageType == 2)
+    {
+        if (source->file.Size() - header.offset < (size_t)header.width * (header.depth / 8) * header.height)
+            error = "unexpected end of file";
+    }
+    else
+    {
+        RleCursor   start = { source->file.Data() + header.offset, source->file.Data() + source->file.Size(), 0, false };
+
+        source->cursor = start;
+        if (!(header.descriptor & TGA_ORIGIN_TOP))
+        {
+            // rows are wanted in the reverse of file order, find them all first
+            source->index.resize(header.height);
+            if (!Index_Rle(header, source->cursor, 0, header.height, &source->index[0], 0))
+                error = "unexpected end of file";
+            source->file.Discard(0, source->file.Size());
+        }
+    }
+
+    if (error)
+    {
+        cout << "TGA Error: " << filename << ": " << error << endl;
+        delete source;
+        return false;
+    }
+
+    m_pSource = source;
+    m_width = header.width;
+    m_height = header.height;
+    m_row = 0;
+
+    return true;
+}// Open
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Unmap the file.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaReader::Close()
+{
+    delete m_pSource;
+    m_pSource = NULL;
+    m_width = m_height = m_row = 0;
+}// Close
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Read the next rows of the image into pStrip, which is resized to
+//  hold them, as premultiplied RGBA.  rows defaults to what fits in about
+//  TGA_STRIP_BYTES.  Pages of the file already read are dropped, and the
+//  next strip is read ahead, so only a couple of strips are in memory at
+//  once.  Return false at the end of the image or on error.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaReader::Read_Strip(TargaImage* pStrip, int rows)
+{
+    if (!m_pSource || !pStrip || m_row >= m_height)
+        return false;
+
+    Source              &source = *m_pSource;
+    const TargaHeader   &header = source.header;
+    size_t              rowBytes = (size_t)m_width * (header.depth / 8);
+    bool                encoded = header.imageType == 10;
+
+    if (rows <= 0)
+        rows = (int)max(TGA_STRIP_BYTES / ((size_t)m_width * 4), (size_t)1);
+    rows = min(rows, m_height - m_row);
+
+    if (encoded)
+    {
+        source.strip.resize(rows);
+        if (source.index.empty())
+        {
+            if (!Index_Rle(header, source.cursor, m_row, m_row + rows, &source.strip[0], m_row))
+            {
+                cout << "TGA Error: unexpected end of file" << endl;
+                return false;
+            }
+        }
+        else
+            copy(source.index.begin() + m_row, source.index.begin() + m_row + rows, source.strip.begin());
+    }
+
+    if (pStrip->Is_Planar())
+        pStrip->Set_Planar(false);
+    if (!pStrip->data || (size_t)pStrip->width * pStrip->height != (size_t)m_width * rows)
+    {
+        delete[] pStrip->data;
+        pStrip->data = new unsigned char[(size_t)m_width * rows * 4];
+    }
+    pStrip->width = m_width;
+    pStrip->height = rows;
+
+    Decode_Targa_Rows(header, source.file.Data(), encoded ? &source.strip[0] : NULL, m_row, m_row + rows, pStrip->data);
+
+    // drop what was read, start reading what comes next
+    const unsigned char     *base = source.file.Data();
+
+    if (!encoded)
+    {
+        size_t  first = header.offset + min(Targa_Row(header, m_row), Targa_Row(header, m_row + rows - 1)) * rowBytes;
+        int     next = min(rows, m_height - m_row - rows);
+
+        source.file.Discard(first, rows * rowBytes);
+        if (next > 0)
+            source.file.Prefetch(header.offset + min(Targa_Row(header, m_row + rows),
+                                                     Targa_Row(header, m_row + rows + next - 1)) * rowBytes, next * rowBytes);
+    }
+    else if (source.index.empty())
+    {
+        source.file.Discard(source.strip[0].next - base, source.cursor.next - source.strip[0].next);
+        source.file.Prefetch(source.cursor.next - base, rows * rowBytes);
+    }
+    else
+    {
+        const unsigned char     *last = source.strip[rows - 1].next;
+        int                     next = min(rows, m_height - m_row - rows);
+
+        source.file.Discard(last - base, source.strip[0].next - last);
+        if (next > 0)
+        {
+            const unsigned char *begin = source.index[m_row + rows + next - 1].next;
+
+            source.file.Prefetch(begin - base, last - begin);
+        }
+    }
+    m_row += rows;
+
+    return true;
+}// Read_Strip
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor and destructor.  An open file is closed, and left short
+//  if not all of its rows were written.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaWriter::TargaWriter() : m_pFile(NULL), m_width(0), m_height(0), m_row(0), m_bFailed(false)
+{}// TargaWriter
+
+TargaWriter::~TargaWriter()
+{
+    Close();
+}// ~TargaWriter
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Create a targa of the given size and write its header.  The file is
+//  written top row first.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaWriter::Open(const char* filename, int width, int height)
+{
+    Close();
+    if (!filename || width <= 0 || height <= 0 || !Targa_Fits(width, height))
+        return false;
+
+    m_pFile = fopen(filename, "wb");
+    if (!m_pFile)
+    {
+        cout << "TGA Save Error: cannot open " << filename << endl;
+        return false;
+    }
+
+    m_width = width;
+    m_height = height;
+    m_row = 0;
+    m_bFailed = !Write_Targa_Header(m_pFile, width, height, 4, false, true);
+
+    return !m_bFailed;
+}// Open
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Append the rows of pStrip, which must be as wide as the file, below
+//  those already written.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaWriter::Write_Strip(TargaImage* pStrip)
+{
+    if (!m_pFile || m_bFailed || !pStrip || !pStrip->data || pStrip->width != m_width ||
+        pStrip->height > m_height - m_row)
+        return false;
+
+    m_bFailed = !Write_Targa_Rows(m_pFile, pStrip, false, 4, false);
+    m_row += pStrip->height;
+
+    return !m_bFailed;
+}// Write_Strip
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Finish the file.  Return true if every row was written.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaWriter::Close()
+{
+    if (!m_pFile)
+        return false;
+
+    bool    ok = fclose(m_pFile) == 0 && !m_bFailed && m_row == m_height;
+
+    if (!ok)
+        cout << "TGA Save Error: writing the file failed after " << m_row << " of " << m_height << " rows" << endl;
+    m_pFile = NULL;
+
+    return ok;
+}// Close
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run an operation over a targa file a strip of rows at a time and
+//  write the result to another, so the image never has to fit in memory.
+//  Only for operations that change each pixel on its own: To_Grayscale,
+//  Quant_Uniform, Dither_Threshold and Dither_Random.  stripRows of 0
+//  picks strips of about TGA_STRIP_BYTES.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Process_Strips(const char* source, const char* dest, bool (TargaImage::*operation)(), int stripRows)
+{
+    TargaReader     reader;
+    TargaWriter     writer;
+    TargaImage      strip;
+
+    if (!operation || !reader.Open(source) || !writer.Open(dest, reader.Width(), reader.Height()))
+        return false;
+
+    while (reader.Read_Strip(&strip, stripRows))
+    {
+        if (!(strip.*operation)() || !writer.Write_Strip(&strip))
+            return false;
+    }
+
+    return reader.Next_Row() == reader.Height() && writer.Close();
+}// Process_Strips
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Per pixel kernels for the operations that run on either layout.  Each
+//  handles rows [y0, y1); STEP is the pixel step of the view, so both 
+//  layouts get a loop with a constant stride.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<int STEP> static void Grayscale_Rows(const PixelView& view, int width, int y0, int y1)
+{
+    float grayscale;
+
+    for (int y = y0 ; y < y1 ; y++)
+    {
+        unsigned char   *r = view.channel[RED] + (size_t)y * view.stride;
+        unsigned char   *g = view.channel[GREEN] + (size_t)y * view.stride;
+        unsigned char   *b = view.channel[BLUE] + (size_t)y * view.stride;
+
+        for (int x = 0 ; x < width * STEP ; x += STEP)
+        {
+            grayscale = 0.299 * r[x] + 0.587 * g[x] + 0.114 * b[x];
+            r[x] = grayscale;
+            g[x] = grayscale;
+            b[x] = grayscale;
+        }
+    }
+}// Grayscale_Rows
+
+template<int STEP> static void Quant_Uniform_Rows(const PixelView& view, int width, int y0, int y1)
+{
+    for (int y = y0 ; y < y1 ; y++)
+    {
+        unsigned char   *r = view.channel[RED] + (size_t)y * view.stride;
+        unsigned char   *g = view.channel[GREEN] + (size_t)y * view.stride;
+        unsigned char   *b = view.channel[BLUE] + (size_t)y * view.stride;
+
+        for (int x = 0 ; x < width * STEP ; x += STEP)
+        {
+            r[x] = r[x] / 32 * 32;
+            g[x] = g[x] / 32 * 32;
+            b[x] = b[x] / 64 * 64;
+        }
+    }
+}// Quant_Uniform_Rows
+
+// Set the pixel to black or white depending on which side of the threshold
+// its gray value is.  The noise term is added to the gray value first.
+template<int STEP> static void Threshold_Rows(const PixelView& view, int width, int y0, int y1, bool random)
+{
+    float grayscale;
+
+    for (int y = y0 ; y < y1 ; y++)
+    {
+        unsigned char   *r = view.channel[RED] + (size_t)y * view.stride;
+        unsigned char   *g = view.channel[GREEN] + (size_t)y * view.stride;
+        unsigned char   *b = view.channel[BLUE] + (size_t)y * view.stride;
+
+        for (int x = 0 ; x < width * STEP ; x += STEP)
+        {
+            grayscale = 0.299 * r[x]/255 + 0.587 * g[x]/255 + 0.114 * b[x]/255;   // [0,255] change to [0,1] scale
+            if (random)
+                grayscale += ((float)rand())/RAND_MAX * 0.4 - 0.2;
+            r[x] = g[x] = b[x] = (grayscale < 0.5) ? 0 : 255;
+        }
+    }
+}// Threshold_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert image to grayscale.  Red, green, and blue channels should all 
+//  contain grayscale value.  Alpha channel shoould be left unchanged.  Return
+//  success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::To_Grayscale()
+{
+    PixelView   view = View(this);
+
+    Parallel_Rows(height, (size_t)width * 4, [&](int y0, int y1) {
+        if (view.step == 1)
+            Grayscale_Rows<1>(view, width, y0, y1);
+        else
+            Grayscale_Rows<4>(view, width, y0, y1);
+    });
+
+    return true;
+}// To_Grayscale
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//  Convert the image to an 8 bit image using uniform quantization.  Return 
+//  success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Quant_Uniform()
+{
+    PixelView   view = View(this);
+
+    Parallel_Rows(height, (size_t)width * 4, [&](int y0, int y1) {
+        if (view.step == 1)
+            Quant_Uniform_Rows<1>(view, width, y0, y1);
+        else
+            Quant_Uniform_Rows<4>(view, width, y0, y1);
+    });
+
+    return true;
+}// Quant_Uniform
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Color histogram shared by the palette quantizers.  Colors are binned
+//  on their top 5 bits per channel; each bin keeps its pixel count and the
+//  sums of the full precision channels, so the color a bin stands for is 
+//  the mean of its pixels rather than the bin corner.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct ColorBin
+{
+    unsigned int        count;          // pixels in the bin
+    unsigned long long  sum[3];         // red, green and blue summed over those pixels
+};
+
+// Bin of a partial histogram, small enough to count HIST_CHUNK_PIXELS pixels
+struct ChunkBin
+{
+    unsigned int        count;
+    unsigned int        sum[3];
+};
+
+struct PaletteColor
+{
+    int                 r, g, b;
+};
+
+static inline int Color_Bin(int r, int g, int b)
+{
+    return ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+}// Color_Bin
+
+static PaletteColor Bin_Mean(const ColorBin& bin)
+{
+    PaletteColor    color;
+
+    color.r = (int)((bin.sum[RED] + bin.count / 2) / bin.count);
+    color.g = (int)((bin.sum[GREEN] + bin.count / 2) / bin.count);
+    color.b = (int)((bin.sum[BLUE] + bin.count / 2) / bin.count);
+    return color;
+}// Bin_Mean
+
+
+// Count rows [y0, y1) into a partial histogram
+template<int STEP> static void Count_Rows(const PixelView& view, int width, int y0, int y1, ChunkBin* hist)
+{
+    for (int y = y0 ; y < y1 ; y++)
+    {
+        const unsigned char *r = view.channel[RED] + (size_t)y * view.stride;
+        const unsigned char *g = view.channel[GREEN] + (size_t)y * view.stride;
+        const unsigned char *b = view.channel[BLUE] + (size_t)y * view.stride;
+
+        for (int x = 0 ; x < width * STEP ; x += STEP)
+        {
+            ChunkBin&   bin = hist[Color_Bin(r[x], g[x], b[x])];
+
+            bin.count++;
+            bin.sum[RED] += r[x];
+            bin.sum[GREEN] += g[x];
+            bin.sum[BLUE] += b[x];
+        }
+    }
+}// Count_Rows
+
+// Replace the colors of rows [y0, y1) through a table of colors per bin
+template<int STEP> static void Map_Rows(const PixelView& view, int width, int y0, int y1, const PaletteColor* binColor)
+{
+    for (int y = y0 ; y < y1 ; y++)
+    {
+        unsigned char   *r = view.channel[RED] + (size_t)y * view.stride;
+        unsigned char   *g = view.channel[GREEN] + (size_t)y * view.stride;
+        unsigned char   *b = view.channel[BLUE] + (size_t)y * view.stride;
+
+        for (int x = 0 ; x < width * STEP ; x += STEP)
+        {
+            const PaletteColor& color = binColor[Color_Bin(r[x], g[x], b[x])];
+
+            r[x] = (unsigned char)color.r;
+            g[x] = (unsigned char)color.g;
+            b[x] = (unsigned char)color.b;
+        }
+    }
+}// Map_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fill bins (QUANT_BINS entries) with the histogram of the image and 
+//  list the non empty bins in occupied, in increasing order.  Bands of 
+//  HIST_CHUNK_PIXELS are counted into private histograms in parallel, and
+//  the partial histograms are summed in parallel over the bins.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Build_Histogram(const PixelView& view, int width, int height, 
+                            ColorBin* bins, vector<int>& occupied)
+{
+    int                 chunkRows = max(1, HIST_CHUNK_PIXELS / max(width, 1));
+    int                 chunks = (height + chunkRows - 1) / chunkRows;
+    int                 binTiles = 64;
+    Scratch<ChunkBin>   partial((size_t)max(chunks, 1) * QUANT_BINS);
+
+    TileScheduler::Run(chunks, [&](int chunk) {
+        ChunkBin*   hist = &partial[(size_t)chunk * QUANT_BINS];
+        int         y1 = min(height, (chunk + 1) * chunkRows);
+
+        memset(hist, 0, QUANT_BINS * sizeof(ChunkBin));
+        if (view.step == 1)
+            Count_Rows<1>(view, width, chunk * chunkRows, y1, hist);
+        else
+            Count_Rows<4>(view, width, chunk * chunkRows, y1, hist);
+    });
+
+    TileScheduler::Run(binTiles, [&](int tile) {
+        int     end = (tile + 1) * (QUANT_BINS / binTiles);
+
+        for (int i = tile * (QUANT_BINS / binTiles) ; i < end ; i++)
+        {
+            ColorBin&   bin = bins[i];
+
+            memset(&bin, 0, sizeof(bin));
+            for (int chunk = 0 ; chunk < chunks ; chunk++)
+            {
+                const ChunkBin& part = partial[(size_t)chunk * QUANT_BINS + i];
+
+                bin.count += part.count;
+                for (int c = 0 ; c < 3 ; c++)
+                    bin.sum[c] += part.sum[c];
+            }
+        }
+    });
+
+    occupied.clear();
+    for (int i = 0 ; i < QUANT_BINS ; i++)
+        if (bins[i].count)
+            occupied.push_back(i);
+}// Build_Histogram
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Index of the entry of palette nearest to the given color.  palette 
+//  is sorted on red, so the search starts at the first entry with at least
+//  the given red and walks outwards in both directions, giving up on a 
+//  direction once the red difference alone is no better than the best 
+//  match so far.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int Nearest_Color(const vector<PaletteColor>& palette, const PaletteColor& color)
+{
+    int     count = (int)palette.size();
+    int     up = 0, best = 0, bestDist = INT_MAX;
+
+    while (up < count && palette[up].r < color.r)
+        up++;
+
+    for (int down = up - 1 ; up < count || down >= 0 ; )
+    {
+        if (up < count)
+        {
+            const PaletteColor& p = palette[up];
+            int dr = p.r - color.r, dg = p.g - color.g, db = p.b - color.b;
+
+            if (dr * dr >= bestDist)
+                up = count;
+            else
+            {
+                int dist = dr * dr + dg * dg + db * db;
+                if (dist < bestDist)
+                {
+                    bestDist = dist;
+                    best = up;
+                }
+                up++;
+            }
+        }
+        if (down >= 0)
+        {
+            const PaletteColor& p = palette[down];
+            int dr = p.r - color.r, dg = p.g - color.g, db = p.b - color.b;
+
+            if (dr * dr >= bestDist)
+                down = -1;
+            else
+            {
+                int dist = dr * dr + dg * dg + db * db;
+                if (dist < bestDist)
+                {
+                    bestDist = dist;
+                    best = down;
+                }
+                down--;
+            }
+        }
+    }
+
+    return best;
+}// Nearest_Color
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Replace every pixel with the palette entry nearest to the mean color
+//  of its histogram bin.  The nearest entry is searched once per occupied
+//  bin and its color kept in a 5-5-5 inverse palette table, so the pixel 
+//  pass is a single table lookup.  Alpha is left alone.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Apply_Palette(const PixelView& view, int width, int height, const ColorBin* bins,
+                          const vector<int>& occupied, vector<PaletteColor> palette)
+{
+    Scratch<PaletteColor>   inverse(QUANT_BINS);
+    int                     binCount = (int)occupied.size();
+    int                     tiles = (binCount + 1023) / 1024;
+
+    if (palette.empty())
+        return;
+
+    sort(palette.begin(), palette.end(), 
+         [](const PaletteColor& a, const PaletteColor& b) { return a.r < b.r; });
+
+    TileScheduler::Run(tiles, [&](int tile) {
+        int     end = min(binCount, (tile + 1) * 1024);
+
+        for (int i = tile * 1024 ; i < end ; i++)
+            inverse[occupied[i]] = palette[Nearest_Color(palette, Bin_Mean(bins[occupied[i]]))];
+    });
+
+    Parallel_Rows(height, (size_t)width * 4, [&](int y0, int y1) {
+        if (view.step == 1)
+            Map_Rows<1>(view, width, y0, y1, inverse.Get());
+        else
+            Map_Rows<4>(view, width, y0, y1, inverse.Get());
+    });
+}// Apply_Palette
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert the image to an 8 bit image using populosity quantization.  
+//  Colors are first binned to 5 bits per channel; the QUANT_COLORS most 
+//  popular bins (ties to the lower bin) become the palette, each entry the
+//  mean of its bin, and every pixel is mapped to the nearest entry.  
+//  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Quant_Populosity()
+{
+    PixelView               view = View(this);
+    Scratch<ColorBin>       bins(QUANT_BINS);
+    vector<int>             occupied;
+
+    Build_Histogram(view, width, height, bins.Get(), occupied);
+
+    vector<int>             popular(occupied);
+    size_t                  colors = min(popular.size(), (size_t)QUANT_COLORS);
+    vector<PaletteColor>    palette(colors);
+
+    partial_sort(popular.begin(), popular.begin() + colors, popular.end(), 
+                 [&](int a, int b) { 
+                     return bins[a].count != bins[b].count ? bins[a].count > bins[b].count : a < b; 
+                 });
+    for (size_t i = 0 ; i < colors ; i++)
+        palette[i] = Bin_Mean(bins[popular[i]]);
+
+    Apply_Palette(view, width, height, bins.Get(), occupied, palette);
+
+    return true;
+}// Quant_Populosity
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Box of histogram bins for the median cut quantizer.  Bounds are 
+//  inclusive 5 bit bin coordinates in red, green, blue order.  error is 
+//  the squared error between the pixels' bin means and the box mean, which
+//  is what splitting the box can remove; the spread inside a bin cannot be
+//  split.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct ColorBox
+{
+    int                 lo[3];          // first bin on each axis
+    int                 hi[3];          // last bin on each axis
+    unsigned long long  count;          // pixels in the box
+    unsigned long long  sum[3];         // red, green and blue summed over those pixels
+    double              error;          // squared error a split could remove
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Shrink a box to the bins in it that hold pixels and total them up.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Measure_Box(const ColorBin* bins, ColorBox& box)
+{
+    int     lo[3] = { 31, 31, 31 }, hi[3] = { 0, 0, 0 };
+    int     at[3];
+    double  spread = 0;
+
+    box.count = 0;
+    box.sum[RED] = box.sum[GREEN] = box.sum[BLUE] = 0;
+    for (at[RED] = box.lo[RED] ; at[RED] <= box.hi[RED] ; at[RED]++)
+        for (at[GREEN] = box.lo[GREEN] ; at[GREEN] <= box.hi[GREEN] ; at[GREEN]++)
+            for (at[BLUE] = box.lo[BLUE] ; at[BLUE] <= box.hi[BLUE] ; at[BLUE]++)
+            {
+                const ColorBin& bin = bins[(at[RED] << 10) | (at[GREEN] << 5) | at[BLUE]];
+
+                if (!bin.count)
+                    continue;
+                box.count += bin.count;
+                for (int c = 0 ; c < 3 ; c++)
+                {
+                    lo[c] = min(lo[c], at[c]);
+                    hi[c] = max(hi[c], at[c]);
+                    box.sum[c] += bin.sum[c];
+                    spread += (double)bin.sum[c] * bin.sum[c] / bin.count;
+                }
+            }
+
+    box.error = 0;
+    if (!box.count)
+        return;
+    for (int c = 0 ; c < 3 ; c++)
+    {
+        box.lo[c] = lo[c];
+        box.hi[c] = hi[c];
+        spread -= (double)box.sum[c] * box.sum[c] / box.count;
+    }
+    box.error = max(spread, 0.0);
+}// Measure_Box
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Split a box in two along the plane that removes the most squared 
+//  error.  The box is projected onto each axis, and prefix sums over the 
+//  slices give the error of every cut in one pass, so no pixels are 
+//  sorted.  Returns false if no cut helps.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Split_Box(const ColorBin* bins, const ColorBox& box, ColorBox& first, ColorBox& second)
+{
+    double  total = 0, best = 0;
+    int     bestAxis = -1, bestCut = 0;
+
+    for (int c = 0 ; c < 3 ; c++)
+        total += (double)box.sum[c] * box.sum[c] / box.count;
+
+    for (int axis = 0 ; axis < 3 ; axis++)
+    {
+        unsigned long long  count[32] = { 0 };
+        unsigned long long  sum[32][3] = { { 0 } };
+        int                 at[3];
+
+        if (box.hi[axis] == box.lo[axis])
+            continue;
+
+        for (at[RED] = box.lo[RED] ; at[RED] <= box.hi[RED] ; at[RED]++)
+            for (at[GREEN] = box.lo[GREEN] ; at[GREEN] <= box.hi[GREEN] ; at[GREEN]++)
+                for (at[BLUE] = box.lo[BLUE] ; at[BLUE] <= box.hi[BLUE] ; at[BLUE]++)
+                {
+                    const ColorBin& bin = bins[(at[RED] << 10) | (at[GREEN] << 5) | at[BLUE]];
+                    int             slice = at[axis] - box.lo[axis];
+
+                    count[slice] += bin.count;
+                    for (int c = 0 ; c < 3 ; c++)
+                        sum[slice][c] += bin.sum[c];
+                }
+
+        // cut after slice k, running totals hold the left side
+        unsigned long long  leftCount = 0, leftSum[3] = { 0, 0, 0 };
+
+        for (int k = 0 ; k < box.hi[axis] - box.lo[axis] ; k++)
+        {
+            leftCount += count[k];
+            for (int c = 0 ; c < 3 ; c++)
+                leftSum[c] += sum[k][c];
+            if (!leftCount || leftCount == box.count)
+                continue;
+
+            unsigned long long  rightCount = box.count - leftCount;
+            double              gain = -total;
+
+            for (int c = 0 ; c < 3 ; c++)
+            {
+                double  right = (double)(box.sum[c] - leftSum[c]);
+                gain += (double)leftSum[c] * leftSum[c] / leftCount + right * right / rightCount;
+            }
+            if (gain > best)
+            {
+                best = gain;
+                bestAxis = axis;
+                bestCut = box.lo[axis] + k;
+            }
+        }
+    }
+
+    if (bestAxis < 0)
+        return false;
+
+    first = second = box;
+    first.hi[bestAxis] = bestCut;
+    second.lo[bestAxis] = bestCut + 1;
+    Measure_Box(bins, first);
+    Measure_Box(bins, second);
+    return true;
+}// Split_Box
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert the image to an 8 bit image using median cut quantization.  
+//  Starting from one box around the 5-5-5 histogram, the box with the most
+//  squared error is split until there are QUANT_COLORS boxes or nothing 
+//  is left to split.  The box means form the palette and every pixel is 
+//  mapped to the nearest entry, as in Quant_Populosity.  Return success of
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Quant_Median()
+{
+    PixelView               view = View(this);
+    Scratch<ColorBin>       bins(QUANT_BINS);
+    vector<int>             occupied;
+    vector<ColorBox>        boxes(1);
+
+    Build_Histogram(view, width, height, bins.Get(), occupied);
+    if (occupied.empty())
+        return true;
+
+    for (int c = 0 ; c < 3 ; c++)
+    {
+        boxes[0].lo[c] = 0;
+        boxes[0].hi[c] = 31;
+    }
+    Measure_Box(bins.Get(), boxes[0]);
+
+    while (boxes.size() < (size_t)QUANT_COLORS)
+    {
+        ColorBox    first, second;
+        size_t      worst = 0;
+
+        for (size_t i = 1 ; i < boxes.size() ; i++)
+            if (boxes[i].error > boxes[worst].error)
+                worst = i;
+        if (boxes[worst].error <= 0)
+            break;
+
+        if (!Split_Box(bins.Get(), boxes[worst], first, second))
+        {
+            boxes[worst].error = 0;
+            continue;
+        }
+        boxes[worst] = first;
+        boxes.push_back(second);
+    }
+
+    vector<PaletteColor>    palette(boxes.size());
+
+    for (size_t i = 0 ; i < boxes.size() ; i++)
+    {
+        const ColorBox&     box = boxes[i];
+
+        palette[i].r = (int)((box.sum[RED] + box.count / 2) / box.count);
+        palette[i].g = (int)((box.sum[GREEN] + box.count / 2) / box.count);
+        palette[i].b = (int)((box.sum[BLUE] + box.count / 2) / box.count);
+    }
+
+    Apply_Palette(view, width, height, bins.Get(), occupied, palette);
+
+    return true;
+}// Quant_Median
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Dither the image using a threshold of 1/2.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Threshold()
+{
+    PixelView   view = View(this);
+
+    Parallel_Rows(height, (size_t)width * 4, [&](int y0, int y1) {
+        if (view.step == 1)
+            Threshold_Rows<1>(view, width, y0, y1, false);
+        else
+            Threshold_Rows<4>(view, width, y0, y1, false);
+    });
+
+    return true;
+}// Dither_Threshold
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Dither image using random dithering.  Return success of operation.
+//  Runs serially: the noise comes from rand() in pixel order, which keeps 
+//  the output the same for a given seed.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Random()
+{
+    PixelView   view = View(this);
+
+    if (view.step == 1)
+        Threshold_Rows<1>(view, width, 0, height, true);
+    else
+        Threshold_Rows<4>(view, width, 0, height, true);
+
+    return true;
+}// Dither_Random
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Error diffusion kernels.  weight[dy][dx + 2] is the share of the 
+//  error that goes dy rows down and dx columns across; row 0 only sends
+//  error to the right.  Indexed by TargaImage::Diffusion.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct DiffusionKernel
+{
+    int     rows;               // rows below the current one that receive error
+    int     radius;             // columns either side that receive error
+    int     divisor;            // sum of the weights
+    int     weight[3][5];
+};
+
+static constexpr DiffusionKernel DIFFUSION_KERNELS[] = 
+{
+    // Floyd-Steinberg
+    { 1, 1, 16, { { 0, 0, 0, 7, 0 }, 
+                  { 0, 3, 5, 1, 0 }, 
+                  { 0, 0, 0, 0, 0 } } },
+    // Jarvis, Judice and Ninke
+    { 2, 2, 48, { { 0, 0, 0, 7, 5 }, 
+                  { 3, 5, 7, 5, 3 }, 
+                  { 1, 3, 5, 3, 1 } } },
+    // Stucki
+    { 2, 2, 42, { { 0, 0, 0, 8, 4 }, 
+                  { 2, 4, 8, 4, 2 }, 
+                  { 1, 2, 4, 2, 1 } } },
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Diffuse the error of pixels [x0, x1) of one row.  rows[dy][c] is the
+//  error owed to channel c of the row dy below, as a sum of error * weight.
+//  quant[c] maps a value in half levels to the nearest output level.  The 
+//  kernel and the channel count are template arguments so the tap loops 
+//  unroll and the divide is by a constant.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<int KERNEL, bool COLOR>
+static void Diffuse_Span(const PixelView& view, int y, int x0, int x1, int* const rows[3][3], 
+                         const unsigned char quant[3][512])
+{
+    const DiffusionKernel&  kernel = DIFFUSION_KERNELS[KERNEL];
+    const int               channels = COLOR ? 3 : 1;
+    unsigned char           *r = view.channel[RED] + (size_t)y * view.stride;
+    unsigned char           *g = view.channel[GREEN] + (size_t)y * view.stride;
+    unsigned char           *b = view.channel[BLUE] + (size_t)y * view.stride;
+
+    for (int x = x0 ; x < x1 ; x++)
+    {
+        int     at = x * view.step;
+        int     in[3];
+
+        if (COLOR)
+        {
+            in[RED] = r[at];
+            in[GREEN] = g[at];
+            in[BLUE] = b[at];
+        }
+        else
+            in[0] = (unsigned char)(float)(0.299 * r[at] + 0.587 * g[at] + 0.114 * b[at]);
+
+        for (int c = 0 ; c < channels ; c++)
+        {
+            int     value = (in[c] << DITHER_FRAC_BITS) + rows[0][c][x] / DIFFUSION_KERNELS[KERNEL].divisor;
+            int     half = max(0, min(511, value >> (DITHER_FRAC_BITS - 1)));
+            int     error;
+
+            in[c] = quant[c][half];
+            error = value - (in[c] << DITHER_FRAC_BITS);
+
+            for (int dx = 1 ; dx <= kernel.radius ; dx++)
+                rows[0][c][x + dx] += error * kernel.weight[0][dx + 2];
+            for (int dy = 1 ; dy <= kernel.rows ; dy++)
+                for (int dx = -kernel.radius ; dx <= kernel.radius ; dx++)
+                    rows[dy][c][x + dx] += error * kernel.weight[dy][dx + 2];
+        }
+
+        if (COLOR)
+        {
+            r[at] = (unsigned char)in[RED];
+            g[at] = (unsigned char)in[GREEN];
+            b[at] = (unsigned char)in[BLUE];
+        }
+        else
+            r[at] = g[at] = b[at] = (unsigned char)in[0];
+    }
+}// Diffuse_Span
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Diffuse the error of the image to the given number of evenly spaced
+//  levels per channel (0 and 255 included), either on the gray value 
+//  (color false, levels[0] used) or on red, green and blue separately.  
+//  Each pixel takes the nearest level.
+//
+//  Values are fixed point with DITHER_FRAC_BITS fraction bits.  The error 
+//  owed to a pixel is kept as the sum of error * weight, and divided by 
+//  the kernel divisor once when the pixel is reached, so all arithmetic is
+//  integer.  The owed error lives in a ring of rows: a row clears the ring
+//  slot of the row kernel.rows below it before it starts, once the row 
+//  that used that slot last is done.
+//
+//  Rows run as a skewed wavefront.  Threads claim rows in order, and a row
+//  only processes a pixel once the row above has finished the pixels 
+//  2 * radius + 1 columns further on.  By then every error the pixel is 
+//  owed has arrived, and rows never add into the same slot entry at the
+//  same time.  Integer sums do not depend on the order of the additions,
+//  so the result is the same as a serial run for any number of threads.
+//  Rows only wait on rows above them that have already been claimed, so 
+//  the wavefront cannot deadlock even if it ends up running on one thread.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Diffuse_Error(const PixelView& view, int width, int height, int kernelIndex,
+                          bool color, const int levels[3])
+{
+    const DiffusionKernel&  kernel = DIFFUSION_KERNELS[kernelIndex];
+    int                     channels = color ? 3 : 1;
+    int                     slots = kernel.rows + 1 + DITHER_IN_FLIGHT;
+    int                     rowInts = width + 2 * kernel.radius;
+    int                     lag = 2 * kernel.radius + 1;
+    Scratch<int>            owed((size_t)slots * channels * rowInts);
+    vector<atomic<int>>     progress(height);
+    atomic<int>             nextRow(0);
+    unsigned char           quant[3][512];
+
+    if (!width || !height)
+        return;
+
+    // a value of h half levels rounds up to level i once it reaches the 
+    // midpoint between levels i - 1 and i
+    for (int c = 0 ; c < channels ; c++)
+    {
+        int     last = levels[c] - 1;
+
+        for (int h = 0, i = 0 ; h < 512 ; h++)
+        {
+            while (i < last && h >= (i * 255 + last / 2) / last + ((i + 1) * 255 + last / 2) / last)
+                i++;
+            quant[c][h] = (unsigned char)((i * 255 + last / 2) / last);
+        }
+    }
+
+    // the slots of the rows no earlier row clears
+    for (int y = 0 ; y < kernel.rows ; y++)
+        memset(&owed[(size_t)y * channels * rowInts], 0, channels * rowInts * sizeof(int));
+
+    TileScheduler::Run(min(height, DITHER_IN_FLIGHT), [&](int) {
+        for (int y = nextRow++ ; y < height ; y = nextRow++)
+        {
+            int*    rows[3][3];         // owed error of this row and the ones below, per channel
+
+            if (y + kernel.rows - slots >= 0)
+                while (progress[y + kernel.rows - slots].load(memory_order_acquire) < width)
+                    this_thread::yield();
+            memset(&owed[(size_t)((y + kernel.rows) % slots) * channels * rowInts], 0, 
+                   channels * rowInts * sizeof(int));
+            for (int dy = 0 ; dy <= kernel.rows ; dy++)
+                for (int c = 0 ; c < channels ; c++)
+                    rows[dy][c] = &owed[((size_t)((y + dy) % slots) * channels + c) * rowInts + kernel.radius];
+
+            for (int x0 = 0 ; x0 < width ; x0 += DITHER_CHUNK)
+            {
+                int     x1 = min(width, x0 + DITHER_CHUNK);
+
+                if (y > 0)
+                    while (progress[y - 1].load(memory_order_acquire) < min(width, x1 - 1 + lag))
+                        this_thread::yield();
+
+                switch (kernelIndex * 2 + color)
+                {
+                    case 0: Diffuse_Span<0, false>(view, y, x0, x1, rows, quant); break;
+                    case 1: Diffuse_Span<0, true>(view, y, x0, x1, rows, quant); break;
+                    case 2: Diffuse_Span<1, false>(view, y, x0, x1, rows, quant); break;
+                    case 3: Diffuse_Span<1, true>(view, y, x0, x1, rows, quant); break;
+                    case 4: Diffuse_Span<2, false>(view, y, x0, x1, rows, quant); break;
+                    case 5: Diffuse_Span<2, true>(view, y, x0, x1, rows, quant); break;
+                }
+
+                progress[y].store(x1, memory_order_release);
+            }
+        }
+    });
+}// Diffuse_Error
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Dither the image with the given error diffusion kernel, to black and
+//  white on the gray value if color is false, otherwise to 8 levels of red
+//  and green and 4 of blue.  Alpha is left alone.  Return success of 
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Diffuse(Diffusion kernel, bool color)
+{
+    const int   grayLevels[3] = { 2, 2, 2 };
+    const int   colorLevels[3] = { 8, 8, 4 };
+
+    if (kernel < FLOYD_STEINBERG || kernel > STUCKI)
+        return false;
+
+    Diffuse_Error(View(this), width, height, kernel, color, color ? colorLevels : grayLevels);
+    return true;
+}// Dither_Diffuse
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform Floyd-Steinberg dithering on the image.  Return success of 
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_FS()
+{
+    return Dither_Diffuse(FLOYD_STEINBERG, false);
+}// Dither_FS
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Gray value of a pixel on [0, 1] as Dither_Bright has always computed
+//  it, 0.299 * r / 255 + 0.587 * g / 255 + 0.114 * b / 255 in double 
+//  rounded to float.  share holds the three products per channel value.
+//  Floats that are not negative order the same as their bit patterns, 
+//  which is what the key is for.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline unsigned int Luma_Key(const double share[3][256], int r, int g, int b)
+{
+    float           gray = (float)(share[RED][r] + share[GREEN][g] + share[BLUE][b]);
+    unsigned int    key;
+
+    memcpy(&key, &gray, sizeof(key));
+    return key;
+}// Luma_Key
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Dither the image while conserving the average brightness.  Pixels 
+//  darker than the gray value ranked (1 - average) * pixels from the 
+//  bottom go black, the rest white.  The ranked value is found exactly 
+//  without sorting: one pass histograms the high LUMA_KEY_BITS of each 
+//  pixel's gray key and sums the channels for the average, a second pass
+//  histograms the low bits of the pixels that fall in the ranked high 
+//  bin, and a third thresholds.  Passes run in parallel over at most 
+//  LUMA_MAX_CHUNKS bands with private histograms, so memory is bounded 
+//  whatever the image size.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Bright()
+{
+    PixelView               view = View(this);
+    size_t                  pixels = (size_t)width * height;
+    const int               bins = 1 << LUMA_KEY_BITS;
+    double                  share[3][256];
+
+    if (!pixels)
+        return true;
+
+    for (int v = 0 ; v < 256 ; v++)
+    {
+        share[RED][v] = 0.299 * v / 255;
+        share[GREEN][v] = 0.587 * v / 255;
+        share[BLUE][v] = 0.114 * v / 255;
+    }
+
+    int                     chunks = (int)min((pixels + HIST_CHUNK_PIXELS - 1) / HIST_CHUNK_PIXELS, 
+                                              (size_t)LUMA_MAX_CHUNKS);
+    int                     chunkRows = (height + chunks - 1) / chunks;
+    Scratch<size_t>         counts((size_t)chunks * bins);
+    Scratch<size_t>         sums((size_t)chunks * 3);
+
+    chunks = (height + chunkRows - 1) / chunkRows;
+
+    // Histogram one band of rows into its own counts.  With high < 0 the 
+    // high bits of every key are counted and the channels summed, 
+    // otherwise the low bits of the keys whose high bits are high.
+    auto histogram = [&](int chunk, int high) {
+        size_t*     count = &counts[(size_t)chunk * bins];
+        size_t      sum[3] = { 0, 0, 0 };
+        int         y1 = min(height, (chunk + 1) * chunkRows);
+
+        memset(count, 0, bins * sizeof(size_t));
+        for (int y = chunk * chunkRows ; y < y1 ; y++)
+        {
+            const unsigned char *r = view.channel[RED] + (size_t)y * view.stride;
+            const unsigned char *g = view.channel[GREEN] + (size_t)y * view.stride;
+            const unsigned char *b = view.channel[BLUE] + (size_t)y * view.stride;
+
+            for (int x = 0 ; x < width * view.step ; x += view.step)
+            {
+                unsigned int    key = Luma_Key(share, r[x], g[x], b[x]);
+
+                if (high < 0)
+                {
+                    count[key >> LUMA_KEY_BITS]++;
+                    sum[RED] += r[x];
+                    sum[GREEN] += g[x];
+                    sum[BLUE] += b[x];
+                }
+                else if ((int)(key >> LUMA_KEY_BITS) == high)
+                    count[key & (bins - 1)]++;
+            }
+        }
+        for (int c = 0 ; c < 3 ; c++)
+            sums[chunk * 3 + c] = sum[c];
+    };
+
+    // Find the bin holding the pixel of the given rank, leaving the rank 
+    // within that bin
+    auto select = [&](size_t& rank) -> int {
+        for (int bin = 0 ; bin < bins ; bin++)
+        {
+            size_t  count = 0;
+
+            for (int chunk = 0 ; chunk < chunks ; chunk++)
+                count += counts[(size_t)chunk * bins + bin];
+            if (rank < count)
+                return bin;
+            rank -= count;
+        }
+        return bins - 1;
+    };
+
+    TileScheduler::Run(chunks, [&](int chunk) { histogram(chunk, -1); });
+
+    double                  total[3] = { 0, 0, 0 };
+
+    for (int chunk = 0 ; chunk < chunks ; chunk++)
+        for (int c = 0 ; c < 3 ; c++)
+            total[c] += (double)sums[chunk * 3 + c];
+
+    double                  average = (0.299 * total[RED] / 255 + 0.587 * total[GREEN] / 255 
+                                       + 0.114 * total[BLUE] / 255) / pixels;
+    double                  position = (1 - average) * pixels;
+    size_t                  rank = position <= 0 ? 0 : min((size_t)position, pixels - 1);
+    int                     high = select(rank);
+
+    TileScheduler::Run(chunks, [&](int chunk) { histogram(chunk, high); });
+
+    unsigned int            threshold = ((unsigned int)high << LUMA_KEY_BITS) | select(rank);
+
+    Parallel_Rows(height, (size_t)width * 4, [&](int y0, int y1) {
+        for (int y = y0 ; y < y1 ; y++)
+        {
+            unsigned char   *r = view.channel[RED] + (size_t)y * view.stride;
+            unsigned char   *g = view.channel[GREEN] + (size_t)y * view.stride;
+            unsigned char   *b = view.channel[BLUE] + (size_t)y * view.stride;
+
+            for (int x = 0 ; x < width * view.step ; x += view.step)
+                r[x] = g[x] = b[x] = Luma_Key(share, r[x], g[x], b[x]) < threshold ? 0 : 255;
+        }
+    });
+
+    return true;
+}// Dither_Bright
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Ordered dither tiles.  Each pattern ranks the cells of a square tile
+//  from 0 to cells - 1, and a pixel is set white when its gray level 
+//  reaches the threshold of the rank under it.  A rank r of n gets the 
+//  threshold ceil(255 * (r + 1) / n), so black stays black, white stays 
+//  white, and a flat gray y turns floor(y * n / 255) cells of a tile white.
+//  The threshold tables are built by the compiler.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<int... I> struct Index_List {};
+template<int N, int... I> struct Make_Index_List : Make_Index_List<N - 1, N - 1, I...> {};
+template<int... I> struct Make_Index_List<0, I...> { typedef Index_List<I...> type; };
+
+static constexpr int Pattern_Threshold(int rank, int cells)
+{
+    return (255 * (rank + 1) + cells - 1) / cells;
+}// Pattern_Threshold
+
+// Rank of (x, y) in the Bayer matrix of side 2^bits.  The lowest bits of 
+// the position pick the most significant part of the rank, so neighbours
+// are as far apart in rank as they can be.
+static constexpr int Bayer_Rank(int x, int y, int bits)
+{
+    return bits == 0 ? 0 : (2 * ((x ^ y) & 1) + (y & 1)) * (1 << 2 * (bits - 1)) 
+                           + Bayer_Rank(x >> 1, y >> 1, bits - 1);
+}// Bayer_Rank
+
+// Clustered dot mask Dither_Cluster has always used, cell (x, y) at 
+// [y * 4 + x]
+static constexpr unsigned char CLUSTER_RANKS[16] = 
+{
+    11,  0,  7,  2,
+     5, 15, 12,  8,
+     9, 13, 14,  4,
+     3,  6,  1, 10,
+};
+
+// Void and cluster blue noise, cell (x, y) at [y * 16 + x]
+static constexpr unsigned char BLUE_NOISE_RANKS[256] = 
+{
+    234,  50, 188,  19,  58, 171, 121,  47, 163,   3, 247, 104,  22, 132,  14,  65,
+    209,   8, 118,  97, 240, 205,  23, 228, 138,  64, 123, 170,  72, 224,  99, 149,
+     85, 139, 229, 165,  78, 146, 111,  84, 176, 216,  30, 231, 153, 201,  42, 180,
+     25,  62, 195,  29,  43, 185,   7, 249,  41, 100, 191,  48,  87,   5, 128, 243,
+    221, 152, 101, 253, 130, 220,  59, 200, 156,  12, 136, 112, 254, 174,  69, 109,
+     46, 189,   2,  73, 172,  90, 142, 116,  80, 237, 210,  61, 147,  33, 206, 160,
+     81, 124, 217, 113, 208,  15, 241,  27, 168,  45, 178,  20, 193,  96, 225,  18,
+    242, 164,  60,  35, 157,  53, 181,  68, 223, 105, 125,  83, 236, 131,  55, 141,
+    197,  10, 227, 134, 246,  95, 126, 198, 148,   1, 244, 161,  71,   9, 182, 106,
+     40,  93, 179,  75, 192,   6, 218,  36,  91,  57, 202,  34, 215, 155, 233,  74,
+    252, 120, 150,  24, 110,  63, 166, 119, 232, 183, 133, 103,  49, 117,  31, 167,
+     16, 212,  51, 238, 207, 137, 255,  21,  76, 151,  13, 250, 190,  88, 203, 135,
+    102, 184,  82, 169,  38,  89, 187,  52, 204,  98, 173,  67, 129,   4, 222,  56,
+    230, 144,   0, 127, 226,  11, 154, 114, 239,  39, 219,  28, 235, 145, 175,  77,
+    196,  37, 248,  70, 107, 199,  66, 177,  17, 143, 115, 159,  86,  44, 108,  26,
+    122,  92, 158, 214, 140,  32, 245,  94, 213,  79, 194,  54, 211, 186, 251, 162
+};
+
+template<int BITS> struct Bayer_Pattern
+{
+    static constexpr int Size() { return 1 << BITS; }
+    static constexpr int Rank(int i) { return Bayer_Rank(i % Size(), i / Size(), BITS); }
+};
+
+struct Cluster_Pattern
+{
+    static constexpr int Size() { return 4; }
+    static constexpr int Rank(int i) { return CLUSTER_RANKS[i]; }
+};
+
+struct Blue_Noise_Pattern
+{
+    static constexpr int Size() { return 16; }
+    static constexpr int Rank(int i) { return BLUE_NOISE_RANKS[i]; }
+};
+
+template<class PATTERN, class LIST = typename Make_Index_List<PATTERN::Size() * PATTERN::Size()>::type> 
+struct Pattern_Table;
+
+template<class PATTERN, int... I> struct Pattern_Table<PATTERN, Index_List<I...>>
+{
+    static constexpr unsigned char threshold[sizeof...(I)] = 
+        { (unsigned char)Pattern_Threshold(PATTERN::Rank(I), sizeof...(I))... };
+};
+
+template<class PATTERN, int... I> 
+constexpr unsigned char Pattern_Table<PATTERN, Index_List<I...>>::threshold[sizeof...(I)];
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Gray level of a pixel on [0, 255] for the ordered dithers, 
+//  0.299 r + 0.587 g + 0.114 b in 16 bit fixed point.  Each product is 
+//  truncated on its own as the 16 bit SIMD multiply does, so every path 
+//  gives the same level.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline int Pattern_Gray(int r, int g, int b)
+{
+    return ((r * 19595 >> 8) + (g * 38470 >> 8) + (b * 7471 >> 8) + 128) >> 8;
+}// Pattern_Gray
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Threshold rows [y0, y1) against the tile.  rows holds one threshold
+//  row per tile row, repeated across the padded width, so the compare 
+//  needs no modulo.  Planar rows compare 32 or 16 gray levels per 
+//  instruction, interleaved rows work on whole pixels so alpha is kept.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<int STEP> 
+static void Pattern_Rows(const PixelView& view, int width, int y0, int y1, 
+                         const unsigned char* rows, size_t rowBytes, int size)
+{
+    for (int y = y0 ; y < y1 ; y++)
+    {
+        const unsigned char *threshold = rows + (y % size) * rowBytes;
+        unsigned char       *r = view.channel[RED] + (size_t)y * view.stride;
+        unsigned char       *g = view.channel[GREEN] + (size_t)y * view.stride;
+        unsigned char       *b = view.channel[BLUE] + (size_t)y * view.stride;
+        int                 x = 0;
+
+        if (STEP == 1)
+        {
+#if defined(TARGA_AVX2)
+            const __m256i   zero = _mm256_setzero_si256();
+            const __m256i   round = _mm256_set1_epi16(128);
+            const __m256i   wr = _mm256_set1_epi16((short)19595);
+            const __m256i   wg = _mm256_set1_epi16((short)38470);
+            const __m256i   wb = _mm256_set1_epi16((short)7471);
+
+            for ( ; x + 32 <= width ; x += 32)
+            {
+                __m256i rv = _mm256_loadu_si256((const __m256i*)(r + x));
+                __m256i gv = _mm256_loadu_si256((const __m256i*)(g + x));
+                __m256i bv = _mm256_loadu_si256((const __m256i*)(b + x));
+                __m256i lo = _mm256_add_epi16(_mm256_add_epi16(
+                                 _mm256_mulhi_epu16(_mm256_unpacklo_epi8(zero, rv), wr), 
+                                 _mm256_mulhi_epu16(_mm256_unpacklo_epi8(zero, gv), wg)), 
+                                 _mm256_add_epi16(_mm256_mulhi_epu16(_mm256_unpacklo_epi8(zero, bv), wb), round));
+                __m256i hi = _mm256_add_epi16(_mm256_add_epi16(
+                                 _mm256_mulhi_epu16(_mm256_unpackhi_epi8(zero, rv), wr), 
+                                 _mm256_mulhi_epu16(_mm256_unpackhi_epi8(zero, gv), wg)), 
+                                 _mm256_add_epi16(_mm256_mulhi_epu16(_mm256_unpackhi_epi8(zero, bv), wb), round));
+                __m256i gray = _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8));
+                __m256i t = _mm256_loadu_si256((const __m256i*)(threshold + x));
+                __m256i white = _mm256_cmpeq_epi8(_mm256_max_epu8(gray, t), gray);
+
+                _mm256_storeu_si256((__m256i*)(r + x), white);
+                _mm256_storeu_si256((__m256i*)(g + x), white);
+                _mm256_storeu_si256((__m256i*)(b + x), white);
+            }
+#elif defined(TARGA_SSE41)
+            const __m128i   zero = _mm_setzero_si128();
+            const __m128i   round = _mm_set1_epi16(128);
+            const __m128i   wr = _mm_set1_epi16((short)19595);
+            const __m128i   wg = _mm_set1_epi16((short)38470);
+            const __m128i   wb = _mm_set1_epi16((short)7471);
+
+            for ( ; x + 16 <= width ; x += 16)
+            {
+                __m128i rv = _mm_loadu_si128((const __m128i*)(r + x));
+                __m128i gv = _mm_loadu_si128((const __m128i*)(g + x));
+                __m128i bv = _mm_loadu_si128((const __m128i*)(b + x));
+                __m128i lo = _mm_add_epi16(_mm_add_epi16(
+                                 _mm_mulhi_epu16(_mm_unpacklo_epi8(zero, rv), wr), 
+                                 _mm_mulhi_epu16(_mm_unpacklo_epi8(zero, gv), wg)), 
+                                 _mm_add_epi16(_mm_mulhi_epu16(_mm_unpacklo_epi8(zero, bv), wb), round));
+                __m128i hi = _mm_add_epi16(_mm_add_epi16(
+                                 _mm_mulhi_epu16(_mm_unpackhi_epi8(zero, rv), wr), 
+                                 _mm_mulhi_epu16(_mm_unpackhi_epi8(zero, gv), wg)), 
+                                 _mm_add_epi16(_mm_mulhi_epu16(_mm_unpackhi_epi8(zero, bv), wb), round));
+                __m128i gray = _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+                __m128i t = _mm_loadu_si128((const __m128i*)(threshold + x));
+                __m128i white = _mm_cmpeq_epi8(_mm_max_epu8(gray, t), gray);
+
+                _mm_storeu_si128((__m128i*)(r + x), white);
+                _mm_storeu_si128((__m128i*)(g + x), white);
+                _mm_storeu_si128((__m128i*)(b + x), white);
+            }
+#endif
+        }
+        else
+        {
+#if defined(TARGA_AVX2)
+            const __m256i   low = _mm256_set1_epi32(0xFF);
+            const __m256i   alpha = _mm256_set1_epi32((int)0xFF000000);
+            const __m256i   color = _mm256_set1_epi32(0x00FFFFFF);
+            const __m256i   round = _mm256_set1_epi32(128);
+
+            for ( ; x + 8 <= width ; x += 8)
+            {
+                __m256i px = _mm256_loadu_si256((const __m256i*)(r + x * 4));
+                __m256i tr = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_and_si256(px, low), 
+                                                                  _mm256_set1_epi32(19595)), 8);
+                __m256i tg = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(px, 8), low), 
+                                                                  _mm256_set1_epi32(38470)), 8);
+                __m256i tb = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(px, 16), low), 
+                                                                  _mm256_set1_epi32(7471)), 8);
+                __m256i gray = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(tr, tg), 
+                                                                  _mm256_add_epi32(tb, round)), 8);
+                __m256i t = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(threshold + x)));
+                __m256i black = _mm256_cmpgt_epi32(t, gray);
+
+                px = _mm256_or_si256(_mm256_and_si256(px, alpha), _mm256_andnot_si256(black, color));
+                _mm256_storeu_si256((__m256i*)(r + x * 4), px);
+            }
+#elif defined(TARGA_SSE41)
+            const __m128i   low = _mm_set1_epi32(0xFF);
+            const __m128i   alpha = _mm_set1_epi32((int)0xFF000000);
+            const __m128i   color = _mm_set1_epi32(0x00FFFFFF);
+            const __m128i   round = _mm_set1_epi32(128);
+
+            for ( ; x + 4 <= width ; x += 4)
+            {
+                __m128i px = _mm_loadu_si128((const __m128i*)(r + x * 4));
+                __m128i tr = _mm_srli_epi32(_mm_mullo_epi32(_mm_and_si128(px, low), _mm_set1_epi32(19595)), 8);
+                __m128i tg = _mm_srli_epi32(_mm_mullo_epi32(_mm_and_si128(_mm_srli_epi32(px, 8), low), 
+                                                            _mm_set1_epi32(38470)), 8);
+                __m128i tb = _mm_srli_epi32(_mm_mullo_epi32(_mm_and_si128(_mm_srli_epi32(px, 16), low), 
+                                                            _mm_set1_epi32(7471)), 8);
+                __m128i gray = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(tr, tg), _mm_add_epi32(tb, round)), 8);
+                int     quad;
+
+                memcpy(&quad, threshold + x, 4);
+
+                __m128i black = _mm_cmpgt_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(quad)), gray);
+
+                px = _mm_or_si128(_mm_and_si128(px, alpha), _mm_andnot_si128(black, color));
+                _mm_storeu_si128((__m128i*)(r + x * 4), px);
+            }
+#endif
+        }
+
+        for ( ; x < width ; x++)
+        {
+            int     at = x * STEP;
+
+            r[at] = g[at] = b[at] = Pattern_Gray(r[at], g[at], b[at]) >= threshold[x] ? 255 : 0;
+        }
+    }
+}// Pattern_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Dither the image in one pass against a tile of the given size.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Ordered_Dither(const PixelView& view, int width, int height, const unsigned char* tile, int size)
+{
+    size_t                  rowBytes = ((size_t)width + 31) & ~(size_t)31;
+    Scratch<unsigned char>  rows(rowBytes * size);
+
+    for (int ty = 0 ; ty < size ; ty++)
+        for (size_t x = 0 ; x < rowBytes ; x++)
+            rows[ty * rowBytes + x] = tile[ty * size + x % size];
+
+    Parallel_Rows(height, (size_t)width * 4, [&](int y0, int y1) {
+        if (view.step == 1)
+            Pattern_Rows<1>(view, width, y0, y1, rows.Get(), rowBytes, size);
+        else
+            Pattern_Rows<4>(view, width, y0, y1, rows.Get(), rowBytes, size);
+    });
+}// Ordered_Dither
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Ordered dither of the image to black and white with the given 
+//  pattern.  Alpha is left unchanged.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Pattern(DitherPattern pattern)
+{
+    PixelView   view = View(this);
+
+    switch (pattern)
+    {
+        case BAYER_2:
+            Ordered_Dither(view, width, height, Pattern_Table<Bayer_Pattern<1>>::threshold, 2);
+            break;
+        case BAYER_4:
+            Ordered_Dither(view, width, height, Pattern_Table<Bayer_Pattern<2>>::threshold, 4);
+            break;
+        case BAYER_8:
+            Ordered_Dither(view, width, height, Pattern_Table<Bayer_Pattern<3>>::threshold, 8);
+            break;
+        case BAYER_16:
+            Ordered_Dither(view, width, height, Pattern_Table<Bayer_Pattern<4>>::threshold, 16);
+            break;
+        case CLUSTERED_DOT:
+            Ordered_Dither(view, width, height, Pattern_Table<Cluster_Pattern>::threshold, 4);
+            break;
+        case BLUE_NOISE:
+            Ordered_Dither(view, width, height, Pattern_Table<Blue_Noise_Pattern>::threshold, 16);
+            break;
+        default:
+            return false;
+    }
+
+    return true;
+}// Dither_Pattern
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform clustered differing of the image.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Cluster()
+{
+    return Dither_Pattern(CLUSTERED_DOT);
+}// Dither_Cluster
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//  Convert the image to an 8 bit image using Floyd-Steinberg dithering over
+//  a uniform quantization - the same 8 by 8 by 4 levels as in Quant_Uniform,
+//  spread to cover 0 to 255 so the error stays bounded.  Return success of 
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Color()
+{
+    return Dither_Diffuse(FLOYD_STEINBERG, true);
+}// Dither_Color
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Porter-Duff operators on premultiplied pixels.  Every operator is 
+//  result = A * Fa + B * Fb, A being this image and B the given one, with
+//  each factor 0, 1, an alpha or one minus an alpha.  On bytes the factors
+//  are (alpha & mask) ^ flip, so one branch free kernel runs all of them.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct CompositeOp
+{
+    unsigned char   maskA, flipA;   // Fa from the alpha of B
+    unsigned char   maskB, flipB;   // Fb from the alpha of A
+};
+
+static constexpr CompositeOp COMP_OVER  = { 0x00, 0xFF, 0xFF, 0xFF };   // A + B (1 - a)
+static constexpr CompositeOp COMP_IN    = { 0xFF, 0x00, 0x00, 0x00 };   // A b
+static constexpr CompositeOp COMP_OUT   = { 0xFF, 0xFF, 0x00, 0x00 };   // A (1 - b)
+static constexpr CompositeOp COMP_ATOP  = { 0xFF, 0x00, 0xFF, 0xFF };   // A b + B (1 - a)
+static constexpr CompositeOp COMP_XOR   = { 0xFF, 0xFF, 0xFF, 0xFF };   // A (1 - b) + B (1 - a)
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      One composited sample, (a fa + b fb) / 255 rounded.  The sum is 
+//  clamped to 255 * 255 so samples that are not properly premultiplied 
+//  saturate instead of wrapping, and the divide is (t + 128) * 257 >> 16,
+//  exact over that range.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline unsigned char Comp_Sample(int a, int b, int fa, int fb)
+{
+    int     t = min(a * fa + b * fb, 255 * 255);
+
+    return (unsigned char)((t + 128) * 257 >> 16);
+}// Comp_Sample
+
+#if defined(TARGA_AVX2)
+static inline __m256i Comp_Words(__m256i a, __m256i b, __m256i fa, __m256i fb)
+{
+    __m256i t = _mm256_adds_epu16(_mm256_mullo_epi16(a, fa), _mm256_mullo_epi16(b, fb));
+
+    t = _mm256_add_epi16(_mm256_min_epu16(t, _mm256_set1_epi16((short)(255 * 255))), _mm256_set1_epi16(128));
+    return _mm256_mulhi_epu16(t, _mm256_set1_epi16(257));
+}// Comp_Words
+
+static inline __m256i Comp_Bytes(__m256i a, __m256i b, __m256i fa, __m256i fb)
+{
+    const __m256i   zero = _mm256_setzero_si256();
+    __m256i         lo = Comp_Words(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero), 
+                                    _mm256_unpacklo_epi8(fa, zero), _mm256_unpacklo_epi8(fb, zero));
+    __m256i         hi = Comp_Words(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero), 
+                                    _mm256_unpackhi_epi8(fa, zero), _mm256_unpackhi_epi8(fb, zero));
+
+    return _mm256_packus_epi16(lo, hi);
+}// Comp_Bytes
+#elif defined(TARGA_SSE41)
+static inline __m128i Comp_Words(__m128i a, __m128i b, __m128i fa, __m128i fb)
+{
+    __m128i t = _mm_adds_epu16(_mm_mullo_epi16(a, fa), _mm_mullo_epi16(b, fb));
+
+    t = _mm_add_epi16(_mm_min_epu16(t, _mm_set1_epi16((short)(255 * 255))), _mm_set1_epi16(128));
+    return _mm_mulhi_epu16(t, _mm_set1_epi16(257));
+}// Comp_Words
+
+static inline __m128i Comp_Bytes(__m128i a, __m128i b, __m128i fa, __m128i fb)
+{
+    const __m128i   zero = _mm_setzero_si128();
+    __m128i         lo = Comp_Words(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), 
+                                    _mm_unpacklo_epi8(fa, zero), _mm_unpacklo_epi8(fb, zero));
+    __m128i         hi = Comp_Words(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), 
+                                    _mm_unpackhi_epi8(fa, zero), _mm_unpackhi_epi8(fb, zero));
+
+    return _mm_packus_epi16(lo, hi);
+}// Comp_Bytes
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Composite count samples of B into A.  Interleaved, the factors come
+//  from the alpha byte of each pixel, spread over its four samples; 
+//  planar, alphaA and alphaB are the alpha planes, and the alpha plane 
+//  itself must be done last since its old values feed Fb.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<bool INTERLEAVED>
+static void Comp_Span(unsigned char* a, const unsigned char* b, const unsigned char* alphaA, 
+                      const unsigned char* alphaB, size_t count, CompositeOp op)
+{
+    size_t  i = 0;
+
+#if defined(TARGA_AVX2)
+    const __m256i   spread = _mm256_setr_epi8(3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15,
+                                              3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15);
+    const __m256i   maskA = _mm256_set1_epi8((char)op.maskA), flipA = _mm256_set1_epi8((char)op.flipA);
+    const __m256i   maskB = _mm256_set1_epi8((char)op.maskB), flipB = _mm256_set1_epi8((char)op.flipB);
+
+    for ( ; i + 32 <= count ; i += 32)
+    {
+        __m256i av = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i bv = _mm256_loadu_si256((const __m256i*)(b + i));
+        __m256i aa = INTERLEAVED ? _mm256_shuffle_epi8(av, spread) : _mm256_loadu_si256((const __m256i*)(alphaA + i));
+        __m256i ab = INTERLEAVED ? _mm256_shuffle_epi8(bv, spread) : _mm256_loadu_si256((const __m256i*)(alphaB + i));
+        __m256i fa = _mm256_xor_si256(_mm256_and_si256(ab, maskA), flipA);
+        __m256i fb = _mm256_xor_si256(_mm256_and_si256(aa, maskB), flipB);
+
+        _mm256_storeu_si256((__m256i*)(a + i), Comp_Bytes(av, bv, fa, fb));
+    }
+#elif defined(TARGA_SSE41)
+    const __m128i   spread = _mm_setr_epi8(3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15);
+    const __m128i   maskA = _mm_set1_epi8((char)op.maskA), flipA = _mm_set1_epi8((char)op.flipA);
+    const __m128i   maskB = _mm_set1_epi8((char)op.maskB), flipB = _mm_set1_epi8((char)op.flipB);
+
+    for ( ; i + 16 <= count ; i += 16)
+    {
+        __m128i av = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i bv = _mm_loadu_si128((const __m128i*)(b + i));
+        __m128i aa = INTERLEAVED ? _mm_shuffle_epi8(av, spread) : _mm_loadu_si128((const __m128i*)(alphaA + i));
+        __m128i ab = INTERLEAVED ? _mm_shuffle_epi8(bv, spread) : _mm_loadu_si128((const __m128i*)(alphaB + i));
+        __m128i fa = _mm_xor_si128(_mm_and_si128(ab, maskA), flipA);
+        __m128i fb = _mm_xor_si128(_mm_and_si128(aa, maskB), flipB);
+
+        _mm_storeu_si128((__m128i*)(a + i), Comp_Bytes(av, bv, fa, fb));
+    }
+#endif
+
+    if (INTERLEAVED)
+    {
+        for ( ; i < count ; i += 4)
+        {
+            int     fa = (b[i + 3] & op.maskA) ^ op.flipA;
+            int     fb = (a[i + 3] & op.maskB) ^ op.flipB;
+
+            for (int c = 0 ; c < 4 ; c++)
+                a[i + c] = Comp_Sample(a[i + c], b[i + c], fa, fb);
+        }
+    }
+    else
+    {
+        for ( ; i < count ; i++)
+            a[i] = Comp_Sample(a[i], b[i], (alphaB[i] & op.maskA) ^ op.flipA, (alphaA[i] & op.maskB) ^ op.flipB);
+    }
+}// Comp_Span
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Composite other into image with the given operator, in place over 
+//  row bands.  Two planar images are done plane by plane; otherwise both
+//  are worked on interleaved.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Composite(TargaImage* image, TargaImage* other, CompositeOp op, const char* name)
+{
+    if (!other)
+        return false;
+
+    if (image->width != other->width || image->height != other->height)
+    {
+        cout << name << ": Images not the same size\n";
+        return false;
+    }
+
+    int                 width = image->width, height = image->height;
+    bool                planar = image->Is_Planar() && other->Is_Planar();
+    InterleavedScope    scope(planar ? NULL : image), source(planar ? NULL : other, true);
+
+    Parallel_Rows(height, (size_t)width * 8, [&](int y0, int y1) {
+        for (int y = y0 ; y < y1 ; y++)
+        {
+            if (planar)
+            {
+                size_t          row = (size_t)y * image->stride;
+                size_t          otherRow = (size_t)y * other->stride;
+
+                for (int c = 0 ; c < 4 ; c++)
+                    Comp_Span<false>(image->planes[c] + row, other->planes[c] + otherRow, 
+                                     image->planes[3] + row, other->planes[3] + otherRow, width, op);
+            }
+            else
+            {
+                size_t  row = (size_t)y * width * 4;
+
+                Comp_Span<true>(image->data + row, other->data + row, NULL, NULL, (size_t)width * 4, op);
+            }
+        }
+    });
+
+    return true;
+}// Composite
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Composite the current image over the given image.  Return success of 
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Comp_Over(TargaImage* pImage)
+{
+    return Composite(this, pImage, COMP_OVER, "Comp_Over");
+}// Comp_Over
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Composite this image "in" the given image.  See lecture notes for 
+//  details.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Comp_In(TargaImage* pImage)
+{
+    return Composite(this, pImage, COMP_IN, "Comp_In");
+}// Comp_In
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Composite this image "out" the given image.  See lecture notes for 
+//  details.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Comp_Out(TargaImage* pImage)
+{
+    return Composite(this, pImage, COMP_OUT, "Comp_Out");
+}// Comp_Out
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Composite current image "atop" given image.  Return success of 
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Comp_Atop(TargaImage* pImage)
+{
+    return Composite(this, pImage, COMP_ATOP, "Comp_Atop");
+}// Comp_Atop
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Composite this image with given image using exclusive or (XOR).  Return
+//  success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Comp_Xor(TargaImage* pImage)
+{
+    return Composite(this, pImage, COMP_XOR, "Comp_Xor");
+}// Comp_Xor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build an empty composite stack.
+//
+///////////////////////////////////////////////////////////////////////////////
+CompositeStack::CompositeStack()
+    : m_width(0), m_height(0), m_tilesX(0), m_tilesY(0)
+{
+}// CompositeStack
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Add a layer above the ones already on the stack.  All layers must be
+//  the same size.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CompositeStack::Add_Layer(TargaImage* pLayer)
+{
+    if (!pLayer)
+        return false;
+
+    if (m_layers.empty())
+    {
+        m_width = pLayer->width;
+        m_height = pLayer->height;
+        m_tilesX = (m_width + STACK_TILE_X - 1) / STACK_TILE_X;
+        m_tilesY = (m_height + STACK_TILE_Y - 1) / STACK_TILE_Y;
+    }
+    else if (pLayer->width != m_width || pLayer->height != m_height)
+    {
+        cout << "Add_Layer: Layer not the same size as the stack\n";
+        return false;
+    }
+
+    m_layers.push_back(pLayer);
+    m_summaries.resize(m_layers.size() * m_tilesX * m_tilesY);
+    Summarize((int)m_layers.size() - 1);
+    return true;
+}// Add_Layer
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Retake the tile summaries, for when layers have been drawn on since
+//  they were added.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CompositeStack::Refresh()
+{
+    for (int i = 0 ; i < (int)m_layers.size() ; i++)
+        Summarize(i);
+}// Refresh
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Remove all layers.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CompositeStack::Clear()
+{
+    m_layers.clear();
+    m_summaries.clear();
+    m_width = m_height = m_tilesX = m_tilesY = 0;
+}// Clear
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Record the smallest alpha and the largest sample of each tile of a 
+//  layer.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CompositeStack::Summarize(int index)
+{
+    PixelView       view = View(m_layers[index]);
+    TileSummary*    summary = &m_summaries[(size_t)index * m_tilesX * m_tilesY];
+
+    TileScheduler::Run(m_tilesX * m_tilesY, [&](int tile) {
+        int     x0 = tile % m_tilesX * STACK_TILE_X, x1 = min(m_width, x0 + STACK_TILE_X);
+        int     y0 = tile / m_tilesX * STACK_TILE_Y, y1 = min(m_height, y0 + STACK_TILE_Y);
+        int     minAlpha = 255, maxSample = 0;
+
+        for (int y = y0 ; y < y1 ; y++)
+        {
+            for (int c = 0 ; c < 4 ; c++)
+            {
+                const unsigned char *row = view.channel[c] + (size_t)y * view.stride;
+
+                for (int x = x0 * view.step ; x < x1 * view.step ; x += view.step)
+                {
+                    maxSample = max(maxSample, (int)row[x]);
+                    if (c == 3)
+                        minAlpha = min(minAlpha, (int)row[x]);
+                }
+            }
+        }
+        summary[tile].minAlpha = (unsigned char)minAlpha;
+        summary[tile].maxSample = (unsigned char)maxSample;
+    });
+}// Summarize
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Put count pixels of a layer behind a row of a composite stack tile.
+//  The tile is laid out like the image it resolves into: interleaved rows,
+//  or with plane set, four planes that far apart.  Putting B behind A is
+//  A over B, so this is the Comp_Over kernel with the tile as A.  A layer 
+//  in the other layout is repacked through temp, which holds a row.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Stack_Behind(unsigned char* tile, int plane, const PixelView& view, size_t offset, 
+                         int count, unsigned char* temp)
+{
+    if (!plane)
+    {
+        const unsigned char *src = view.channel[0] + offset;
+
+        if (view.step != 4)
+        {
+            for (int x = 0 ; x < count ; x++)
+                for (int c = 0 ; c < 4 ; c++)
+                    temp[x * 4 + c] = view.channel[c][offset + x];
+            src = temp;
+        }
+        Comp_Span<true>(tile, src, NULL, NULL, (size_t)count * 4, COMP_OVER);
+    }
+    else
+    {
+        const unsigned char *src[4];
+
+        for (int c = 0 ; c < 4 ; c++)
+            src[c] = view.channel[c] + offset;
+        if (view.step != 1)
+        {
+            for (int c = 0 ; c < 4 ; c++)
+            {
+                for (int x = 0 ; x < count ; x++)
+                    temp[c * STACK_TILE_X + x] = src[c][x * view.step];
+                src[c] = temp + c * STACK_TILE_X;
+            }
+        }
+        for (int c = 0 ; c < 4 ; c++)
+            Comp_Span<false>(tile + c * plane, src[c], tile + 3 * plane, src[3], count, COMP_OVER);
+    }
+}// Stack_Behind
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Composite the layers over the image, top layer in front.  The 
+//  result equals putting each layer from the bottom up over the image with
+//  Comp_Over within rounding, at most N levels for N layers, since the 
+//  rounding happens in a different order.  Each tile is resolved front 
+//  to back into a premultiplied tile buffer, each layer going behind what
+//  is there so far.  A tile stops at the first layer that is opaque across
+//  it, or once the buffer is, and layers that are clear across a tile are
+//  not read there.  The image is read last, and only for tiles that still
+//  show through.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CompositeStack::Resolve(TargaImage* pImage)
+{
+    if (!pImage)
+        return false;
+
+    if (m_layers.empty())
+        return true;
+
+    if (pImage->width != m_width || pImage->height != m_height)
+    {
+        cout << "Resolve: Image not the same size as the stack\n";
+        return false;
+    }
+
+    const int           tiles = m_tilesX * m_tilesY;
+    const int           pixels = STACK_TILE_X * STACK_TILE_Y;
+    vector<PixelView>   views(m_layers.size());
+    PixelView           target = View(pImage);
+    int                 plane = target.step == 1 ? pixels : 0;
+
+    for (size_t i = 0 ; i < m_layers.size() ; i++)
+        views[i] = View(m_layers[i]);
+
+    TileScheduler::Run(tiles, [&](int tile) {
+        int                     x0 = tile % m_tilesX * STACK_TILE_X, x1 = min(m_width, x0 + STACK_TILE_X);
+        int                     y0 = tile / m_tilesX * STACK_TILE_Y, y1 = min(m_height, y0 + STACK_TILE_Y);
+        int                     tileWidth = x1 - x0;
+        int                     rowBytes = plane ? STACK_TILE_X : STACK_TILE_X * 4;
+        Scratch<unsigned char>  color(4 * pixels);
+        Scratch<unsigned char>  temp(4 * STACK_TILE_X);
+        bool                    open = true;
+
+        memset(color.Get(), 0, 4 * pixels);
+
+        // Put a layer, or finally the image, behind the tile
+        auto behind = [&](const PixelView& view) {
+            for (int y = y0 ; y < y1 ; y++)
+                Stack_Behind(&color[(y - y0) * rowBytes], plane, view, 
+                             (size_t)y * view.stride + (size_t)x0 * view.step, tileWidth, temp.Get());
+        };
+
+        // Whether the tile is opaque everywhere
+        auto opaque = [&]() -> bool {
+            const unsigned char *alpha = plane ? &color[3 * plane] : &color[3];
+            int                 step = plane ? 1 : 4;
+
+            for (int y = 0 ; y < y1 - y0 ; y++)
+                for (int x = 0 ; x < tileWidth * step ; x += step)
+                    if (alpha[y * rowBytes + x] != 255)
+                        return false;
+            return true;
+        };
+
+        for (int i = (int)m_layers.size() - 1 ; i >= 0 && open ; i--)
+        {
+            const TileSummary&  summary = m_summaries[(size_t)i * tiles + tile];
+
+            if (summary.maxSample == 0)
+                continue;
+            behind(views[i]);
+            open = summary.minAlpha != 255 && !opaque();
+        }
+        if (open)
+            behind(target);
+
+        for (int y = y0 ; y < y1 ; y++)
+        {
+            size_t  row = (size_t)y * target.stride + (size_t)x0 * target.step;
+
+            if (plane)
+            {
+                for (int c = 0 ; c < 4 ; c++)
+                    memcpy(target.channel[c] + row, &color[c * plane + (y - y0) * rowBytes], tileWidth);
+            }
+            else
+                memcpy(target.channel[0] + row, &color[(y - y0) * rowBytes], (size_t)tileWidth * 4);
+        }
+    });
+
+    return true;
+}// Resolve
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Un-premultiply count pixels of row y starting at x0 into one row per 
+//  channel.  The SIMD paths do the same float divide and multiply as 
+//  Unpremultiply; where alpha is 0 the product is not a number or 
+//  infinite, converts to INT_MIN and packs to 0, so there is no branch.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Unpremultiply_Row(const PixelView& view, int y, int x0, int count, unsigned char* const rgb[3])
+{
+    size_t  row = (size_t)y * view.stride + (size_t)x0 * view.step;
+    int     x = 0;
+
+#if defined(TARGA_AVX2)
+    const __m256i   low = _mm256_set1_epi32(0xFF);
+    const __m256    full = _mm256_set1_ps(255.0f);
+
+    for ( ; x + 8 <= count ; x += 8)
+    {
+        __m256i ch[4];
+
+        if (view.step == 4)
+        {
+            __m256i px = _mm256_loadu_si256((const __m256i*)(view.channel[0] + row + x * 4));
+
+            for (int c = 0 ; c < 3 ; c++)
+                ch[c] = _mm256_and_si256(_mm256_srli_epi32(px, 8 * c), low);
+            ch[3] = _mm256_srli_epi32(px, 24);
+        }
+        else
+        {
+            for (int c = 0 ; c < 4 ; c++)
+                ch[c] = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(view.channel[c] + row + x)));
+        }
+
+        __m256  scale = _mm256_div_ps(full, _mm256_cvtepi32_ps(ch[3]));
+
+        for (int c = 0 ; c < 3 ; c++)
+        {
+            __m256i val = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(ch[c]), scale));
+            __m128i words;
+
+            val = _mm256_min_epi32(val, low);
+            words = _mm_packus_epi32(_mm256_castsi256_si128(val), _mm256_extracti128_si256(val, 1));
+            _mm_storel_epi64((__m128i*)(rgb[c] + x), _mm_packus_epi16(words, words));
+        }
+    }
+#elif defined(TARGA_SSE41)
+    const __m128i   low = _mm_set1_epi32(0xFF);
+    const __m128    full = _mm_set1_ps(255.0f);
+
+    for ( ; x + 4 <= count ; x += 4)
+    {
+        __m128i ch[4];
+
+        if (view.step == 4)
+        {
+            __m128i px = _mm_loadu_si128((const __m128i*)(view.channel[0] + row + x * 4));
+
+            for (int c = 0 ; c < 3 ; c++)
+                ch[c] = _mm_and_si128(_mm_srli_epi32(px, 8 * c), low);
+            ch[3] = _mm_srli_epi32(px, 24);
+        }
+        else
+        {
+            for (int c = 0 ; c < 4 ; c++)
+            {
+                int     quad;
+
+                memcpy(&quad, view.channel[c] + row + x, 4);
+                ch[c] = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(quad));
+            }
+        }
+
+        __m128  scale = _mm_div_ps(full, _mm_cvtepi32_ps(ch[3]));
+
+        for (int c = 0 ; c < 3 ; c++)
+        {
+            __m128i val = _mm_min_epi32(_mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(ch[c]), scale)), low);
+            __m128i words = _mm_packus_epi32(val, val);
+            int     quad = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+
+            memcpy(rgb[c] + x, &quad, 4);
+        }
+    }
+#endif
+
+    for ( ; x < count ; x++)
+    {
+        size_t  at = row + (size_t)x * view.step;
+
+        for (int c = 0 ; c < 3 ; c++)
+            rgb[c][x] = Unpremultiply(view.channel[c][at], view.channel[3][at]);
+    }
+}// Unpremultiply_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Difference one cell wide span of un-premultiplied rows, at most 
+//  DIFF_CELL samples.  The differences go to diff, the sum of their 
+//  squares to sumSq and the largest to maxError.  Return a mask with a 
+//  bit set for each pixel that differs by more than the tolerance.
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long Diff_Span(unsigned char* const a[3], unsigned char* const b[3], unsigned char* const diff[3],
+                                    int x0, int count, int tolerance, unsigned long long& sumSq, int& maxError)
+{
+    unsigned long long  mask = 0;
+    int                 x = 0;
+
+#if defined(TARGA_AVX2)
+    const __m256i   zero = _mm256_setzero_si256();
+    const __m256i   limit = _mm256_set1_epi8((char)min(tolerance + 1, 255));
+    __m256i         squares = _mm256_setzero_si256();
+    __m256i         largest = _mm256_setzero_si256();
+
+    for ( ; x + 32 <= count ; x += 32)
+    {
+        __m256i most = zero;
+
+        for (int c = 0 ; c < 3 ; c++)
+        {
+            __m256i av = _mm256_loadu_si256((const __m256i*)(a[c] + x0 + x));
+            __m256i bv = _mm256_loadu_si256((const __m256i*)(b[c] + x0 + x));
+            __m256i d = _mm256_or_si256(_mm256_subs_epu8(av, bv), _mm256_subs_epu8(bv, av));
+            __m256i lo = _mm256_unpacklo_epi8(d, zero), hi = _mm256_unpackhi_epi8(d, zero);
+
+            _mm256_storeu_si256((__m256i*)(diff[c] + x0 + x), d);
+            squares = _mm256_add_epi32(squares, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+            most = _mm256_max_epu8(most, d);
+        }
+        largest = _mm256_max_epu8(largest, most);
+        if (tolerance < 255)
+            mask |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(
+                        _mm256_cmpeq_epi8(_mm256_max_epu8(most, limit), most)) << x;
+    }
+
+    int     lanes[8];
+    unsigned char   bytes[32];
+
+    _mm256_storeu_si256((__m256i*)lanes, squares);
+    _mm256_storeu_si256((__m256i*)bytes, largest);
+    for (int i = 0 ; i < 8 ; i++)
+        sumSq += (unsigned int)lanes[i];
+    for (int i = 0 ; i < 32 ; i++)
+        maxError = max(maxError, (int)bytes[i]);
+#elif defined(TARGA_SSE41)
+    const __m128i   zero = _mm_setzero_si128();
+    const __m128i   limit = _mm_set1_epi8((char)min(tolerance + 1, 255));
+    __m128i         squares = _mm_setzero_si128();
+    __m128i         largest = _mm_setzero_si128();
+
+    for ( ; x + 16 <= count ; x += 16)
+    {
+        __m128i most = zero;
+
+        for (int c = 0 ; c < 3 ; c++)
+        {
+            __m128i av = _mm_loadu_si128((const __m128i*)(a[c] + x0 + x));
+            __m128i bv = _mm_loadu_si128((const __m128i*)(b[c] + x0 + x));
+            __m128i d = _mm_or_si128(_mm_subs_epu8(av, bv), _mm_subs_epu8(bv, av));
+            __m128i lo = _mm_unpacklo_epi8(d, zero), hi = _mm_unpackhi_epi8(d, zero);
+
+            _mm_storeu_si128((__m128i*)(diff[c] + x0 + x), d);
+            squares = _mm_add_epi32(squares, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+            most = _mm_max_epu8(most, d);
+        }
+        largest = _mm_max_epu8(largest, most);
+        if (tolerance < 255)
+            mask |= (unsigned long long)(unsigned int)_mm_movemask_epi8(
+                        _mm_cmpeq_epi8(_mm_max_epu8(most, limit), most)) << x;
+    }
+
+    int     lanes[4];
+    unsigned char   bytes[16];
+
+    _mm_storeu_si128((__m128i*)lanes, squares);
+    _mm_storeu_si128((__m128i*)bytes, largest);
+    for (int i = 0 ; i < 4 ; i++)
+        sumSq += (unsigned int)lanes[i];
+    for (int i = 0 ; i < 16 ; i++)
+        maxError = max(maxError, (int)bytes[i]);
+#endif
+
+    for ( ; x < count ; x++)
+    {
+        int     most = 0;
+
+        for (int c = 0 ; c < 3 ; c++)
+        {
+            int     d = abs(a[c][x0 + x] - b[c][x0 + x]);
+
+            diff[c][x0 + x] = (unsigned char)d;
+            sumSq += d * d;
+            most = max(most, d);
+        }
+        maxError = max(maxError, most);
+        if (most > tolerance)
+            mask |= 1ULL << x;
+    }
+    return mask;
+}// Diff_Span
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Difference image against other, composited with black, in one pass
+//  over bands of DIFF_CELL rows.  Gathers the squared error, the largest
+//  error, and the count and boxes of pixels differing by more than the 
+//  tolerance; each band owns a row of cells and boxes its changed pixels
+//  by cell, and cells that touch are merged into regions at the end.  
+//  With write set the difference goes into image as Difference has always 
+//  left it; otherwise neither image changes.  A non zero maxChanged stops
+//  the comparison once more pixels than that have changed.  The 
+//  tolerance is clamped to [-1, 255] first, so every span compares against
+//  the same limit; -1 counts every pixel as changed.  Return success of 
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Diff_Images(TargaImage* image, TargaImage* other, DiffStats& stats, int tolerance, 
+                        size_t maxChanged, bool write, const char* name)
+{
+    if (!other)
+        return false;
+
+    if (image->width != other->width || image->height != other->height)
+    {
+        cout << name << ": Images not the same size\n";
+        return false;
+    }
+    tolerance = max(-1, min(tolerance, 255));
+
+    int                     width = image->width, height = image->height;
+    int                     cellsX = (width + DIFF_CELL - 1) / DIFF_CELL;
+    int                     bands = (height + DIFF_CELL - 1) / DIFF_CELL;
+    PixelView               view = View(image), otherView = View(other);
+    vector<DiffBox>         cells((size_t)cellsX * bands);
+    vector<unsigned long long> bandSq(bands, 0), bandChanged(bands, 0), bandRows(bands, 0);
+    vector<int>             bandMax(bands, 0);
+    atomic<size_t>          changed(0);
+    atomic<bool>            stop(false);
+
+    TileScheduler::Run(bands, [&](int band) {
+        int                     y0 = band * DIFF_CELL, y1 = min(height, y0 + DIFF_CELL);
+        Scratch<unsigned char>  rows((size_t)width * 9);
+        unsigned char           *a[3], *b[3], *diff[3];
+        DiffBox                 *cell = &cells[(size_t)band * cellsX];
+
+        for (int c = 0 ; c < 3 ; c++)
+        {
+            a[c] = &rows[(size_t)width * c];
+            b[c] = &rows[(size_t)width * (c + 3)];
+            diff[c] = &rows[(size_t)width * (c + 6)];
+        }
+        for (int cx = 0 ; cx < cellsX ; cx++)
+            cell[cx].left = cell[cx].top = cell[cx].right = cell[cx].bottom = 0;
+
+        for (int y = y0 ; y < y1 && !stop ; y++)
+        {
+            size_t  rowChanged = 0;
+
+            Unpremultiply_Row(view, y, 0, width, a);
+            Unpremultiply_Row(otherView, y, 0, width, b);
+            for (int cx = 0 ; cx < cellsX ; cx++)
+            {
+                int                 x0 = cx * DIFF_CELL;
+                unsigned long long  mask = Diff_Span(a, b, diff, x0, min(DIFF_CELL, width - x0), tolerance, 
+                                                     bandSq[band], bandMax[band]);
+
+                if (!mask)
+                    continue;
+
+                DiffBox     span = { x0 + Low_Bit(mask), y, x0 + High_Bit(mask) + 1, y + 1 };
+
+                if (cell[cx].right <= cell[cx].left)
+                    cell[cx] = span;
+                else
+                {
+                    cell[cx].left = min(cell[cx].left, span.left);
+                    cell[cx].right = max(cell[cx].right, span.right);
+                    cell[cx].bottom = span.bottom;
+                }
+                rowChanged += Bit_Count(mask);
+            }
+
+            if (write)
+            {
+                size_t  row = (size_t)y * view.stride;
+
+                for (int x = 0 ; x < width ; x++)
+                {
+                    size_t  at = row + (size_t)x * view.step;
+
+                    for (int c = 0 ; c < 3 ; c++)
+                        view.channel[c][at] = diff[c][x];
+                    view.channel[3][at] = 255;
+                }
+            }
+
+            bandChanged[band] += rowChanged;
+            bandRows[band]++;
+            if (maxChanged && changed.fetch_add(rowChanged) + rowChanged > maxChanged)
+                stop = true;
+        }
+    });
+
+    unsigned long long      sumSq = 0, rows = 0;
+
+    stats.maxError = 0;
+    stats.changed = 0;
+    for (int band = 0 ; band < bands ; band++)
+    {
+        sumSq += bandSq[band];
+        rows += bandRows[band];
+        stats.maxError = max(stats.maxError, bandMax[band]);
+        stats.changed += (size_t)bandChanged[band];
+    }
+    stats.mse = rows ? (double)sumSq / (3.0 * rows * width) : 0;
+    stats.psnr = stats.mse > 0 ? 10 * log10(255.0 * 255.0 / stats.mse) : HUGE_VAL;
+    stats.stopped = stop;
+
+    // Merge cells that touch, sides or corners, into regions
+    vector<int>             group(cells.size(), -1);
+    vector<int>             pending;
+    DiffBox                 none = { 0, 0, 0, 0 };
+
+    stats.bounds = none;
+    stats.regions.clear();
+    for (size_t i = 0 ; i < cells.size() ; i++)
+    {
+        if (cells[i].right <= cells[i].left || group[i] >= 0)
+            continue;
+
+        DiffBox     region = cells[i];
+
+        group[i] = (int)stats.regions.size();
+        pending.push_back((int)i);
+        while (!pending.empty())
+        {
+            int     at = pending.back(), cx = at % cellsX, cy = at / cellsX;
+
+            pending.pop_back();
+            region.left = min(region.left, cells[at].left);
+            region.top = min(region.top, cells[at].top);
+            region.right = max(region.right, cells[at].right);
+            region.bottom = max(region.bottom, cells[at].bottom);
+            for (int ny = max(cy - 1, 0) ; ny <= min(cy + 1, bands - 1) ; ny++)
+            {
+                for (int nx = max(cx - 1, 0) ; nx <= min(cx + 1, cellsX - 1) ; nx++)
+                {
+                    int     next = ny * cellsX + nx;
+
+                    if (cells[next].right > cells[next].left && group[next] < 0)
+                    {
+                        group[next] = group[i];
+                        pending.push_back(next);
+                    }
+                }
+            }
+        }
+        stats.regions.push_back(region);
+        if (stats.bounds.right <= stats.bounds.left)
+            stats.bounds = region;
+        else
+        {
+            stats.bounds.left = min(stats.bounds.left, region.left);
+            stats.bounds.top = min(stats.bounds.top, region.top);
+            stats.bounds.right = max(stats.bounds.right, region.right);
+            stats.bounds.bottom = max(stats.bounds.bottom, region.bottom);
+        }
+    }
+
+    return true;
+}// Diff_Images
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Calculate the difference bewteen this imag and the given one.  Image 
+//  dimensions must be equal.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Difference(TargaImage* pImage)
+{
+    DiffStats   stats;
+
+    return Diff_Images(this, pImage, stats, 0, 0, true, "Difference");
+}// Difference
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Calculate the difference bewteen this image and the given one, and 
+//  measure it.  Pixels count as changed if a sample differs by more than 
+//  the tolerance.  Image dimensions must be equal.  Return success of 
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Difference(TargaImage* pImage, DiffStats& stats, int tolerance)
+{
+    return Diff_Images(this, pImage, stats, tolerance, 0, true, "Difference");
+}// Difference
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Measure the difference between this image and the given one without
+//  changing either.  Pixels count as changed if a sample differs by more 
+//  than the tolerance.  A non zero maxChanged stops the comparison once 
+//  more pixels than that have changed, for callers that only need to know
+//  whether the images match.  Image dimensions must be equal.  Return 
+//  success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Compare(TargaImage* pImage, DiffStats& stats, int tolerance, size_t maxChanged)
+{
+    return Diff_Images(this, pImage, stats, tolerance, maxChanged, false, "Compare");
+}// Compare
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform 5x5 box filter on this image.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+bool TargaImage::Filter_Box()
+{   
+	float filter_box[25];
+
+	for(int i = 0;i < 25;i++)
+		filter_box[i] = (float)1/25;
+	convolve_rgb(this, filter_box, 5, 5);
+    return true;
+}// Filter_Box
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Box filter this image over a square 2 * radius + 1 pixels wide, with
+//  running sums so the cost does not grow with the radius.  Matches the 
+//  box convolution exactly, radius 2 being Filter_Box.  Return success of
+//  operation, false if the radius is over BOX_MAX_RADIUS.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Box(unsigned int radius)
+{
+    int     radii[1] = { (int)radius };
+
+    if (radius > (unsigned int)BOX_MAX_RADIUS)
+        return false;
+    Box_RGB(this, radii, 1);
+    return true;
+}// Filter_Box
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Print the kernel a filter built, or the one Filter_Taps builds for 
+//  it, a row a line, when TARGA_TRACE is 1 or more.  Compiled out 
+//  otherwise, leaving the arguments unused.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Trace_Kernel(const char* name, const vector<float>& taps, int size)
+{
+#if TARGA_TRACE >= 1
+    printf("%s kernel %dx%d\n", name, size, size);
+    for (int i = 0 ; i < size ; i++)
+    {
+        for (int j = 0 ; j < size ; j++)
+            printf("%f  ", taps[i * size + j]);
+        printf("\n");
+    }
+#else
+    (void)name;
+    (void)taps;
+    (void)size;
+#endif
+}// Trace_Kernel
+
+static void Trace_Kernel(const char* name, TargaImage::FilterKernel filter)
+{
+#if TARGA_TRACE >= 1
+    vector<float>   taps;
+    int             size;
+
+    TargaImage::Filter_Taps(filter, 0, taps, size);
+    Trace_Kernel(name, taps, size);
+#else
+    (void)name;
+    (void)filter;
+#endif
+}// Trace_Kernel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform 5x5 Bartlett filter on this image, with the integer 
+//  Bartlett engine.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Bartlett()
+{
+    Trace_Kernel("Filter_Bartlett", KERNEL_BARTLETT);
+    Bartlett_RGB(this, BARTLETT_BLUR);
+    return true;
+}// Filter_Bartlett
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform 5x5 Gaussian filter on this image.  Return success of 
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Gaussian()
+{
+    return Filter_Gaussian_N(5);
+}// Filter_Gaussian
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform NxN Gaussian filter on this image.  For odd N from 
+//  GAUSS_BOX_SIZE up the kernel is approximated by three box passes of 
+//  about the same variance, whose cost does not grow with N.  These differ
+//  from the kernel by up to 6 levels on noise and 9 at a bright image 
+//  border, under 1 on average.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+bool TargaImage::Filter_Gaussian_N( unsigned int N )
+{
+    vector<float>   taps;
+    int             size;
+
+    if (Gaussian_Uses_Boxes(N))
+    {
+        int     radii[3];
+
+        Gaussian_Boxes(N, radii);
+        if (radii[2] > BOX_MAX_RADIUS)
+            return false;
+        Box_RGB(this, radii, 3);
+        return true;
+    }
+    if (!Filter_Taps(KERNEL_GAUSSIAN_N, N, taps, size))
+        return false;
+    Trace_Kernel("Filter_Gaussian_N", taps, size);
+    convolve_rgb(this, &taps[0], size, size);
+    return true;
+}// Filter_Gaussian_N
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Whether Filter_Gaussian_N approximates the N tap Gaussian with box
+//  passes rather than convolving with its kernel.  An even kernel is half
+//  a pixel off center, which symmetric boxes cannot follow.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Gaussian_Uses_Boxes(unsigned int N)
+{
+    return N >= GAUSS_BOX_SIZE && N % 2 == 1;
+}// Gaussian_Uses_Boxes
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform 5x5 edge detect (high pass) filter on this image: each 
+//  pixel less its Bartlett blur, from the integer Bartlett engine.  Return
+//  success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Edge()
+{
+    Trace_Kernel("Filter_Edge", KERNEL_EDGE);
+    Bartlett_RGB(this, BARTLETT_EDGE);
+    return true;
+}// Filter_Edge
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform a 5x5 enhancement filter to this image: each pixel plus its
+//  edge, from the integer Bartlett engine.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Enhance()
+{
+    Trace_Kernel("Filter_Enhance", KERNEL_ENHANCE);
+    Bartlett_RGB(this, BARTLETT_ENHANCE);
+    return true;
+}// Filter_Enhance
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build the kernel a convolution filter applies, size * size taps.  N
+//  is the size of the Gaussian.
+//  Return false if there is no such kernel.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Taps(FilterKernel filter, unsigned int N, vector<float>& taps, int& size)
+{
+    const float bartlett[25] = {1,2,3,2,1,2,4,6,4,2,3,6,9,6,3,2,4,6,4,2,1,2,3,2,1};
+
+    switch (filter)
+    {
+        case KERNEL_BOX:
+            taps.assign(25, (float)1/25);
+            size = 5;
+            return true;
+
+        case KERNEL_BARTLETT:
+            taps.resize(25);
+            for (int i = 0 ; i < 25 ; i++)
+                taps[i] = bartlett[i] / 81;
+            size = 5;
+            return true;
+
+        case KERNEL_GAUSSIAN_N:
+        {
+            if (N == 0)
+                return false;
+
+            vector<float>   filter_1d(N);
+            float           sum = 0.0;
+
+            for (unsigned int i = 0 ; i < N ; i++)
+            {
+                filter_1d[i] = Binomial(N - 1, i);
+                sum += filter_1d[i];
+            }
+            taps.resize((size_t)N * N);
+            for (unsigned int i = 0 ; i < N ; i++)
+                for (unsigned int j = 0 ; j < N ; j++)
+                    taps[i * N + j] = filter_1d[i] * filter_1d[j] / pow(sum, 2);
+            size = (int)N;
+            return true;
+        }
+
+        case KERNEL_EDGE:
+        case KERNEL_ENHANCE:
+            taps.resize(25);
+            for (int i = 0 ; i < 25 ; i++)
+                taps[i] = (i == 12 ? (filter == KERNEL_EDGE ? 1 : 2) : 0) - bartlett[i] / 81;
+            size = 5;
+            return true;
+    }
+
+    return false;
+}// Filter_Taps
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Apply a chain of per pixel operations to rows [y0, y1) a row at a
+//  time, so every operation after the first finds the row in cache.  Each
+//  operation only looks at its own pixel, so the pixels come out as if the
+//  operations had run one after another over the whole image, and
+//  Dither_Random's noise is drawn in the same pixel order.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<int STEP> static void Point_Rows(const PixelView& view, int width, int y0, int y1, 
+                                          const vector<TargaImage::PointOp>& ops)
+{
+    if (ops.empty())
+        return;
+
+    for (int y = y0 ; y < y1 ; y++)
+    {
+        for (size_t i = 0 ; i < ops.size() ; i++)
+        {
+            switch (ops[i])
+            {
+                case TargaImage::POINT_GRAY:        Grayscale_Rows<STEP>(view, width, y, y + 1);         break;
+                case TargaImage::POINT_QUANT_UNIF:  Quant_Uniform_Rows<STEP>(view, width, y, y + 1);     break;
+                case TargaImage::POINT_THRESHOLD:   Threshold_Rows<STEP>(view, width, y, y + 1, false);  break;
+                case TargaImage::POINT_RANDOM:      Threshold_Rows<STEP>(view, width, y, y + 1, true);   break;
+            }
+        }
+    }
+}// Point_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the operations of a fused pass over the image, touching each
+//  pixel once instead of once per operation.  Without a kernel the point
+//  operations run as one chain over the rows.  With one, each band of rows
+//  is read with its halo into a small planar buffer, where the operations
+//  before the filter are applied, then convolved into fresh storage, and
+//  the operations after it are applied to the band while it is still in
+//  cache; the halos are read from the untouched image, so bands run in
+//  parallel.  A pass with POINT_RANDOM runs serially, in row order, to keep
+//  the noise sequence of Dither_Random.  The result is the same as running
+//  the operations one at a time.  Return false if the pass breaks the rules
+//  of FusedPass.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Run_Pass(const FusedPass& pass)
+{
+    bool    filtered = !pass.kernel.empty();
+    int     randomBefore = (int)count(pass.before.begin(), pass.before.end(), POINT_RANDOM);
+    int     randoms = randomBefore + (int)count(pass.after.begin(), pass.after.end(), POINT_RANDOM);
+
+    if (randoms > 1 || (filtered && (randomBefore || pass.size <= 0 || pass.kernel.size() != (size_t)pass.size * pass.size)))
+        return false;
+    if (!width || !height)
+        return true;
+
+    PixelView   view = View(this);
+    bool        serial = randoms > 0;
+
+    if (!filtered)
+    {
+        vector<PointOp>     ops(pass.before);
+        auto                rows = [&](int y0, int y1) {
+            if (view.step == 1)
+                Point_Rows<1>(view, width, y0, y1, ops);
+            else
+                Point_Rows<4>(view, width, y0, y1, ops);
+        };
+
+        ops.insert(ops.end(), pass.after.begin(), pass.after.end());
+        if (serial)
+            rows(0, height);
+        else
+            Parallel_Rows(height, (size_t)width * 4, rows);
+        return true;
+    }
+
+    ConvKernel      conv;
+
+    Make_Conv_Kernel(&pass.kernel[0], pass.size, pass.size, conv);
+
+    int             above = pass.size / 2, below = pass.size - 1 - above;
+    // tiles are kept at least 8 times the halo high so the halo rows, whose
+    // before operations and horizontal pass are done twice, stay cheap
+    int             tileRows = max(Conv_Tile_Rows(conv, width, (size_t)width * 3), 8 * (pass.size - 1));
+    int             tiles = (height + tileRows - 1) / tileRows;
+    unsigned char   *result = NULL;
+    PixelView       out = view;
+
+    if (Is_Planar())
+    {
+        for (int c = RED ; c <= BLUE ; c++)
+            out.channel[c] = FrameArena::Acquire((size_t)stride * height);
+    }
+    else
+    {
+        result = new unsigned char[(size_t)width * height * 4];
+        for (int c = 0 ; c < 4 ; c++)
+            out.channel[c] = result + c;
+    }
+
+    auto    band = [&](int tile) {
+        int                     y0 = tile * tileRows, y1 = min(height, y0 + tileRows);
+        int                     r0 = max(0, y0 - above), r1 = min(height, y1 + below);
+        size_t                  plane = (size_t)width * (r1 - r0);
+        Scratch<unsigned char>  source(plane * 3);
+        PixelView               src = { { source.Get(), source.Get() + plane, source.Get() + 2 * plane, NULL }, 1, width };
+
+        for (int y = r0 ; y < r1 ; y++)
+        {
+            for (int c = RED ; c <= BLUE ; c++)
+            {
+                const unsigned char     *in = view.channel[c] + (size_t)y * view.stride;
+                unsigned char           *dst = src.channel[c] + (size_t)(y - r0) * width;
+
+                if (view.step == 1)
+                    memcpy(dst, in, width);
+                else
+                    for (int x = 0 ; x < width ; x++)
+                        dst[x] = in[x * 4];
+            }
+        }
+        Point_Rows<1>(src, width, 0, r1 - r0, pass.before);
+
+        for (int c = RED ; c <= BLUE ; c++)
+            Convolve_Band(conv, src.channel[c], 1, width, r0, out.channel[c], out.step, out.stride, width, height, y0, y1);
+
+        if (result)
+        {
+            for (size_t i = (size_t)y0 * width * 4 + 3 ; i < (size_t)y1 * width * 4 ; i += 4)
+                result[i] = data[i];
+            Point_Rows<4>(out, width, y0, y1, pass.after);
+        }
+        else
+            Point_Rows<1>(out, width, y0, y1, pass.after);
+    };
+
+    if (serial)
+    {
+        for (int tile = 0 ; tile < tiles ; tile++)
+            band(tile);
+    }
+    else
+        TileScheduler::Run(tiles, band);
+
+    if (result)
+    {
+        delete[] data;
+        data = result;
+    }
+    else
+    {
+        for (int c = RED ; c <= BLUE ; c++)
+        {
+            FrameArena::Release(planes[c]);
+            planes[c] = out.channel[c];
+        }
+    }
+
+    return true;
+}// Run_Pass
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run simplified version of Hertzmann's painterly image filter.
+//      You probably will want to use the Draw_Stroke funciton and the
+//      Stroke class to help.
+// Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+void imageDiff(unsigned char *canvas,unsigned char *refImage,unsigned char *difImage,int pixels){
+
+	double diff;
+	for(int i= 0; i< pixels * 4; i += 4)
+	{
+ 	  diff = pow(((double)canvas[i]-(double)refImage[i]), 2)
+ 			 	+ pow(((double)canvas[i+1]-(double)refImage[i+1]), 2)
+ 			 	+ pow(((double)canvas[i+2]-(double)refImage[i+2]), 2);
+ 	  diff = sqrt(diff);
+ 	  diff = diff > 255 ? 255 : diff;
+	  difImage[i] = diff;
+	  difImage[i+1] = diff;
+	  difImage[i+2] = diff;
+	}
+}
+
+int region(unsigned char *difImage, int width, int height, int& xPos, int& yPos, int radius)
+{
+	int sum = 0, idx, maxVal = 0, maxX = 0, maxY = 0;
+
+	for(int i = -radius; i <= radius; i++)
+	{
+		for(int j = -radius; j <= radius; j++)
+ 		{
+ 			if(((i+xPos) >= 0)&&((i+xPos) < width)&&
+				((j+yPos) >= 0)&&((j+yPos) < height))
+ 			{
+ 		 		idx = ((j+yPos) * width + (i+xPos)) * 4;
+ 				sum += (int)difImage[idx];
+
+ 		 		// Test for the max value of the region 
+ 				if((int)difImage[idx] > maxVal)
+				{
+					maxVal = (int)difImage[idx];
+					maxX = i+xPos;
+					maxY = j+yPos;
+				}
+			}
+		}
+	}
+	xPos = maxX; yPos = maxY;
+	return sum;
+}
+
+void paintLayer(unsigned char *source,TargaImage *canvas,unsigned char *refImage,int radius){
+
+	int width = canvas->width, height = canvas->height;
+	Scratch<unsigned char> difImage((size_t)width * height * 4);
+	imageDiff(canvas->data,refImage,difImage.Get(),width * height);
+
+	int grid = radius; /* fg * radius, fg set to 1 */
+	int error,rad,maxX,maxY,unitNum;
+
+	vector<int> strokePointsX, strokePointsY;
+
+	Stroke stroke;
+
+	for(int x = 0; x < width;x += grid)
+		for(int y = 0;y < height;y += grid)
+		{
+			// sum the error
+			rad = (grid/2 < 1) ? 1 : grid/2;
+ 			maxX = x+rad; maxY = y+rad;
+ 			error = region(difImage.Get(), width, height, maxX, maxY, rad)/(grid * grid);
+			if(error > 25)  // threshold set to 25
+			{
+			  strokePointsX.push_back(maxX);
+			  strokePointsY.push_back(maxY);
+			}
+		}
+	// Randomly pull a point from the container and render it
+	//srand(time(NULL));
+	while(!strokePointsX.empty() && !strokePointsY.empty())
+	{
+		unitNum = rand() % strokePointsX.size();
+		stroke.radius = radius;
+		stroke.x = strokePointsX[unitNum];
+		stroke.y = strokePointsY[unitNum];
+		unsigned char *color = refImage + ((size_t)stroke.y * width + stroke.x) * 4;
+		stroke.r = color[0];
+		stroke.g = color[1];
+		stroke.b = color[2];
+		stroke.a = color[3];
+		canvas->Paint_Stroke(stroke);
+		strokePointsX.erase(strokePointsX.begin()+unitNum);
+		strokePointsY.erase(strokePointsY.begin()+unitNum);
+	}
+	/* copy canvas data to current image */
+	memcpy(source, canvas->data, (size_t)width * height * 4);
+}
+
+void paint(TargaImage *source,int strokeSizes[],int num){
+
+	/* canvas starts out black */
+	TargaImage canvas(source->width,source->height);
+	size_t bytes = (size_t)source->width * source->height * 4;
+	Scratch<unsigned char> refImage(bytes);
+	memset(refImage.Get(), 0, bytes);
+
+	for(int i = 0;i < num;i++){
+       bool blur = source->Filter_Gaussian_N(2 * strokeSizes[i] + 1);
+		/* Gaussian blurred refImage */
+	   if(blur == true)
+		memcpy(refImage.Get(), source->data, bytes);
+	   paintLayer(source->data,&canvas,refImage.Get(),strokeSizes[i]);
+	}
+    //Redraw();
+
+
+}
+bool TargaImage::NPR_Paint()
+{   
+	InterleavedScope scope(this);
+	/* Not Working !!!!! 
+	 The basic idea: I use Gaussian filter N to create a reference image of current image, and a canvas image
+	                 to paint, each time stroke color is initialized by the color in the corresponding point 
+					 of reference image. I think it is wrong in error computation of paintLayer. I just did not
+					 figure out how to do it, and the paper omits some details in this part.*/
+	if (!width || !height)
+		return true;
+	TargaImage source(width,height,data);
+	int strokeSizes[] = {7,3,1};
+	paint(&source,strokeSizes,3);
+	memcpy(data, source.data, (size_t)width * height * 4);
+    return true;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Weights that resample one axis of an image, computed once per 
+//  output sample.  Output sample i is the sum over k < taps of source 
+//  sample index[i * taps + k] times weights[i * taps + k], the weights in
+//  1 / (1 << RESAMPLE_BITS) and summing to one.  The source samples of an
+//  output sample start at first[i], which may lie outside the image; 
+//  index clamps them to the edge.  first never decreases, and taps is 
+//  even so the SIMD passes can take the taps in pairs.
+//
+///////////////////////////////////////////////////////////////////////////////
+enum ResampleKernel
+{
+    RESAMPLE_BARTLETT,                  // triangle, the binomial [1 3 3 1] filters at twice and half size
+    RESAMPLE_LANCZOS3                   // windowed sinc of three lobes
+};
+
+struct ResampleAxis
+{
+    int             taps;
+    vector<int>     first;
+    vector<int>     index;
+    vector<short>   weights;
+    bool            negative;           // some weights are negative, so results can leave the premultiplied range
+};
+
+static double Resample_Weight(ResampleKernel kernel, double t)
+{
+    t = fabs(t);
+    if (kernel == RESAMPLE_BARTLETT)
+        return t < 1 ? 1 - t : 0;
+    if (t < 1e-9)
+        return 1;
+    if (t >= 3)
+        return 0;
+
+    double  x = 3.14159265358979323846 * t;
+
+    return 3 * sin(x) * sin(x / 3) / (x * x);
+}// Resample_Weight
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build the weights that resample inSize samples to outSize, each 
+//  output sample ratio source samples wide.  Output sample i is centered
+//  on source position (i + 0.5) * ratio - 0.5.  When shrinking the kernel
+//  is stretched to cover ratio samples per lobe, so it also filters out 
+//  what the smaller image cannot hold.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Build_Resample_Axis(int inSize, int outSize, double ratio, ResampleKernel kernel, ResampleAxis& axis)
+{
+    double          stretch = max(ratio, 1.0);
+    double          support = (kernel == RESAMPLE_BARTLETT ? 1 : 3) * stretch;
+    vector<double>  weights;
+
+    axis.taps = 0;
+    for (int i = 0 ; i < outSize ; i++)
+    {
+        double  center = (i + 0.5) * ratio - 0.5;
+
+        axis.taps = max(axis.taps, (int)floor(center + support) - (int)ceil(center - support) + 1);
+    }
+    axis.taps += axis.taps & 1;
+    axis.first.resize(outSize);
+    axis.index.resize((size_t)outSize * axis.taps);
+    axis.weights.resize((size_t)outSize * axis.taps);
+    axis.negative = false;
+    weights.resize(axis.taps);
+
+    for (int i = 0 ; i < outSize ; i++)
+    {
+        double  center = (i + 0.5) * ratio - 0.5;
+        int     first = (int)ceil(center - support);
+        double  sum = 0;
+
+        for (int k = 0 ; k < axis.taps ; k++)
+        {
+            weights[k] = Resample_Weight(kernel, (first + k - center) / stretch);
+            sum += weights[k];
+        }
+
+        // round to fixed point, and give the rounding error to the largest
+        // weight so the weights sum to exactly one
+        short   *fixed = &axis.weights[(size_t)i * axis.taps];
+        int     total = 0, largest = 0;
+
+        for (int k = 0 ; k < axis.taps ; k++)
+        {
+            fixed[k] = (short)floor(weights[k] / sum * (1 << RESAMPLE_BITS) + 0.5);
+            total += fixed[k];
+            if (fixed[k] > fixed[largest])
+                largest = k;
+            axis.negative |= fixed[k] < 0;
+            axis.index[(size_t)i * axis.taps + k] = min(max(first + k, 0), inSize - 1);
+        }
+        fixed[largest] += (short)((1 << RESAMPLE_BITS) - total);
+        axis.first[i] = first;
+    }
+}// Build_Resample_Axis
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Two weights packed for madd against samples interleaved a, b.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline int Weight_Pair(const short* weight)
+{
+    return (int)((unsigned short)weight[0] | ((unsigned int)(unsigned short)weight[1] << 16));
+}// Weight_Pair
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Resample source row y across into RGBA samples with 
+//  RESAMPLE_MID_BITS fractional bits.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<int STEP> static void Resample_Across(const PixelView& view, int y, const ResampleAxis& axis, int width, short* out)
+{
+    const int           taps = axis.taps;
+    const int           shift = RESAMPLE_BITS - RESAMPLE_MID_BITS;
+    const unsigned char *row[4];
+
+    for (int c = 0 ; c < 4 ; c++)
+        row[c] = view.channel[c] + (size_t)y * view.stride;
+
+    for (int x = 0 ; x < width ; x++)
+    {
+        const int       *index = &axis.index[(size_t)x * taps];
+        const short     *weight = &axis.weights[(size_t)x * taps];
+
+#if defined(TARGA_SSE41)
+        if (STEP == 4)
+        {
+            __m128i sum = _mm_setzero_si128();
+
+            // two source pixels a step, their channels interleaved a, b, a, b
+            // against the weight pair
+            for (int k = 0 ; k < taps ; k += 2)
+            {
+                int     a, b;
+
+                memcpy(&a, row[0] + index[k] * 4, 4);
+                memcpy(&b, row[0] + index[k + 1] * 4, 4);
+
+                __m128i pair = _mm_unpacklo_epi16(_mm_cvtepu8_epi16(_mm_cvtsi32_si128(a)),
+                                                  _mm_cvtepu8_epi16(_mm_cvtsi32_si128(b)));
+                __m128i w = _mm_set1_epi32(Weight_Pair(weight + k));
+
+                sum = _mm_add_epi32(sum, _mm_madd_epi16(pair, w));
+            }
+            sum = _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(1 << (shift - 1))), shift);
+            _mm_storel_epi64((__m128i*)(out + x * 4), _mm_packs_epi32(sum, sum));
+            continue;
+        }
+#endif
+
+        for (int c = 0 ; c < 4 ; c++)
+        {
+            int     sum = 0;
+
+            for (int k = 0 ; k < taps ; k++)
+                sum += row[c][index[k] * STEP] * weight[k];
+            out[x * 4 + c] = (short)((sum + (1 << (shift - 1))) >> shift);
+        }
+    }
+}// Resample_Across
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Resample down one output row from the taps rows of across samples
+//  in rows, count samples, weighting row k by weight[k].  Results are
+//  rounded and clamped to bytes.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Resample_Down(short* const* rows, const short* weight, int taps, int count, unsigned char* out)
+{
+    const int   shift = RESAMPLE_BITS + RESAMPLE_MID_BITS;
+    int         i = 0;
+
+#if defined(TARGA_AVX2)
+    for ( ; i + 16 <= count ; i += 16)
+    {
+        __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+
+        for (int k = 0 ; k < taps ; k += 2)
+        {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(rows[k] + i));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(rows[k + 1] + i));
+            __m256i w = _mm256_set1_epi32(Weight_Pair(weight + k));
+
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+        }
+
+        __m256i round = _mm256_set1_epi32(1 << (shift - 1));
+        __m256i words = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(lo, round), shift),
+                                           _mm256_srai_epi32(_mm256_add_epi32(hi, round), shift));
+
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(_mm256_castsi256_si128(words),
+                                                               _mm256_extracti128_si256(words, 1)));
+    }
+#endif
+#if defined(TARGA_SSE41)
+    for ( ; i + 8 <= count ; i += 8)
+    {
+        __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+
+        for (int k = 0 ; k < taps ; k += 2)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*)(rows[k] + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(rows[k + 1] + i));
+            __m128i w = _mm_set1_epi32(Weight_Pair(weight + k));
+
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+        }
+
+        __m128i round = _mm_set1_epi32(1 << (shift - 1));
+        __m128i words = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(lo, round), shift),
+                                        _mm_srai_epi32(_mm_add_epi32(hi, round), shift));
+
+        _mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(words, words));
+    }
+#endif
+
+    for ( ; i < count ; i++)
+    {
+        int     sum = 0;
+
+        for (int k = 0 ; k < taps ; k++)
+            sum += rows[k][i] * weight[k];
+        out[i] = (unsigned char)min(max((sum + (1 << (shift - 1))) >> shift, 0), 255);
+    }
+}// Resample_Down
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Source rows resampled across, kept in a ring of taps rows keyed by
+//  source row.  Row makes output row y of the down axis: the source rows
+//  it needs that are not in the ring yet are resampled across into it,
+//  over rows no later output row needs since first never decreases, and
+//  the output row is resampled down from the ring.  Kernels with negative
+//  lobes can overshoot, so their colors are clamped to alpha to keep the
+//  pixels premultiplied.
+//
+///////////////////////////////////////////////////////////////////////////////
+class ResampleRing
+{
+    public:
+        ResampleRing(const ResampleAxis& across, const ResampleAxis& down, int width)
+            : m_across(across), m_down(down), m_width(width), m_ring((size_t)down.taps * width * 4),
+              m_rows(down.taps), m_next(INT_MIN) {}
+
+        void Row(const PixelView& view, int sourceHeight, int y, unsigned char* out)
+        {
+            int     taps = m_down.taps, first = m_down.first[y], samples = m_width * 4;
+
+            for (int r = max(m_next, first) ; r < first + taps ; r++)
+            {
+                int     source = min(max(r, 0), sourceHeight - 1);
+
+                if (view.step == 1)
+                    Resample_Across<1>(view, source, m_across, m_width, Slot(r));
+                else
+                    Resample_Across<4>(view, source, m_across, m_width, Slot(r));
+            }
+            m_next = first + taps;
+
+            for (int k = 0 ; k < taps ; k++)
+                m_rows[k] = Slot(first + k);
+            Resample_Down(m_rows.Get(), &m_down.weights[(size_t)y * taps], taps, samples, out);
+
+            if (m_across.negative || m_down.negative)
+            {
+                for (int x = 0 ; x < samples ; x += 4)
+                {
+                    out[x] = min(out[x], out[x + 3]);
+                    out[x + 1] = min(out[x + 1], out[x + 3]);
+                    out[x + 2] = min(out[x + 2], out[x + 3]);
+                }
+            }
+        }
+
+    private:
+        ResampleRing(const ResampleRing&);
+        ResampleRing& operator=(const ResampleRing&);
+
+        short* Slot(int row) const { return m_ring.Get() + (size_t)(((row % m_down.taps) + m_down.taps) % m_down.taps) * m_width * 4; }
+
+        const ResampleAxis&     m_across;
+        const ResampleAxis&     m_down;
+        int                     m_width;
+        Scratch<short>          m_ring;
+        Scratch<short*>         m_rows;
+        int                     m_next;             // first source row not yet in the ring
+};// ResampleRing
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Resample the pixels of a view into width by height interleaved 
+//  pixels, across and then down, each output pixel ratioX by ratioY 
+//  source pixels.  Each tile of output rows keeps its own ring, so memory
+//  stays at the output width times the taps however large the image.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Resample_Pixels(const PixelView& view, int sourceWidth, int sourceHeight, unsigned char* result,
+                            int width, int height, double ratioX, double ratioY, ResampleKernel kernel)
+{
+    ResampleAxis    across, down;
+
+    Build_Resample_Axis(sourceWidth, width, ratioX, kernel, across);
+    Build_Resample_Axis(sourceHeight, height, ratioY, kernel, down);
+
+    int     tileRows = max(Tile_Rows((size_t)width * 4 * (sizeof(short) * down.taps + 1), 0), 8);
+    int     tiles = width ? (height + tileRows - 1) / tileRows : 0;
+
+    TileScheduler::Run(tiles, [&](int tile) {
+        ResampleRing    ring(across, down, width);
+
+        for (int y = tile * tileRows ; y < min(height, (tile + 1) * tileRows) ; y++)
+            ring.Row(view, sourceHeight, y, result + (size_t)y * width * 4);
+    });
+}// Resample_Pixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Resample the image to width by height, see Resample_Pixels.  data 
+//  is replaced once; a planar image is split into planes again afterwards.
+//  Return false if the new image does not fit in memory.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Resample_Image(TargaImage* image, int width, int height, double ratioX, double ratioY, ResampleKernel kernel)
+{
+    if ((double)width * height * 4 > INT_MAX)
+        return false;
+
+    unsigned char   *result = new (nothrow) unsigned char[(size_t)width * height * 4];
+
+    if (!result)
+        return false;
+
+    Resample_Pixels(View(image), image->width, image->height, result, width, height, ratioX, ratioY, kernel);
+
+    bool    planar = image->Is_Planar();
+
+    for (int c = 0 ; c < 4 ; c++)
+    {
+        FrameArena::Release(image->planes[c]);
+        image->planes[c] = NULL;
+    }
+    delete[] image->data;
+    image->data = result;
+    image->width = width;
+    image->height = height;
+    if (planar)
+        image->Set_Planar(true);
+
+    return true;
+}// Resample_Image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Halve the dimensions of this image.  Each pixel is the [1 3 3 1] 
+//  binomial filter of the 4x4 source pixels around the 2x2 it replaces.
+//  Odd sizes drop the last row or column.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Half_Size()
+{
+    return Resample_Image(this, width / 2, height / 2, 2.0, 2.0, RESAMPLE_BARTLETT);
+}// Half_Size
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Double the dimensions of this image.  Each new pixel mixes the 2x2
+//  source pixels nearest it by 3 to 1 along each axis, the polyphase form
+//  of the Bartlett filter.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Double_Size()
+{
+    if ((double)width * height * 16 > INT_MAX)
+        return false;
+    return Resample_Image(this, width * 2, height * 2, 0.5, 0.5, RESAMPLE_BARTLETT);
+}// Double_Size
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Scale the image dimensions by the given factor, up or down, with a
+//  Lanczos-3 filter.  Sizes are rounded and at least one pixel.  Return 
+//  success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Resize(float scale)
+{
+    if (!(scale > 0) || (double)width * scale * height * scale * 4 > INT_MAX)
+        return false;
+
+    int     newWidth = width ? max(1, (int)floor(width * (double)scale + 0.5)) : 0;
+    int     newHeight = height ? max(1, (int)floor(height * (double)scale + 0.5)) : 0;
+
+    return Resample_Image(this, newWidth, newHeight, 1.0 / scale, 1.0 / scale, RESAMPLE_LANCZOS3);
+}// Resize
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build an empty pyramid.  Free the levels.
+//
+///////////////////////////////////////////////////////////////////////////////
+MipPyramid::MipPyramid() : m_pData(NULL)
+{
+}// MipPyramid
+
+MipPyramid::~MipPyramid()
+{
+    Clear();
+}// ~MipPyramid
+
+void MipPyramid::Clear()
+{
+    delete[] m_pData;
+    m_pData = NULL;
+    m_levels.clear();
+}// Clear
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build the levels of an image, replacing any built before.  Each
+//  level is its own Bartlett reduction of the level before, the binomial
+//  filter Half_Size applies, with a ring of its own.  As each row of the
+//  image is copied into level 0, every row of the smaller levels whose
+//  source rows are now done is made, so the rows a level reads are the
+//  ones just written and still in cache, and the image is read once for
+//  all levels.  Sizes halve and round down but stop at 1.  Return false 
+//  if the image is empty or the levels do not fit in memory.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool MipPyramid::Build(TargaImage* pImage, int levels)
+{
+    Clear();
+    if (!pImage || pImage->width <= 0 || pImage->height <= 0)
+        return false;
+
+    Level   level = { pImage->width, pImage->height, 0 };
+    size_t  total = 0;
+
+    for (;;)
+    {
+        level.offset = total;
+        m_levels.push_back(level);
+        total += (size_t)level.width * level.height * 4;
+        if ((level.width == 1 && level.height == 1) || (int)m_levels.size() == levels)
+            break;
+        level.width = max(1, level.width / 2);
+        level.height = max(1, level.height / 2);
+    }
+
+    if (!(m_pData = new (nothrow) unsigned char[total]))
+    {
+        Clear();
+        return false;
+    }
+
+    int                     count = (int)m_levels.size();
+    vector<ResampleAxis>    across(count), down(count);     // entry k makes level k from level k - 1
+    vector<ResampleRing*>   rings(count, (ResampleRing*)NULL);
+    vector<PixelView>       views(count);
+    vector<int>             done(count, 0);                 // rows of each level made so far
+
+    for (int k = 0 ; k < count ; k++)
+    {
+        unsigned char   *pixels = m_pData + m_levels[k].offset;
+        PixelView       view = { { pixels, pixels + 1, pixels + 2, pixels + 3 }, 4, m_levels[k].width * 4 };
+
+        views[k] = view;
+        if (!k)
+            continue;
+        Build_Resample_Axis(m_levels[k - 1].width, m_levels[k].width, 2.0, RESAMPLE_BARTLETT, across[k]);
+        Build_Resample_Axis(m_levels[k - 1].height, m_levels[k].height, 2.0, RESAMPLE_BARTLETT, down[k]);
+        rings[k] = new ResampleRing(across[k], down[k], m_levels[k].width);
+    }
+
+    PixelView   source = View(pImage);
+    int         width = pImage->width;
+
+    for (int y = 0 ; y < pImage->height ; y++)
+    {
+        unsigned char   *row = m_pData + (size_t)y * width * 4;
+
+        if (source.step == 4)
+            memcpy(row, source.channel[0] + (size_t)y * source.stride, (size_t)width * 4);
+        else
+        {
+            for (int c = 0 ; c < 4 ; c++)
+            {
+                const unsigned char *plane = source.channel[c] + (size_t)y * source.stride;
+
+                for (int x = 0 ; x < width ; x++)
+                    row[x * 4 + c] = plane[x];
+            }
+        }
+        done[0]++;
+
+        for (int k = 1 ; k < count ; k++)
+        {
+            const Level&    below = m_levels[k - 1];
+
+            while (done[k] < m_levels[k].height)
+            {
+                int     last = min(down[k].first[done[k]] + down[k].taps - 1, below.height - 1);
+
+                if (last >= done[k - 1])
+                    break;
+                rings[k]->Row(views[k - 1], below.height, done[k],
+                              m_pData + m_levels[k].offset + (size_t)done[k] * m_levels[k].width * 4);
+                done[k]++;
+            }
+        }
+    }
+
+    for (int k = 0 ; k < count ; k++)
+        delete rings[k];
+
+    return true;
+}// Build
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make a new image of the given size from the smallest level that is 
+//  at least that large, or level 0 if none is, resampled with Lanczos-3 
+//  when the sizes differ.  The caller owns the image.  Return NULL if 
+//  nothing is built or the size is not positive.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* MipPyramid::Thumbnail(int width, int height) const
+{
+    if (m_levels.empty() || width <= 0 || height <= 0 || (double)width * height * 4 > INT_MAX)
+        return NULL;
+
+    int     k = 0;
+
+    while (k + 1 < (int)m_levels.size() && m_levels[k + 1].width >= width && m_levels[k + 1].height >= height)
+        k++;
+
+    const Level&    level = m_levels[k];
+    unsigned char   *pixels = m_pData + level.offset;
+    TargaImage      *pImage = new TargaImage(width, height);
+
+    if (level.width == width && level.height == height)
+        memcpy(pImage->data, pixels, (size_t)width * height * 4);
+    else
+    {
+        PixelView   view = { { pixels, pixels + 1, pixels + 2, pixels + 3 }, 4, level.width * 4 };
+
+        Resample_Pixels(view, level.width, level.height, pImage->data, width, height,
+                        (double)level.width / width, (double)level.height / height, RESAMPLE_LANCZOS3);
+    }
+
+    return pImage;
+}// Thumbnail
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Inverse mapping of a rotation: output pixel (x, y) comes from source
+//  position (x * ax + y * bx + cx, x * ay + y * by + cy).  A rotation 
+//  clockwise by a on screen, where y runs down, about the center of the
+//  image.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct RotateMap
+{
+    double      ax, bx, cx;
+    double      ay, by, cy;
+};
+
+static RotateMap Rotate_Map(int width, int height, double cosA, double sinA)
+{
+    double      midX = (width - 1) * 0.5, midY = (height - 1) * 0.5;
+    RotateMap   map = { cosA, sinA, midX - midX * cosA - midY * sinA,
+                        -sinA, cosA, midY + midX * sinA - midY * cosA };
+
+    return map;
+}// Rotate_Map
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy the pixels of an output tile from a rotation by a multiple of
+//  90 degrees whose map is whole numbers, so every output pixel is one 
+//  source pixel.  Pixels mapped outside the image are cleared.  A tile's
+//  source is a square of the same size, so the column it is read down 
+//  stays in cache.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<int STEP> static void Rotate_Exact_Tile(const PixelView& view, int width, int height, const RotateMap& map,
+                                                 int x0, int x1, int y0, int y1, unsigned char* out)
+{
+    int     ax = (int)map.ax, ay = (int)map.ay;
+
+    for (int y = y0 ; y < y1 ; y++)
+    {
+        int             sx = (int)(x0 * map.ax + y * map.bx + map.cx);
+        int             sy = (int)(x0 * map.ay + y * map.by + map.cy);
+        unsigned char   *dst = out + ((size_t)y * width + x0) * 4;
+
+        for (int x = x0 ; x < x1 ; x++, sx += ax, sy += ay, dst += 4)
+        {
+            if (sx < 0 || sy < 0 || sx >= width || sy >= height)
+            {
+                memset(dst, 0, 4);
+                continue;
+            }
+
+            size_t  offset = (size_t)sy * view.stride + (size_t)sx * STEP;
+
+            if (STEP == 4)
+                memcpy(dst, view.channel[0] + offset, 4);
+            else
+            {
+                for (int c = 0 ; c < 4 ; c++)
+                    dst[c] = view.channel[c][offset];
+            }
+        }
+    }
+}// Rotate_Exact_Tile
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Bilinearly sample the pixels of an output tile from a rotation.  
+//  Source positions are stepped along each row in ROTATE_FRAC_BITS fixed
+//  point from one computed at the start of the row, and the fraction,
+//  rounded to 8 bits, weights the four source pixels around them.  Pixels beyond
+//  the image count as clear, so the edges of the rotated image are 
+//  smoothed into the clear corners.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<int STEP> static inline unsigned char Rotate_Sample(const PixelView& view, int c, int x, int y, int width, int height)
+{
+    return (x >= 0 && y >= 0 && x < width && y < height) ? view.channel[c][(size_t)y * view.stride + (size_t)x * STEP] : 0;
+}// Rotate_Sample
+
+template<int STEP> static void Rotate_Bilinear_Tile(const PixelView& view, int width, int height, const RotateMap& map,
+                                                    int x0, int x1, int y0, int y1, unsigned char* out)
+{
+    const double        one = (double)(1 << ROTATE_FRAC_BITS);
+    const long long     stepX = llround(map.ax * one), stepY = llround(map.ay * one);
+    const int           shift = ROTATE_FRAC_BITS - 8;
+
+    for (int y = y0 ; y < y1 ; y++)
+    {
+        long long       sx = llround((x0 * map.ax + y * map.bx + map.cx) * one) + (1 << (shift - 1));
+        long long       sy = llround((x0 * map.ay + y * map.by + map.cy) * one) + (1 << (shift - 1));
+        unsigned char   *dst = out + ((size_t)y * width + x0) * 4;
+
+        for (int x = x0 ; x < x1 ; x++, sx += stepX, sy += stepY, dst += 4)
+        {
+            int     ix = (int)(sx >> ROTATE_FRAC_BITS), iy = (int)(sy >> ROTATE_FRAC_BITS);
+
+            if (ix < -1 || iy < -1 || ix >= width || iy >= height)
+            {
+                memset(dst, 0, 4);
+                continue;
+            }
+
+            int     fx = (int)(sx >> shift) & 0xFF, fy = (int)(sy >> shift) & 0xFF;
+            int     w00 = (256 - fx) * (256 - fy), w10 = fx * (256 - fy);
+            int     w01 = (256 - fx) * fy, w11 = fx * fy;
+
+            if (ix >= 0 && iy >= 0 && ix + 1 < width && iy + 1 < height)
+            {
+                for (int c = 0 ; c < 4 ; c++)
+                {
+                    const unsigned char *p = view.channel[c] + (size_t)iy * view.stride + (size_t)ix * STEP;
+
+                    dst[c] = (unsigned char)((p[0] * w00 + p[STEP] * w10 + p[view.stride] * w01 +
+                                              p[view.stride + STEP] * w11 + (1 << 15)) >> 16);
+                }
+            }
+            else
+            {
+                for (int c = 0 ; c < 4 ; c++)
+                {
+                    dst[c] = (unsigned char)((Rotate_Sample<STEP>(view, c, ix, iy, width, height) * w00 +
+                                              Rotate_Sample<STEP>(view, c, ix + 1, iy, width, height) * w10 +
+                                              Rotate_Sample<STEP>(view, c, ix, iy + 1, width, height) * w01 +
+                                              Rotate_Sample<STEP>(view, c, ix + 1, iy + 1, width, height) * w11 +
+                                              (1 << 15)) >> 16);
+                }
+            }
+        }
+    }
+}// Rotate_Bilinear_Tile
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Rotate the image clockwise by the given angle.  Do not resize the 
+//  image: corners rotated out of it are lost and those rotated in are 
+//  clear.  Output is written in ROTATE_TILE square tiles, in parallel, so
+//  the source each tile reads is a small rotated square rather than whole
+//  rows or columns.  Multiples of 90 degrees that map pixels onto pixels,
+//  any of them for square images, are exact tiled copies; other angles 
+//  are bilinear.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Rotate(float angleDegrees)
+{
+    double  angle = fmod((double)angleDegrees, 360.0);
+
+    if (angle < 0)
+        angle += 360;
+    if (angle == 0 || !width || !height)
+        return true;
+
+    bool    quarter = fmod(angle, 90.0) == 0;
+    double  radians = angle * 3.14159265358979323846 / 180;
+    double  cosA = cos(radians), sinA = sin(radians);
+
+    if (quarter)
+    {
+        cosA = angle == 180 ? -1 : 0;
+        sinA = angle == 90 ? 1 : (angle == 270 ? -1 : 0);
+    }
+
+    RotateMap       map = Rotate_Map(width, height, cosA, sinA);
+    bool            exact = quarter && map.cx == floor(map.cx) && map.cy == floor(map.cy);
+    unsigned char   *result = new (nothrow) unsigned char[(size_t)width * height * 4];
+
+    if (!result)
+        return false;
+
+    PixelView   view = View(this);
+    int         tilesX = (width + ROTATE_TILE - 1) / ROTATE_TILE;
+    int         tilesY = (height + ROTATE_TILE - 1) / ROTATE_TILE;
+
+    TileScheduler::Run(tilesX * tilesY, [&](int tile) {
+        int     x0 = tile % tilesX * ROTATE_TILE, y0 = tile / tilesX * ROTATE_TILE;
+        int     x1 = min(width, x0 + ROTATE_TILE), y1 = min(height, y0 + ROTATE_TILE);
+
+        if (exact && view.step == 1)
+            Rotate_Exact_Tile<1>(view, width, height, map, x0, x1, y0, y1, result);
+        else if (exact)
+            Rotate_Exact_Tile<4>(view, width, height, map, x0, x1, y0, y1, result);
+        else if (view.step == 1)
+            Rotate_Bilinear_Tile<1>(view, width, height, map, x0, x1, y0, y1, result);
+        else
+            Rotate_Bilinear_Tile<4>(view, width, height, map, x0, x1, y0, y1, result);
+    });
+
+    bool    planar = Is_Planar();
+
+    for (int c = 0 ; c < 4 ; c++)
+    {
+        FrameArena::Release(planes[c]);
+        planes[c] = NULL;
+    }
+    delete[] data;
+    data = result;
+    if (planar)
+        Set_Planar(true);
+
+    return true;
+}// Rotate
+
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//      Given a single RGBA pixel return, via the second argument, the RGB
+//      equivalent composited with a black background.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::RGBA_To_RGB(unsigned char *rgba, unsigned char *rgb)
+{
+    const unsigned char *entry = Alpha_Table<Unpremultiply>() + rgba[3] * 256;
+
+    rgb[0] = entry[rgba[0]];
+    rgb[1] = entry[rgba[1]];
+    rgb[2] = entry[rgba[2]];
+}// RGA_To_RGB
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Clear the image to all black.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::ClearToBlack()
+{
+    memset(data, 0, (size_t)width * height * 4);
+    if (Is_Planar())
+        for (int c = 0 ; c < 4 ; c++)
+            memset(planes[c], 0, (size_t)stride * height);
+}// ClearToBlack
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Helper function for the painterly filter; paint a stroke at
+// the given location
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Paint_Stroke(const Stroke& s) {
+   PixelView view = View(this);
+   unsigned char color[4] = { s.r, s.g, s.b, s.a };
+   int radius_squared = (int)s.radius * (int)s.radius;
+   for (int x_off = -((int)s.radius); x_off <= (int)s.radius; x_off++) {
+      for (int y_off = -((int)s.radius); y_off <= (int)s.radius; y_off++) {
+         int x_loc = (int)s.x + x_off;
+         int y_loc = (int)s.y + y_off;
+         // are we inside the circle, and inside the image?
+         if ((x_loc >= 0 && x_loc < width && y_loc >= 0 && y_loc < height)) {
+            int dist_squared = x_off * x_off + y_off * y_off;
+            size_t offset = (size_t)y_loc * view.stride + (size_t)x_loc * view.step;
+            if (dist_squared <= radius_squared) {
+               for (int c = 0; c < 4; c++)
+                  view.channel[c][offset] = color[c];
+            } else if (dist_squared == radius_squared + 1) {
+               for (int c = 0; c < 4; c++)
+                  view.channel[c][offset] = (view.channel[c][offset] + color[c]) / 2;
+            }
+         }
+      }
+   }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build a Stroke
+//
+///////////////////////////////////////////////////////////////////////////////
+Stroke::Stroke() {}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build a Stroke
+//
+///////////////////////////////////////////////////////////////////////////////
+Stroke::Stroke(unsigned int iradius, unsigned int ix, unsigned int iy,
+               unsigned char ir, unsigned char ig, unsigned char ib, unsigned char ia) :
+   radius(iradius),x(ix),y(iy),r(ir),g(ig),b(ib),a(ia)
+{
+}
+
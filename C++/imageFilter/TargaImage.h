@@ -4,12 +4,84 @@
 #include <Fl/Fl.h>
 #include <Fl/Fl_Widget.h>
 #include <stdio.h>
+#include <vector>
 
 class Stroke;
 class DistanceImage;
+struct FusedPass;
+
+// Scratch memory accounting, summed over the scratch arenas of all threads
+struct ScratchStats
+{
+    size_t      inUse;          // bytes of scratch and plane memory currently handed out
+    size_t      highWater;      // most bytes ever handed out at once
+    size_t      cached;         // bytes kept on free lists for reuse
+    size_t      heapAllocs;     // blocks that had to come from the heap
+    size_t      requests;       // blocks handed out
+};
+
+// Box of pixels, right and bottom exclusive.  Empty when right <= left.
+struct DiffBox
+{
+    int         left, top, right, bottom;
+};
+
+// Measured difference between two images, see TargaImage::Compare
+struct DiffStats
+{
+    double      mse;            // mean squared difference of the red, green and blue samples
+    double      psnr;           // peak signal to noise ratio in dB, infinite if nothing differs
+    int         maxError;       // largest difference of a sample
+    size_t      changed;        // pixels with a sample differing by more than the tolerance
+    DiffBox     bounds;         // box holding all changed pixels
+    std::vector<DiffBox> regions;   // boxes around separate groups of changed pixels
+    bool        stopped;        // stopped at the change limit, the figures only cover the rows compared
+};
 
 class TargaImage
 {
+    // types
+    public:
+        enum Diffusion                              // error diffusion kernels for Dither_Diffuse
+        {
+            FLOYD_STEINBERG,
+            JARVIS_JUDICE_NINKE,
+            STUCKI
+        };
+
+        enum SaveFormat                             // file formats for Save_Image
+        {
+            SAVE_RAW,                               // 32 bit, uncompressed
+            SAVE_COMPACT                            // run length encoded, 24 bit unless the image uses alpha
+        };
+
+        enum PointOp                                // per pixel operations Run_Pass can chain
+        {
+            POINT_GRAY,                             // To_Grayscale
+            POINT_QUANT_UNIF,                       // Quant_Uniform
+            POINT_THRESHOLD,                        // Dither_Threshold
+            POINT_RANDOM                            // Dither_Random
+        };
+
+        enum FilterKernel                           // convolution filters Filter_Taps builds the kernel of
+        {
+            KERNEL_BOX,                             // Filter_Box
+            KERNEL_BARTLETT,                        // Filter_Bartlett
+            KERNEL_GAUSSIAN_N,                      // Filter_Gaussian_N
+            KERNEL_EDGE,                            // Filter_Edge
+            KERNEL_ENHANCE                          // Filter_Enhance
+        };
+
+        enum DitherPattern                          // ordered dither tiles for Dither_Pattern
+        {
+            BAYER_2,
+            BAYER_4,
+            BAYER_8,
+            BAYER_16,
+            CLUSTERED_DOT,
+            BLUE_NOISE
+        };
+
     // methods
     public:
 	    TargaImage(void);
@@ -19,8 +91,31 @@ class TargaImage
 	    ~TargaImage(void);
 
         unsigned char*	To_RGB(void);	            // Convert the image to RGB format,
-        bool Save_Image(const char*);               // save the image to a file
+        bool To_RGB(unsigned char* rgb);            // Convert the image to RGB format into a width * height * 3 buffer
+        bool Save_Image(const char*, SaveFormat format = SAVE_RAW);  // save the image to a file
         static TargaImage* Load_Image(char*);       // Load a file and return a pointer to a new TargaImage object.  Returns NULL on failure
+        static bool Process_Strips(const char* source, const char* dest, bool (TargaImage::*operation)(),
+                                   int stripRows = 0);  // run a per pixel operation over a file a strip at a time
+
+        bool Set_Planar(bool planar);               // switch between interleaved and planar pixel storage
+        bool Is_Planar() const { return planes[0] != NULL; }
+
+        static ScratchStats Get_Scratch_Stats();    // scratch memory use so far
+        static void Trim_Scratch();                 // return the calling thread's cached scratch to the heap
+
+        static void Set_Thread_Count(int count);    // threads used by the image operations, 0 for one per core
+        static int Get_Thread_Count();
+
+        class Serial_Scope                          // while one exists, image operations run on the calling thread
+        {                                           // only; the threads are kept for later
+            public:
+                Serial_Scope();
+                ~Serial_Scope();
+
+            private:
+                Serial_Scope(const Serial_Scope&);
+                Serial_Scope& operator=(const Serial_Scope&);
+        };
 
         bool To_Grayscale();
 
@@ -31,8 +126,10 @@ class TargaImage
         bool Dither_Threshold();
         bool Dither_Random();
         bool Dither_FS();
+        bool Dither_Diffuse(Diffusion kernel, bool color);  // error diffusion with a choice of kernel
         bool Dither_Bright();
         bool Dither_Cluster();
+        bool Dither_Pattern(DitherPattern pattern);    // ordered dither against a threshold tile
         bool Dither_Color();
 
         bool Comp_Over(TargaImage* pImage);
@@ -42,14 +139,21 @@ class TargaImage
         bool Comp_Xor(TargaImage* pImage);
 
         bool Difference(TargaImage* pImage);
+        bool Difference(TargaImage* pImage, DiffStats& stats, int tolerance = 0);      // difference and measure it
+        bool Compare(TargaImage* pImage, DiffStats& stats, int tolerance = 0, size_t maxChanged = 0);   // measure without a difference image
 
         bool Filter_Box();
+        bool Filter_Box(unsigned int radius);       // box of any radius, at a cost that does not grow with it
         bool Filter_Bartlett();
         bool Filter_Gaussian();
         bool Filter_Gaussian_N(unsigned int N);
+        static bool Gaussian_Uses_Boxes(unsigned int N);   // Filter_Gaussian_N approximates with box passes, not a kernel
         bool Filter_Edge();
         bool Filter_Enhance();
 
+        bool Run_Pass(const FusedPass& pass);       // run several operations in one pass over the image
+        static bool Filter_Taps(FilterKernel filter, unsigned int N, std::vector<float>& taps, int& size);  // N is for KERNEL_GAUSSIAN_N
+
         bool NPR_Paint();
 
         bool Half_Size();
@@ -65,9 +169,6 @@ class TargaImage
 	// helper function for format conversion
         void RGBA_To_RGB(unsigned char *rgba, unsigned char *rgb);
 
-        // reverse the rows of the image, some targas are stored bottom to top
-	TargaImage* Reverse_Rows(void);
-
 	// clear image to all black
         void ClearToBlack();
 
@@ -77,7 +178,25 @@ class TargaImage
         int		width;	    // width of the image in pixels
         int		height;	    // height of the image in pixels
         unsigned char	*data;	    // pixel data for the image, assumed to be in pre-multiplied RGBA format.
+                                    // Not kept up to date while the image is planar.
+        unsigned char   *planes[4]; // planar pixel data, one 64 byte aligned R, G, B and A plane.  All NULL
+                                    // unless the image is planar.
+        int             stride;     // bytes per row of each plane, a multiple of 64
+
+};
 
+// Operations fused into one pass over an image, see TargaImage::Run_Pass.
+// The before operations are applied to the pixels as they are read, the
+// kernel, if there is one, convolves red, green and blue as the filters
+// do, and the after operations are applied to the results while they are
+// still in cache.  A pass holds at most one POINT_RANDOM, and with a
+// kernel it must come after it.
+struct FusedPass
+{
+    std::vector<TargaImage::PointOp>    before;
+    std::vector<float>                  kernel;     // size * size taps, empty for no filter
+    int                                 size;
+    std::vector<TargaImage::PointOp>    after;
 };
 
 class Stroke { // Data structure for holding painterly strokes.
@@ -91,6 +210,131 @@ public:
    unsigned char r, g, b, a;	// Color
 };
 
+// An ordered list of layers composited over an image in one pass.  Layers
+// are added bottom first and resolved front to back, tile by tile, so a 
+// tile stops reading layers once it is opaque and skips layers that are 
+// clear there.  The stack does not own its layers.  A layer's tile summary
+// is taken when it is added; call Refresh after changing a layer's pixels.
+class CompositeStack
+{
+    public:
+        CompositeStack();
+
+        bool Add_Layer(TargaImage* pLayer);         // stack a layer above the others, false if the size differs
+        void Refresh();                             // retake the tile summaries of all layers
+        void Clear();                               // remove all layers
+        int Layer_Count() const { return (int)m_layers.size(); }
+
+        bool Resolve(TargaImage* pImage);           // composite the layers over the image, in place
+
+    private:
+        // what a layer holds in one tile
+        struct TileSummary
+        {
+            unsigned char   minAlpha;               // 255 if the layer hides everything below in the tile
+            unsigned char   maxSample;              // 0 if the layer is clear in the tile
+        };
+
+        void Summarize(int index);
+
+        std::vector<TargaImage*>    m_layers;       // bottom layer first
+        std::vector<TileSummary>    m_summaries;    // tiles of each layer, layer by layer
+        int                         m_width;        // size of the layers, set by the first one
+        int                         m_height;
+        int                         m_tilesX;       // tiles across and down
+        int                         m_tilesY;
+};
+
+// Successively halved copies of an image, for thumbnails of many sizes.
+// Level 0 is the image itself and each level after is the one before
+// halved with the [1 3 3 1] binomial filter, down to 1x1.  All levels are
+// built in one pass over the image, each row of a level reduced into the
+// next as soon as the rows below it are done, and kept in one block of
+// interleaved premultiplied RGBA.
+class MipPyramid
+{
+    public:
+        MipPyramid();
+        ~MipPyramid();
+
+        bool Build(TargaImage* pImage, int levels = 0);     // levels to keep, 0 for all of them
+        void Clear();
+
+        int Level_Count() const { return (int)m_levels.size(); }
+        int Level_Width(int level) const { return m_levels[level].width; }
+        int Level_Height(int level) const { return m_levels[level].height; }
+        const unsigned char* Level_Data(int level) const { return m_pData + m_levels[level].offset; }
+
+        TargaImage* Thumbnail(int width, int height) const;    // a new image of that size, from the nearest level at least as large
+
+    private:
+        MipPyramid(const MipPyramid&);
+        MipPyramid& operator=(const MipPyramid&);
+
+        struct Level
+        {
+            int             width;
+            int             height;
+            size_t          offset;                 // of the first pixel in m_pData
+        };
+
+        std::vector<Level>  m_levels;               // largest first
+        unsigned char       *m_pData;               // pixels of all levels
+};
+
+// Reads a targa a strip of rows at a time, top row first, so images too 
+// large for memory can be processed.  The file is mapped; run length 
+// encoded files are expanded a strip at a time.  Only true color 24 and 32
+// bit files can be streamed.
+class TargaReader
+{
+    public:
+        TargaReader();
+        ~TargaReader();
+
+        bool Open(const char* filename);            // false if the file is missing or cannot be streamed
+        void Close();
+        int Width() const { return m_width; }
+        int Height() const { return m_height; }
+        int Next_Row() const { return m_row; }      // first row the next strip holds
+
+        bool Read_Strip(TargaImage* pStrip, int rows = 0);  // read the next rows into pStrip, false at the end or on error
+
+    private:
+        TargaReader(const TargaReader&);
+        TargaReader& operator=(const TargaReader&);
+
+        struct Source;                              // the mapped file and where its rows start
+
+        Source      *m_pSource;
+        int         m_width;
+        int         m_height;
+        int         m_row;
+};
+
+// Writes a 32 bit targa a strip of rows at a time, top row first, as the
+// strips are finished.
+class TargaWriter
+{
+    public:
+        TargaWriter();
+        ~TargaWriter();
+
+        bool Open(const char* filename, int width, int height);
+        bool Write_Strip(TargaImage* pStrip);       // append rows below those written, the strip must be as wide as the file
+        bool Close();                               // false unless every row was written
+
+    private:
+        TargaWriter(const TargaWriter&);
+        TargaWriter& operator=(const TargaWriter&);
+
+        FILE        *m_pFile;
+        int         m_width;
+        int         m_height;
+        int         m_row;                          // rows written so far
+        bool        m_bFailed;                      // a write failed
+};
+
 #endif
 
 
@@ -0,0 +1,104 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ThreadBench.cpp
+//
+//      Times the row parallel operations and filters with the tile pool at
+//  1, 2, 4, ... threads up to one per hardware thread, and reports the
+//  speedup over one thread, which is how they all ran before the pool.
+//  Each result is checked byte for byte against the one thread result.
+//  Run by make bench.  An optional width and height set the image size,
+//  and a third argument the largest thread count.  Returns 0 if every 
+//  thread count gave the same output.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "CheckImages.h"
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+// constants
+const char*     c_asNames[]         = { "gray", "quant-unif", "threshold", "bartlett", "gauss-n 9", "box 5", "over", "difference" };
+const int       c_nOps              = 8;
+const int       c_nRuns             = 3;        // timed runs, the best is reported
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run operation op on the image, with other as the second image of
+//  the two image operations.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Run_Op(int op, TargaImage* pImage, TargaImage* pOther)
+{
+    switch (op)
+    {
+        case 0:     pImage->To_Grayscale();         break;
+        case 1:     pImage->Quant_Uniform();        break;
+        case 2:     pImage->Dither_Threshold();     break;
+        case 3:     pImage->Filter_Bartlett();      break;
+        case 4:     pImage->Filter_Gaussian_N(9);   break;
+        case 5:     pImage->Filter_Box();           break;
+        case 6:     pImage->Comp_Over(pOther);      break;
+        case 7:     pImage->Difference(pOther);     break;
+    }
+}// Run_Op
+
+
+int main(int argc, char* argv[])
+{
+    int             width = argc > 2 ? atoi(argv[1]) : 3840, height = argc > 2 ? atoi(argv[2]) : 2160;
+    int             cores = max(1, (int)thread::hardware_concurrency());
+    int             maxThreads = argc > 3 ? max(1, atoi(argv[3])) : cores;
+    vector<int>     counts;
+    TargaImage      source(width, height), other(width, height);
+    int             failures = 0;
+
+    for (int count = 1 ; count < maxThreads ; count *= 2)
+        counts.push_back(count);
+    counts.push_back(maxThreads);
+    Fill_Premultiplied(&source, 1);
+    Fill_Premultiplied(&other, 2);
+
+    printf("%dx%d, %d hardware threads; ms and speedup over one thread\n%-11s", width, height, cores, "threads");
+    for (size_t i = 0 ; i < counts.size() ; i++)
+        printf("  %13d", counts[i]);
+    printf("\n");
+
+    for (int op = 0 ; op < c_nOps ; op++)
+    {
+        TargaImage  serial(source);
+        double      serialMs = 0;
+
+        TargaImage::Set_Thread_Count(1);
+        Run_Op(op, &serial, &other);
+        printf("%-11s", c_asNames[op]);
+        for (size_t i = 0 ; i < counts.size() ; i++)
+        {
+            TargaImage  pooled(source);
+
+            TargaImage::Set_Thread_Count(counts[i]);
+            Run_Op(op, &pooled, &other);
+            if (memcmp(serial.data, pooled.data, (size_t)width * height * 4))
+            {
+                printf("\n%s differs with %d threads\n", c_asNames[op], counts[i]);
+                failures++;
+            }
+
+            double  ms = Best_Ms(source, c_nRuns, [op, &other](TargaImage* pImage) { Run_Op(op, pImage, &other); });
+
+            if (i == 0)
+                serialMs = ms;
+            printf("  %7.1f %5.2fx", ms, serialMs / ms);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}// main